@@ -6,6 +6,8 @@
 
 #include "allpass.hpp"
 
+#include <algorithm>
+
 allpass::allpass()
 {
 	bufidx = 0;
@@ -15,6 +17,7 @@ void allpass::setbuffer(float *buf, int size)
 {
 	buffer = buf; 
 	bufsize = size;
+	bufidx = 0;
 }
 
 void allpass::mute()
@@ -23,6 +26,28 @@ void allpass::mute()
 		buffer[i]=0;
 }
 
+void allpass::process(float *samples, int numsamples)
+{
+	// Within one pass round the delay line no sample is read after it is
+	// written, so there is no dependency between iterations
+	while (numsamples > 0)
+	{
+		const int count = std::min(numsamples, bufsize - bufidx);
+		float *buf = buffer + bufidx;
+		for (int i=0; i<count; i++)
+		{
+			const float input = samples[i];
+			const float bufout = undenormalised(buf[i]);
+			samples[i] = -input + bufout;
+			buf[i] = input + (bufout*feedback);
+		}
+		samples += count;
+		numsamples -= count;
+		bufidx += count;
+		if (bufidx >= bufsize) bufidx = 0;
+	}
+}
+
 void allpass::setfeedback(float val) 
 {
 	feedback = val;
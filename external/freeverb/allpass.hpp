@@ -14,6 +14,8 @@ public:
 					allpass();
 			void	setbuffer(float *buf, int size);
 	inline  float	process(float inp);
+			// Filters a block in place; the same as process() on each sample
+			void	process(float *samples, int numsamples);
 			void	mute();
 			void	setfeedback(float val);
 			float	getfeedback();
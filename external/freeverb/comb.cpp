@@ -6,6 +6,9 @@
 
 #include "comb.hpp"
 
+#include <algorithm>
+#include <assert.h>
+
 comb::comb()
 {
 	filterstore = 0;
@@ -45,4 +48,96 @@ float comb::getfeedback()
 	return feedback;
 }
 
+combbank::combbank()
+{
+	feedback = damp1 = damp2 = 0;
+	buffer = 0;
+	bufsize = 0;
+	bufidx = 0;
+	for (int c=0; c<numcombs; c++)
+	{
+		filterstore[c] = 0;
+		delay[c] = 0;
+	}
+}
+
+void combbank::setbuffer(frame *buf, const int *sizes)
+{
+	buffer = buf;
+	std::copy(sizes, sizes + numcombs, delay);
+	bufsize = *std::max_element(delay, delay + numcombs);
+	bufidx = 0;
+}
+
+int combbank::getmaxblock()
+{
+	return std::min((int) maxblock, *std::min_element(delay, delay + numcombs));
+}
+
+void combbank::process(const float *input, float *output, int numsamples)
+{
+	assert(numsamples <= getmaxblock());
+
+	// Every sample read here was written at least one delay ago, so the
+	// whole block can be read before any of it is written
+	float delayed[maxblock][numcombs];
+	for (int c=0; c<numcombs; c++)
+	{
+		int idx = bufidx - delay[c];
+		if (idx < 0) idx += bufsize;
+		for (int i=0; i<numsamples; )
+		{
+			const int count = std::min(numsamples - i, bufsize - idx);
+			for (int j=0; j<count; j++)
+				delayed[i+j][c] = buffer[idx+j][c];
+			i += count;
+			idx = 0;
+		}
+	}
+
+	// Local copies, so that the compiler can keep them in registers
+	float store[numcombs];
+	std::copy(filterstore, filterstore + numcombs, store);
+	const float fb = feedback, d1 = damp1, d2 = damp2;
+
+	for (int i=0; i<numsamples; i++)
+	{
+		const float in = input[i];
+		float *feedin = buffer[bufidx];
+		for (int c=0; c<numcombs; c++)
+		{
+			const float out = undenormalised(delayed[i][c]);
+			store[c] = undenormalised((out*d2) + (store[c]*d1));
+			feedin[c] = in + (store[c]*fb);
+			delayed[i][c] = out;
+		}
+		if(++bufidx>=bufsize) bufidx = 0;
+
+		// Summed in order, as the per-sample combs were
+		float sum = 0;
+		for (int c=0; c<numcombs; c++)
+			sum += delayed[i][c];
+		output[i] = sum;
+	}
+
+	std::copy(store, store + numcombs, filterstore);
+}
+
+void combbank::mute()
+{
+	std::fill(buffer[0], buffer[0] + bufsize * numcombs, 0.0f);
+	std::fill(filterstore, filterstore + numcombs, 0.0f);
+}
+
+void combbank::setdamp(float val)
+{
+	damp1 = val;
+	damp2 = 1-val;
+}
+
+void combbank::setfeedback(float val)
+{
+	feedback = val;
+}
+
 // ends
@@ -8,6 +8,7 @@
 #define _comb_
 
 #include "denormals.h"
+#include "tuning.h"
 
 class comb
 {
@@ -50,6 +51,40 @@ inline float comb::process(float input)
 	return output;
 }
 
+// A channel's combs, run in lockstep with one comb per SIMD lane. The eight
+// delay lines share one ring buffer of frames, one float per comb, with a
+// single write position, so each sample's feedback is written as one vector.
+// Each comb reads its own delay behind it; the block's reads are copied out
+// together, since none of them can see this block's writes. The output is
+// identical to summing comb::process() for each comb in order.
+class combbank
+{
+public:
+	typedef float frame[numcombs];
+
+	// The most samples process() handles per call
+	static const int maxblock = 64;
+
+					combbank();
+			// buf holds at least as many frames as the longest delay
+			void	setbuffer(frame *buf, const int *sizes);
+			// Samples per call that can be read before any are written
+			int		getmaxblock();
+			void	process(const float *input, float *output, int numsamples);
+			void	mute();
+			void	setdamp(float val);
+			void	setfeedback(float val);
+private:
+	float	feedback;
+	float	damp1;
+	float	damp2;
+	float	filterstore[numcombs];
+	frame	*buffer;
+	int		bufsize;	// frames in use, the longest delay
+	int		bufidx;		// write position
+	int		delay[numcombs];
+};
+
 #endif //_comb_
 
 //ends
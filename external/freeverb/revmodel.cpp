@@ -4,6 +4,7 @@
 // http://www.dreampoint.co.uk
 // This code is public domain
 
+#include <algorithm>
 #include <assert.h>
 #include <iostream>
 #include "revmodel.hpp"
@@ -13,6 +14,7 @@ revmodel::revmodel()
 ,	wet1z(0.F)
 ,	wet2z(0.F)
 ,	mode(initialmode)
+,	arenarate(0)
 {
     setrate(44100);
 
@@ -37,32 +39,52 @@ revmodel::revmodel()
 
 void revmodel::setrate(int rate)
 {
-    assert(rate <= TUNING_MAX_SAMPLE_RATE);
-
-    combL[0].setbuffer(bufcombL1, TUNING(combtuningL1, rate));
-    combR[0].setbuffer(bufcombR1, TUNING(combtuningR1, rate));
-    combL[1].setbuffer(bufcombL2, TUNING(combtuningL2, rate));
-    combR[1].setbuffer(bufcombR2, TUNING(combtuningR2, rate));
-    combL[2].setbuffer(bufcombL3, TUNING(combtuningL3, rate));
-    combR[2].setbuffer(bufcombR3, TUNING(combtuningR3, rate));
-    combL[3].setbuffer(bufcombL4, TUNING(combtuningL4, rate));
-    combR[3].setbuffer(bufcombR4, TUNING(combtuningR4, rate));
-    combL[4].setbuffer(bufcombL5, TUNING(combtuningL5, rate));
-    combR[4].setbuffer(bufcombR5, TUNING(combtuningR5, rate));
-    combL[5].setbuffer(bufcombL6, TUNING(combtuningL6, rate));
-    combR[5].setbuffer(bufcombR6, TUNING(combtuningR6, rate));
-    combL[6].setbuffer(bufcombL7, TUNING(combtuningL7, rate));
-    combR[6].setbuffer(bufcombR7, TUNING(combtuningR7, rate));
-    combL[7].setbuffer(bufcombL8, TUNING(combtuningL8, rate));
-    combR[7].setbuffer(bufcombR8, TUNING(combtuningR8, rate));
-    allpassL[0].setbuffer(bufallpassL1, TUNING(allpasstuningL1, rate));
-    allpassR[0].setbuffer(bufallpassR1, TUNING(allpasstuningR1, rate));
-    allpassL[1].setbuffer(bufallpassL2, TUNING(allpasstuningL2, rate));
-    allpassR[1].setbuffer(bufallpassR2, TUNING(allpasstuningR2, rate));
-    allpassL[2].setbuffer(bufallpassL3, TUNING(allpasstuningL3, rate));
-    allpassR[2].setbuffer(bufallpassR3, TUNING(allpasstuningR3, rate));
-    allpassL[3].setbuffer(bufallpassL4, TUNING(allpasstuningL4, rate));
-    allpassR[3].setbuffer(bufallpassR4, TUNING(allpasstuningR4, rate));
+    const int combsizesL[numcombs] = {
+        TUNING(combtuningL1, rate), TUNING(combtuningL2, rate), TUNING(combtuningL3, rate), TUNING(combtuningL4, rate),
+        TUNING(combtuningL5, rate), TUNING(combtuningL6, rate), TUNING(combtuningL7, rate), TUNING(combtuningL8, rate) };
+    const int combsizesR[numcombs] = {
+        TUNING(combtuningR1, rate), TUNING(combtuningR2, rate), TUNING(combtuningR3, rate), TUNING(combtuningR4, rate),
+        TUNING(combtuningR5, rate), TUNING(combtuningR6, rate), TUNING(combtuningR7, rate), TUNING(combtuningR8, rate) };
+    const int allpasssizesL[numallpasses] = {
+        TUNING(allpasstuningL1, rate), TUNING(allpasstuningL2, rate), TUNING(allpasstuningL3, rate), TUNING(allpasstuningL4, rate) };
+    const int allpasssizesR[numallpasses] = {
+        TUNING(allpasstuningR1, rate), TUNING(allpasstuningR2, rate), TUNING(allpasstuningR3, rate), TUNING(allpasstuningR4, rate) };
+
+    // The comb rings are as long as their longest comb
+    const int combframesL = *std::max_element(combsizesL, combsizesL + numcombs);
+    const int combframesR = *std::max_element(combsizesR, combsizesR + numcombs);
+
+    // Holds the old buffers until the combs and allpasses have been pointed
+    // at the new ones, and frees them on return
+    std::vector<float> previous;
+    if (rate != arenarate)
+    {
+        size_t size = (combframesL + combframesR) * numcombs;
+        for (int i=0; i<numallpasses; i++)
+            size += allpasssizesL[i] + allpasssizesR[i];
+        previous.swap(arena);
+        arena.assign(size, 0.0f);
+        arenarate = rate;
+    }
+
+    float *next = arena.data();
+    combL.setbuffer((combbank::frame *) next, combsizesL);
+    next += combframesL * numcombs;
+    combR.setbuffer((combbank::frame *) next, combsizesR);
+    next += combframesR * numcombs;
+    for (int i=0; i<numallpasses; i++)
+    {
+        allpassL[i].setbuffer(next, allpasssizesL[i]);
+        next += allpasssizesL[i];
+        allpassR[i].setbuffer(next, allpasssizesR[i]);
+        next += allpasssizesR[i];
+    }
+
+    blocksize = std::min(combL.getmaxblock(), combR.getmaxblock());
+
+    // Longest path from input to output: the longest comb, then every allpass
+    taillength = TUNING(combtuningR8, rate) + TUNING(allpasstuningR1, rate) + TUNING(allpasstuningR2, rate)
+               + TUNING(allpasstuningR3, rate) + TUNING(allpasstuningR4, rate);
 
     // Buffer will be full of rubbish - so we MUST mute them
     mute();
@@ -73,11 +95,8 @@ void revmodel::mute()
 	if (getmode() >= freezemode)
 		return;
 
-	for (int i=0;i<numcombs;i++)
-	{
-		combL[i].mute();
-		combR[i].mute();
-	}
+	combL.mute();
+	combR.mute();
 	for (int i=0;i<numallpasses;i++)
 	{
 		allpassL[i].mute();
@@ -85,126 +104,128 @@ void revmodel::mute()
 	}
 }
 
+long revmodel::gettaillength()
+{
+	return taillength;
+}
+
+void revmodel::processwet(const float *input, float *outL, float *outR, int numsamples)
+{
+	// Accumulate comb filters in parallel
+	combL.process(input, outL, numsamples);
+	combR.process(input, outR, numsamples);
+
+	// Feed through allpasses in series
+	for(int i=0; i<numallpasses; i++)
+	{
+		allpassL[i].process(outL, numsamples);
+		allpassR[i].process(outR, numsamples);
+	}
+}
+
 void 
 revmodel::processreplace(float *inputL, float *inputR, float *outputL, float *outputR, long numsamples, int skip)
 {
-	float outL,outR,input;
-	int i;
+	float input[combbank::maxblock], outL[combbank::maxblock], outR[combbank::maxblock];
 
-	while(numsamples-- > 0)
+	while(numsamples > 0)
 	{
-		outL = outR = 0;
-		input = (*inputL) * gain;
+		const int count = (int) std::min(numsamples, (long) blocksize);
 
-		// Accumulate comb filters in parallel
-		for(i=0; i<numcombs; i++)
-		{
-			outL += combL[i].process(input);
-			outR += combR[i].process(input);
-		}
+		for(int i=0; i<count; i++)
+			input[i] = inputL[i * skip] * gain;
+
+		processwet(input, outL, outR, count);
 
-		// Feed through allpasses in series
-		for(i=0; i<numallpasses; i++)
+		for(int i=0; i<count; i++)
 		{
-			outL = allpassL[i].process(outL);
-			outR = allpassR[i].process(outR);
+			// De-zipper
+			float d = (dryz += ((dry - dryz) * 0.005F));
+			float w1 = (wet1z += ((wet1 - wet1z) * 0.005F));
+			float w2 = (wet2z += ((wet2 - wet2z) * 0.005F));
+
+			// Calculate output REPLACING anything already there
+			*outputL = outL[i]*w1 + outR[i]*w2 + *inputL*d;
+			*outputR = outR[i]*w1 + outL[i]*w2 + *inputR*d;
+
+			// Increment sample pointers, allowing for interleave (if any)
+			inputL += skip;
+			inputR += skip;
+			outputL += skip;
+			outputR += skip;
 		}
 
-		// De-zipper
-		float d = (dryz += ((dry - dryz) * 0.005F));
-		float w1 = (wet1z += ((wet1 - wet1z) * 0.005F));
-		float w2 = (wet2z += ((wet2 - wet2z) * 0.005F));
-
-		// Calculate output REPLACING anything already there
-		*outputL = outL*w1 + outR*w2 + *inputL*d;
-		*outputR = outR*w1 + outL*w2 + *inputR*d;
-
-		// Increment sample pointers, allowing for interleave (if any)
-		inputL += skip;
-		inputR += skip;
-		outputL += skip;
-		outputR += skip;
+		numsamples -= count;
 	}
 }
 
 void 
 revmodel::processreplace(float *inputM, float *outputL, float *outputR, long numsamples, int stride_in, int stride_out)
 {
-	float outL,outR,input;
-	int i;
+	float input[combbank::maxblock], outL[combbank::maxblock], outR[combbank::maxblock];
 
-	while(numsamples-- > 0)
+	while(numsamples > 0)
 	{
-		outL = outR = 0;
-		input = (*inputM) * gain;
+		const int count = (int) std::min(numsamples, (long) blocksize);
 
-		// Accumulate comb filters in parallel
-		for(i=0; i<numcombs; i++)
-		{
-			outL += combL[i].process(input);
-			outR += combR[i].process(input);
-		}
+		for(int i=0; i<count; i++)
+			input[i] = inputM[i * stride_in] * gain;
 
-		// Feed through allpasses in series
-		for(i=0; i<numallpasses; i++)
+		processwet(input, outL, outR, count);
+
+		for(int i=0; i<count; i++)
 		{
-			outL = allpassL[i].process(outL);
-			outR = allpassR[i].process(outR);
+			// De-zipper
+			float d = (dryz += ((dry - dryz) * 0.005F));
+			float w1 = (wet1z += ((wet1 - wet1z) * 0.005F));
+			float w2 = (wet2z += ((wet2 - wet2z) * 0.005F));
+
+			// Calculate output REPLACING anything already there
+			*outputL = outL[i]*w1 + outR[i]*w2 + *inputM*d;
+			*outputR = outR[i]*w1 + outL[i]*w2 + *inputM*d;
+
+			// Increment sample pointers, allowing for interleave (if any)
+			inputM += stride_in;
+			outputL += stride_out;
+			outputR += stride_out;
 		}
 
-		// De-zipper
-		float d = (dryz += ((dry - dryz) * 0.005F));
-		float w1 = (wet1z += ((wet1 - wet1z) * 0.005F));
-		float w2 = (wet2z += ((wet2 - wet2z) * 0.005F));
-
-		// Calculate output REPLACING anything already there
-		*outputL = outL*w1 + outR*w2 + *inputM*d;
-		*outputR = outR*w1 + outL*w2 + *inputM*d;
-
-		// Increment sample pointers, allowing for interleave (if any)
-		inputM += stride_in;
-		outputL += stride_out;
-		outputR += stride_out;
+		numsamples -= count;
 	}
 }
 
 void revmodel::processmix(float *inputL, float *inputR, float *outputL, float *outputR, long numsamples, int skip)
 {
-	float outL,outR,input;
+	float input[combbank::maxblock], outL[combbank::maxblock], outR[combbank::maxblock];
 
-	while(numsamples-- > 0)
+	while(numsamples > 0)
 	{
-		outL = outR = 0;
-		input = (*inputL + *inputR) * gain;
+		const int count = (int) std::min(numsamples, (long) blocksize);
 
-		// Accumulate comb filters in parallel
-		for(int i=0; i<numcombs; i++)
-		{
-			outL += combL[i].process(input);
-			outR += combR[i].process(input);
-		}
+		for(int i=0; i<count; i++)
+			input[i] = (inputL[i * skip] + inputR[i * skip]) * gain;
+
+		processwet(input, outL, outR, count);
 
-		// Feed through allpasses in series
-		for(int i=0; i<numallpasses; i++)
+		for(int i=0; i<count; i++)
 		{
-			outL = allpassL[i].process(outL);
-			outR = allpassR[i].process(outR);
+			// De-zipper
+			float d = (dryz += ((dry - dryz) * 0.005F));
+			float w1 = (wet1z += ((wet1 - wet1z) * 0.005F));
+			float w2 = (wet2z += ((wet2 - wet2z) * 0.005F));
+
+			// Calculate output MIXING with anything already there
+			*outputL += outL[i]*w1 + outR[i]*w2 + *inputL*d;
+			*outputR += outR[i]*w1 + outL[i]*w2 + *inputR*d;
+
+			// Increment sample pointers, allowing for interleave (if any)
+			inputL += skip;
+			inputR += skip;
+			outputL += skip;
+			outputR += skip;
 		}
 
-		// De-zipper
-		float d = (dryz += ((dry - dryz) * 0.005F));
-		float w1 = (wet1z += ((wet1 - wet1z) * 0.005F));
-		float w2 = (wet2z += ((wet2 - wet2z) * 0.005F));
-
-		// Calculate output MIXING with anything already there
-		*outputL += outL*w1 + outR*w2 + *inputL*d;
-		*outputR += outR*w1 + outL*w2 + *inputR*d;
-
-		// Increment sample pointers, allowing for interleave (if any)
-		inputL += skip;
-		inputR += skip;
-		outputL += skip;
-		outputR += skip;
+		numsamples -= count;
 	}
 }
 
@@ -212,8 +233,6 @@ void revmodel::update()
 {
 // Recalculate internal values after parameter change
 
-	int i;
-
 	wet1 = wet*(width/2 + 0.5f);
 	wet2 = wet*((1-width)/2);
 
@@ -230,17 +249,10 @@ void revmodel::update()
 		gain = fixedgain;
 	}
 
-	for(i=0; i<numcombs; i++)
-	{
-		combL[i].setfeedback(roomsize1);
-		combR[i].setfeedback(roomsize1);
-	}
-
-	for(i=0; i<numcombs; i++)
-	{
-		combL[i].setdamp(damp1);
-		combR[i].setdamp(damp1);
-	}
+	combL.setfeedback(roomsize1);
+	combR.setfeedback(roomsize1);
+	combL.setdamp(damp1);
+	combR.setdamp(damp1);
 }
 
 // The following get/set functions are not inlined, because
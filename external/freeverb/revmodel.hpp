@@ -11,12 +11,16 @@
 #include "allpass.hpp"
 #include "tuning.h"
 
+#include <vector>
+
 class revmodel
 {
 public:
 	revmodel();
+    // Allocates the delay lines for rate; not to be called on the audio thread
     void    setrate(int rate);
     void    mute();
+    long    gettaillength();
     void    processmix(float *inputL, float *inputR, float *outputL, float *outputR, long numsamples, int skip);
     void    processreplace(float *inputL, float *inputR, float *outputL, float *outputR, long numsamples, int skip);
     void    processreplace(float *inputM, float *outputL, float *outputR, long numsamples, int stride_in, int stride_out);
@@ -34,7 +38,11 @@ public:
     float   getmode();
 private:
 	void    update();
+	// Renders the wet signal for up to blocksize samples of (gain scaled) input
+	void    processwet(const float *input, float *outL, float *outR, int numsamples);
 private:
+    long    taillength;
+    int     blocksize;
     float   gain;
 	float   roomsize,roomsize1;
     float   damp,damp1;
@@ -44,45 +52,17 @@ private:
    float   width;
  float   mode;
 
- // The following are all declared inline 
-      // to remove the need for dynamic allocation
-   // with its subsequent error-checking messiness
-
        // Comb filters
-    comb    combL[numcombs];
-    comb    combR[numcombs];
+    combbank combL;
+    combbank combR;
 
       // Allpass filters
     allpass allpassL[numallpasses];
     allpass allpassR[numallpasses];
 
-    // Buffers for the combs
-    float   bufcombL1[TUNING(combtuningL1, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombR1[TUNING(combtuningR1, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombL2[TUNING(combtuningL2, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombR2[TUNING(combtuningR2, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombL3[TUNING(combtuningL3, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombR3[TUNING(combtuningR3, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombL4[TUNING(combtuningL4, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombR4[TUNING(combtuningR4, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombL5[TUNING(combtuningL5, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombR5[TUNING(combtuningR5, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombL6[TUNING(combtuningL6, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombR6[TUNING(combtuningR6, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombL7[TUNING(combtuningL7, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombR7[TUNING(combtuningR7, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombL8[TUNING(combtuningL8, TUNING_MAX_SAMPLE_RATE)];
-    float   bufcombR8[TUNING(combtuningR8, TUNING_MAX_SAMPLE_RATE)];
-
-    // Buffers for the allpasses
-    float   bufallpassL1[TUNING(allpasstuningL1, TUNING_MAX_SAMPLE_RATE)];
-    float   bufallpassR1[TUNING(allpasstuningR1, TUNING_MAX_SAMPLE_RATE)];
-    float   bufallpassL2[TUNING(allpasstuningL2, TUNING_MAX_SAMPLE_RATE)];
-    float   bufallpassR2[TUNING(allpasstuningR2, TUNING_MAX_SAMPLE_RATE)];
-    float   bufallpassL3[TUNING(allpasstuningL3, TUNING_MAX_SAMPLE_RATE)];
-    float   bufallpassR3[TUNING(allpasstuningR3, TUNING_MAX_SAMPLE_RATE)];
-    float   bufallpassL4[TUNING(allpasstuningL4, TUNING_MAX_SAMPLE_RATE)];
-    float   bufallpassR4[TUNING(allpasstuningR4, TUNING_MAX_SAMPLE_RATE)];
+    // Every comb and allpass buffer, sized for the current rate
+    std::vector<float> arena;
+    int     arenarate;
 };
 
 #endif//_revmodel_
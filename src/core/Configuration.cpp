@@ -52,6 +52,19 @@ Configuration::Defaults	()
 	channels = 2;
 	buffer_size = 128;
 	polyphony = 10;
+	render_threads = 1;
+	block_size = 64;
+	oscillator_engine = "classic";
+	voice_retire_threshold = -200;
+	envelope_shape = "linear";
+	filter_engine = "biquad";
+	voice_kernel = "staged";
+	lfo_mode = "voice";
+	reverb_engine = "freeverb";
+	distortion_oversampling = false;
+	limiter_lookahead = false;
+	pipelined_effects = false;
+	controller_ramps = false;
 	pitch_bend_range = 2;
 	jack_autoconnect = true;
 	jack_client_name_preference = "amsynth";
@@ -98,6 +111,45 @@ Configuration::load	()
 		} else if (buffer=="polyphony"){
 			file >> buffer;
 			std::istringstream(buffer) >> polyphony;
+		} else if (buffer=="render_threads"){
+			file >> buffer;
+			std::istringstream(buffer) >> render_threads;
+		} else if (buffer=="block_size"){
+			file >> buffer;
+			std::istringstream(buffer) >> block_size;
+		} else if (buffer=="oscillator_engine"){
+			file >> buffer;
+			oscillator_engine = buffer;
+		} else if (buffer=="voice_retire_threshold"){
+			file >> buffer;
+			std::istringstream(buffer) >> voice_retire_threshold;
+		} else if (buffer=="envelope_shape"){
+			file >> buffer;
+			envelope_shape = buffer;
+		} else if (buffer=="filter_engine"){
+			file >> buffer;
+			filter_engine = buffer;
+		} else if (buffer=="voice_kernel"){
+			file >> buffer;
+			voice_kernel = buffer;
+		} else if (buffer=="lfo_mode"){
+			file >> buffer;
+			lfo_mode = buffer;
+		} else if (buffer=="reverb_engine"){
+			file >> buffer;
+			reverb_engine = buffer;
+		} else if (buffer=="distortion_oversampling"){
+			file >> buffer;
+			distortion_oversampling = (buffer == "true");
+		} else if (buffer=="limiter_lookahead"){
+			file >> buffer;
+			limiter_lookahead = (buffer == "true");
+		} else if (buffer=="pipelined_effects"){
+			file >> buffer;
+			pipelined_effects = (buffer == "true");
+		} else if (buffer=="controller_ramps"){
+			file >> buffer;
+			controller_ramps = (buffer == "true");
 		} else if (buffer=="pitch_bend_range"){
 			file >> buffer;
 			std::istringstream(buffer) >> pitch_bend_range;
@@ -131,6 +183,19 @@ Configuration::save	()
 	fprintf (fout, "alsa_audio_device\t%s\n", alsa_audio_device.c_str());
 	fprintf (fout, "sample_rate\t%d\n", sample_rate);
 	fprintf (fout, "polyphony\t%d\n", polyphony);
+	fprintf (fout, "render_threads\t%d\n", render_threads);
+	fprintf (fout, "block_size\t%d\n", block_size);
+	fprintf (fout, "oscillator_engine\t%s\n", oscillator_engine.c_str());
+	fprintf (fout, "voice_retire_threshold\t%d\n", voice_retire_threshold);
+	fprintf (fout, "envelope_shape\t%s\n", envelope_shape.c_str());
+	fprintf (fout, "filter_engine\t%s\n", filter_engine.c_str());
+	fprintf (fout, "voice_kernel\t%s\n", voice_kernel.c_str());
+	fprintf (fout, "lfo_mode\t%s\n", lfo_mode.c_str());
+	fprintf (fout, "reverb_engine\t%s\n", reverb_engine.c_str());
+	fprintf (fout, "distortion_oversampling\t%s\n", distortion_oversampling ? "true" : "false");
+	fprintf (fout, "limiter_lookahead\t%s\n", limiter_lookahead ? "true" : "false");
+	fprintf (fout, "pipelined_effects\t%s\n", pipelined_effects ? "true" : "false");
+	fprintf (fout, "controller_ramps\t%s\n", controller_ramps ? "true" : "false");
 	fprintf (fout, "pitch_bend_range\t%d\n", pitch_bend_range);
 	fprintf (fout, "tuning_file\t%s\n", current_tuning_file.c_str());
 	fprintf (fout, "ignored_parameters\t%s\n", locked_parameters.c_str());
@@ -80,6 +80,72 @@ public:
 	 * unlimited polyphony.
 	 */
 	int polyphony;
+	/**
+	 * The number of threads used to render voices. 1 renders everything on
+	 * the audio thread.
+	 */
+	int render_threads;
+	/**
+	 * The most frames the synth renders at a time, from 16 to 512. Larger
+	 * blocks use less CPU, but add latency when pipelined_effects is on.
+	 */
+	int block_size;
+	/**
+	 * How voice oscillators generate their waveforms, "classic",
+	 * "wavetable" or "polyblep".
+	 */
+	std::string oscillator_engine;
+	/**
+	 * Released voices quieter than this level, in dBFS, are stopped before
+	 * their envelope finishes. -200, the default, never stops them early.
+	 */
+	int voice_retire_threshold;
+	/**
+	 * "linear" envelope stages, as presets were designed with, or
+	 * "exponential" analog-style curves.
+	 */
+	std::string envelope_shape;
+	/**
+	 * "biquad" is the double precision filter presets were designed with;
+	 * "svf" is a cheaper single precision state variable filter.
+	 */
+	std::string filter_engine;
+	/**
+	 * "staged" renders each voice's osc mix, filter and amp one stage at a
+	 * time; "fused" renders them in a single pass, which may be faster on
+	 * CPUs with small caches.
+	 */
+	std::string voice_kernel;
+	/**
+	 * "voice" gives each voice its own LFO, restarted by each note; "global"
+	 * shares one free-running LFO between all voices.
+	 */
+	std::string lfo_mode;
+	/**
+	 * "freeverb", as presets were designed with, or "fdn", a cheaper
+	 * feedback delay network with the same controls.
+	 */
+	std::string reverb_engine;
+	/**
+	 * Applies the distortion at twice the sample rate to reduce aliasing,
+	 * adding 15 frames of latency.
+	 */
+	bool distortion_oversampling;
+	/**
+	 * Delays the output by 32 frames so that the limiter can keep every
+	 * sample below its threshold.
+	 */
+	bool limiter_lookahead;
+	/**
+	 * Runs the distortion, reverb and limiter on a helper thread, in parallel
+	 * with the voices, at the cost of one block (block_size frames) of latency.
+	 */
+	bool pipelined_effects;
+	/**
+	 * Applies MIDI controllers mapped to parameters, and the pitch wheel, as
+	 * ramps instead of splitting the audio at every event.
+	 */
+	bool controller_ramps;
 	/*
 	 */
 	int pitch_bend_range;
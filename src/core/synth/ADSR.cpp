@@ -23,24 +23,51 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cmath>
 
 static const float kMinimumTime = 0.0005f;
 
+// How far past its target an exponential stage aims, relative to the distance
+// it travels. Attacks aim well past 1 for the steep-then-flattening curve of a
+// charging capacitor; decays and releases aim close to their level.
+static const float kAttackOvershoot = 0.3f;
+static const float kDecayOvershoot = 0.0001f;
+
+// The sustain smoother snaps to the sustain level once this close
+static const float kSustainSettled = 1e-5f;
+
+void
+ADSR::beginStage(State state, float target, float time)
+{
+	m_state = state;
+	m_frames_left_in_state = (int) (time * m_sample_rate);
+	m_target = target;
+
+	if (m_params.shape == Shape::kExponential && m_frames_left_in_state > 0) {
+		// Approach aim = target + overshoot * (target - start) with
+		// x' = aim + (x - aim) * coef, which is exactly at target after
+		// m_frames_left_in_state samples when coef^frames = overshoot / (1 + overshoot)
+		const float overshoot = state == State::kAttack ? kAttackOvershoot : kDecayOvershoot;
+		const float aim = target + overshoot * (target - m_value);
+		m_coef = (float) dsp::exp(dsp::log(overshoot / (1.f + overshoot)) / m_frames_left_in_state);
+		m_inc = aim * (1.f - m_coef);
+	} else {
+		m_coef = 1.f;
+		m_inc = (target - m_value) / (float) m_frames_left_in_state;
+	}
+}
+
 void
 ADSR::triggerOn()
 {
-	m_state = State::kAttack;
-	m_frames_left_in_state = (int) (m_attack * m_sample_rate);
-	const float target = m_decay <= kMinimumTime ? m_sustain : 1.0;
-	m_inc = (target - m_value) / (float) m_frames_left_in_state;
+	const float target = m_params.decay <= kMinimumTime ? m_params.sustain : 1.0;
+	beginStage(State::kAttack, target, m_params.attack);
 }
 
 void 
 ADSR::triggerOff()
 {
-	m_state = State::kRelease;
-	m_frames_left_in_state = (int) (m_release * m_sample_rate);
-	m_inc = (0.f - m_value) / (float) m_frames_left_in_state;
+	beginStage(State::kRelease, 0.f, m_params.release);
 }
 
 void
@@ -48,61 +75,121 @@ ADSR::reset()
 {
 	m_state = State::kOff;
 	m_value = 0;
+	m_coef = 1;
 	m_inc = 0;
 	m_frames_left_in_state = UINT_MAX;
 }
 
+void
+ADSR::endStage()
+{
+	// Rounding leaves an exponential stage just short of its target
+	if (m_coef != 1.f)
+		m_value = m_target;
+
+	switch (m_state) {
+		case State::kAttack:
+			beginStage(State::kDecay, m_params.sustain, m_params.decay);
+			break;
+		case State::kDecay:
+			m_sustain_smoother.set(m_value);
+			m_state = State::kSustain;
+			m_frames_left_in_state = UINT_MAX;
+			m_coef = 1;
+			m_inc = 0;
+			break;
+		case State::kSustain:
+			m_frames_left_in_state = UINT_MAX;
+			break;
+		case State::kRelease:
+		case State::kOff:
+			m_state = State::kOff;
+			m_value = 0;
+			m_frames_left_in_state = UINT_MAX;
+			m_coef = 1;
+			m_inc = 0;
+			break;
+		default:
+			assert(nullptr == "invalid state");
+	}
+}
+
 void
 ADSR::process(float *buffer, unsigned frames)
 {
+	if (isConstant()) {
+		std::fill(buffer, buffer + frames, m_value);
+		return;
+	}
+	render<true>(buffer, frames);
+}
+
+float
+ADSR::advance(unsigned frames)
+{
+	if (isConstant() || frames == 0) {
+		return m_value;
+	}
+	return render<false>(nullptr, frames);
+}
+
+template <bool kWrite>
+float
+ADSR::render(float *buffer, unsigned frames)
+{
+	float last = m_value;
+
 	while (frames) {
 
 		const unsigned int count = std::min(frames, m_frames_left_in_state);
 
-		if (m_state == State::kSustain) {
-			for (unsigned i = 0; i < count; i++) {
-				*buffer = m_value;
-				m_value = m_sustain_smoother.processSample(m_sustain);
-				buffer++;
+		if (count == 0) {
+			// zero length stage
+		} else if (m_state == State::kSustain) {
+			const float sustain = m_params.sustain;
+			if (kWrite) {
+				for (unsigned i = 0; i < count; i++) {
+					*buffer = m_value;
+					m_value = m_sustain_smoother.processSample(sustain);
+					buffer++;
+				}
+				last = buffer[-1];
+			} else {
+				// the smoother's distance to the sustain level shrinks by (1 - 0.005) per sample
+				const float decay = dsp::pow(1.f - 0.005f, (float) (count - 1));
+				last = sustain + (m_value - sustain) * decay;
+				m_value = sustain + (last - sustain) * (1.f - 0.005f);
+				m_sustain_smoother.set(m_value);
 			}
-		} else {
+			if (fabsf(m_value - sustain) < kSustainSettled) {
+				m_value = sustain;
+				m_sustain_smoother.set(sustain);
+			}
+		} else if (kWrite) {
+			const float coef = m_coef, inc = m_inc;
 			for (unsigned i = 0; i < count; i++) {
 				*buffer = m_value;
-				m_value += m_inc;
+				m_value = m_value * coef + inc;
 				buffer++;
 			}
+			last = buffer[-1];
+		} else if (m_coef == 1.f) {
+			last = m_value + m_inc * (float) (count - 1);
+			m_value = last + m_inc;
+		} else {
+			const float aim = m_inc / (1.f - m_coef);
+			last = aim + (m_value - aim) * dsp::pow(m_coef, (float) (count - 1));
+			m_value = last * m_coef + m_inc;
 		}
 
 		m_frames_left_in_state -= count;
 
 		if (m_frames_left_in_state == 0) {
-			switch (m_state) {
-				case State::kAttack:
-					m_state = State::kDecay;
-					m_frames_left_in_state = (int) (m_decay * m_sample_rate);
-					m_inc = (m_sustain - m_value) / (float) m_frames_left_in_state;
-					break;
-				case State::kDecay:
-					m_sustain_smoother.set(m_value);
-					m_state = State::kSustain;
-					m_frames_left_in_state = UINT_MAX;
-					m_inc = 0;
-					break;
-				case State::kSustain:
-					m_frames_left_in_state = UINT_MAX;
-					break;
-				case State::kRelease:
-				case State::kOff:
-					m_state = State::kOff;
-					m_value = 0;
-					m_frames_left_in_state = UINT_MAX;
-					m_inc = 0;
-					break;
-				default:
-					assert(nullptr == "invalid state");
-			}
+			endStage();
 		}
 
 		frames -= count;
 	}
+
+	return last;
 }
@@ -37,19 +37,57 @@ public:
 		kOff
 	};
 
-	void	SetSampleRate	(int value) { m_sample_rate = value; }
+	/**
+	 * kLinear ramps each stage at a constant rate, as presets were designed
+	 * with. kExponential follows the charge and discharge curves of an analog
+	 * envelope generator, reaching each target in the same time.
+	 */
+	enum class Shape {
+		kLinear,
+		kExponential
+	};
+
+	/**
+	 * The envelope times (in seconds) and sustain level. These are part of the
+	 * patch and shared by the envelopes of every voice; each ADSR only holds
+	 * its own playback state.
+	 */
+	struct Parameters
+	{
+		float	attack = 0;
+		float	decay = 0;
+		float	sustain = 1;
+		float	release = 0;
+		Shape	shape = Shape::kLinear;
+	};
+
+	explicit ADSR(const Parameters &parameters): m_params(parameters) {}
 
-	void	SetAttack	(float value) { m_attack = value; }
-	void	SetDecay	(float value) { m_decay = value; }
-	void	SetSustain	(float value) { m_sustain = value; if (m_state == State::kSustain) m_value = value; }
-	void	SetRelease	(float value) { m_release = value; }
+	void	SetSampleRate	(int value) { m_sample_rate = value; }
 	
 	void	process		(float *buffer, unsigned frames);
+
+	/**
+	 * Advances the envelope as process() would, without writing the samples.
+	 * Returns the last sample process() would have written. Each stage is
+	 * evaluated in closed form, so the cost does not depend on frames.
+	 */
+	float	advance		(unsigned frames);
+
+	/**
+	 * True while every sample process() writes will equal getValue(), until
+	 * the note is triggered or released or the sustain level changes. That is
+	 * the off state, or the sustain state once it has settled on its level.
+	 */
+	bool	isConstant	() const { return m_state == State::kOff || (m_state == State::kSustain && m_value == m_params.sustain); }
+	float	getValue	() const { return m_value; }
 	
 	void	triggerOn	();
 	void	triggerOff	();
 
 	int		getState	() { return (m_state == State::kOff) ? 0 : 1; };
+	bool	isReleasing	() const { return m_state == State::kRelease; }
+	unsigned	getFramesLeftInState	() const { return m_frames_left_in_state; }
 
 	/**
 	 * puts the envelope directly into the off (ADSR_OFF) state, without
@@ -58,17 +96,23 @@ public:
 	void reset();
 
 private:
-	float			m_attack = 0;
-	float			m_decay = 0;
-	float			m_sustain = 1;
+	const Parameters &m_params;
 	ParamSmoother	m_sustain_smoother{1.f};
-	float			m_release = 0;
 
 	float			m_sample_rate = 44100;
 	State			m_state = State::kOff;
 
+	void	beginStage	(State state, float target, float time);
+	void	endStage	();
+
+	template <bool kWrite>
+	float	render		(float *buffer, unsigned frames);
+
 	float			m_value = 0.0F;
+	// Each sample of a stage is m_value = m_value * m_coef + m_inc; m_coef is 1 for linear stages
+	float			m_coef = 1.0F;
 	float			m_inc = 0.0F;
+	float			m_target = 0.0F;
 	unsigned		m_frames_left_in_state = UINT_MAX;
 };
 
@@ -0,0 +1,100 @@
+/*
+ *  DenormalGuard.h
+ *
+ *  Copyright (c) 2026 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _DENORMALGUARD_H
+#define _DENORMALGUARD_H
+
+#include <cstdint>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#include <xmmintrin.h>
+#define DENORMAL_GUARD_SSE 1
+#elif defined(__aarch64__) || (defined(__arm__) && defined(__ARM_FP))
+#define DENORMAL_GUARD_ARM 1
+#endif
+
+/**
+ * Flushes denormal results and operands to zero on the calling thread for
+ * the guard's lifetime, then restores the previous mode.
+ *
+ * Decaying envelopes, filter states and reverb tails otherwise pass through
+ * the denormal range on their way to zero, where x86 CPUs take a microcode
+ * assist on every operation. Sets FTZ and DAZ in the SSE control register,
+ * or FZ in the ARM floating point control register; elsewhere it does
+ * nothing.
+ */
+class DenormalGuard
+{
+public:
+	DenormalGuard()
+	{
+#if DENORMAL_GUARD_SSE
+		mSaved = _mm_getcsr();
+		_mm_setcsr(mSaved | kSSEFlushToZero | kSSEDenormalsAreZero);
+#elif DENORMAL_GUARD_ARM
+		mSaved = getControl();
+		setControl(mSaved | kARMFlushToZero);
+#endif
+	}
+
+	~DenormalGuard()
+	{
+#if DENORMAL_GUARD_SSE
+		_mm_setcsr(mSaved);
+#elif DENORMAL_GUARD_ARM
+		setControl(mSaved);
+#endif
+	}
+
+	DenormalGuard(const DenormalGuard&) = delete;
+	DenormalGuard& operator=(const DenormalGuard&) = delete;
+
+private:
+#if DENORMAL_GUARD_SSE
+	static constexpr unsigned kSSEFlushToZero = 0x8000;
+	static constexpr unsigned kSSEDenormalsAreZero = 0x0040;
+	unsigned mSaved;
+#elif DENORMAL_GUARD_ARM
+	// ARM has no separate control for inputs; FZ flushes both
+	static constexpr uintptr_t kARMFlushToZero = 1 << 24;
+	static uintptr_t getControl()
+	{
+		uintptr_t value;
+#if defined(__aarch64__)
+		__asm__ __volatile__("mrs %0, fpcr" : "=r"(value));
+#else
+		__asm__ __volatile__("vmrs %0, fpscr" : "=r"(value));
+#endif
+		return value;
+	}
+	static void setControl(uintptr_t value)
+	{
+#if defined(__aarch64__)
+		__asm__ __volatile__("msr fpcr, %0" : : "r"(value));
+#else
+		__asm__ __volatile__("vmsr fpscr, %0" : : "r"(value));
+#endif
+	}
+	uintptr_t mSaved;
+#endif
+};
+
+#endif
@@ -1,7 +1,7 @@
 /*
  *  Distortion.cpp
  *
- *  Copyright (c) 2001-2012 Nick Dowell
+ *  Copyright (c) 2001-2026 Nick Dowell
  *
  *  This file is part of amsynth.
  *
@@ -20,25 +20,189 @@
  */
 
 #include "Distortion.h"
+
 #include <math.h>
 
+// The float bits of 2^kMinOctave and of the last table point, whose
+// exponent and top mantissa bits index the table
+static const int kMantissaShift = 23 - 5;
+static const uint32_t kMinBits = (uint32_t)(127 + Distortion::kMinOctave) << 23;
+static const uint32_t kMaxBits = (uint32_t)(127 + Distortion::kMinOctave + Distortion::kOctaves) << 23;
+
+static_assert(Distortion::kStepsPerOctave == 1 << (23 - kMantissaShift), "kMantissaShift must match kStepsPerOctave");
+
+// curve(|x|) with the sign of x
+static inline float lookup(const float *table, float x)
+{
+	const uint32_t bits = fast::floatToBits(x);
+	const uint32_t sign = bits & 0x80000000u;
+	const uint32_t magnitude = std::min(bits & 0x7fffffffu, kMaxBits);
+	const uint32_t clamped = std::max(magnitude, kMinBits);
+	const uint32_t index = (clamped >> kMantissaShift) - (kMinBits >> kMantissaShift);
+	const float fraction = (float)(clamped & ((1u << kMantissaShift) - 1)) * (1.f / (1u << kMantissaShift));
+	const float y = table[index] + (table[index + 1] - table[index]) * fraction;
+	return fast::bitsToFloat(fast::floatToBits(magnitude < kMinBits ? 0.f : y) | sign);
+}
+
+Distortion::Distortion()
+{
+	buildCurve(mCurves[0], 0);
+
+	// Blackman windowed sinc, normalised for unity gain at DC
+	float sum = 0;
+	for (int i = 0; i < kHalfBandTaps; i++) {
+		const int k = 2 * i + 1;
+		const double x = m::pi * k / (2 * kHalfBandTaps);
+		const double window = 0.42 + 0.5 * cos(x) + 0.08 * cos(2 * x);
+		mHalfBand[i] = (float)(sin(m::pi * k / 2) / (m::pi * k) * window);
+		sum += mHalfBand[i];
+	}
+	for (float &tap : mHalfBand)
+		tap *= 0.25f / sum;
+
+	reset();
+}
+
 void 
 Distortion::SetCrunch	(float value)
 {
-	crunch=1-value;
+	mCrunch = value;
+}
+
+void
+Distortion::SetOversampling	(bool oversampling)
+{
+	if (oversampling == mOversampling)
+		return;
+	mOversampling = oversampling;
+	reset();
+}
+
+void
+Distortion::reset	()
+{
+	std::fill(mUpHistory, mUpHistory + 2 * kHalfBandTaps - 1, 0.f);
+	std::fill(mDownEvenHistory, mDownEvenHistory + 2 * kHalfBandTaps - 1, 0.f);
+	std::fill(mDownOddHistory, mDownOddHistory + kHalfBandTaps, 0.f);
+}
+
+void
+Distortion::buildCurve	(float *table, float crunch)
+{
+	// (2^octave * step)^exponent, with one powf per step and one exp2f per
+	// octave rather than a powf per point, as crunch may be automated
+	const float exponent = std::max(1 - crunch, 0.01f);
+	float steps[kStepsPerOctave];
+	for (int k = 0; k < kStepsPerOctave; k++)
+		steps[k] = powf(1.f + (float)k / kStepsPerOctave, exponent);
+	for (int i = 0; i < kTableSize; i += kStepsPerOctave) {
+		const float scale = exp2f((float)(kMinOctave + i / kStepsPerOctave) * exponent);
+		for (int k = 0; k < kStepsPerOctave && i + k < kTableSize; k++)
+			table[i + k] = scale * steps[k];
+	}
+}
+
+void
+Distortion::startFade	()
+{
+	buildCurve(mCurves[mCurrent ^ 1], mCrunch);
+	mCurveCrunch = mCrunch;
+	mFadePosition = 0;
+}
+
+void
+Distortion::shape	(float *buffer, int nframes, int fadePosition)
+{
+	const float *from = mCurves[mCurrent], *to = mCurves[mCurrent ^ 1];
+	if (fadePosition >= kFadeFrames) {
+		for (int i = 0; i < nframes; i++)
+			buffer[i] = lookup(from, buffer[i]);
+	} else {
+		for (int i = 0; i < nframes; i++) {
+			const float t = std::min((float)(fadePosition + i) * (1.f / kFadeFrames), 1.f);
+			const float a = lookup(from, buffer[i]);
+			buffer[i] = a + (lookup(to, buffer[i]) - a) * t;
+		}
+	}
 }
 
 void
 Distortion::Process	(float *buffer, unsigned nframes)
 {
-	float x, s;
-	for (unsigned i=0; i<nframes; i++)
-	{
-		x = buffer[i];
-		if(x<0) s=-1; else s=1;
-		x*=s;
-		float c = crunch.tick();
-		x = pow (x, c < 0.01f ? 0.01f : c);
-		buffer[i] = x*s;
+	// Nothing to do, without a latency to keep up
+	if (mCrunch == 0 && mCurveCrunch == 0 && mFadePosition >= kFadeFrames && !mOversampling)
+		return;
+
+	while (nframes > 0) {
+		// A new curve waits for the fade to the last one to finish, so that
+		// automating crunch builds a table at most once every kFadeFrames
+		if (mCrunch != mCurveCrunch && mFadePosition >= kFadeFrames)
+			startFade();
+		const int count = std::min((int)nframes, (int)kMaxBlock);
+		if (mOversampling)
+			processOversampled(buffer, count);
+		else
+			processBlock(buffer, count);
+		buffer += count;
+		nframes -= count;
+	}
+}
+
+void
+Distortion::processBlock	(float *buffer, int nframes)
+{
+	shape(buffer, nframes, mFadePosition);
+	if (mFadePosition < kFadeFrames) {
+		mFadePosition += nframes;
+		if (mFadePosition >= kFadeFrames)
+			mCurrent ^= 1;
+	}
+}
+
+void
+Distortion::processOversampled	(float *buffer, int nframes)
+{
+	const int K = kHalfBandTaps, H = 2 * kHalfBandTaps - 1;
+	const float *a = mHalfBand;
+
+	// Upsample: the odd samples are the input delayed, the even samples are
+	// interpolated between them by the half-band's odd taps
+	float x[H + kMaxBlock], even[kMaxBlock], odd[kMaxBlock];
+	std::copy(mUpHistory, mUpHistory + H, x);
+	std::copy(buffer, buffer + nframes, x + H);
+	std::copy(x + nframes, x + nframes + H, mUpHistory);
+	for (int n = 0; n < nframes; n++) {
+		const float *xn = x + H + n; // xn[-j] is x[n - j]
+		float sum = 0;
+		for (int i = 0; i < K; i++)
+			sum += a[i] * (xn[-(K - 1) + i] + xn[-K - i]);
+		even[n] = 2 * sum;
+		odd[n] = xn[-(K - 1)];
+	}
+
+	if (mCurveCrunch != 0 || mFadePosition < kFadeFrames) {
+		shape(even, nframes, mFadePosition);
+		shape(odd, nframes, mFadePosition);
+		if (mFadePosition < kFadeFrames) {
+			mFadePosition += nframes;
+			if (mFadePosition >= kFadeFrames)
+				mCurrent ^= 1;
+		}
+	}
+
+	// Downsample through the same half-band
+	float ve[H + kMaxBlock], vo[K + kMaxBlock];
+	std::copy(mDownEvenHistory, mDownEvenHistory + H, ve);
+	std::copy(even, even + nframes, ve + H);
+	std::copy(ve + nframes, ve + nframes + H, mDownEvenHistory);
+	std::copy(mDownOddHistory, mDownOddHistory + K, vo);
+	std::copy(odd, odd + nframes, vo + K);
+	std::copy(vo + nframes, vo + nframes + K, mDownOddHistory);
+	for (int n = 0; n < nframes; n++) {
+		const float *en = ve + H + n, *on = vo + K + n;
+		float sum = 0;
+		for (int i = 0; i < K; i++)
+			sum += a[i] * (en[-(K - 1) + i] + en[-K - i]);
+		buffer[n] = 0.5f * on[-K] + sum;
 	}
 }
@@ -1,7 +1,7 @@
 /*
  *  Distortion.h
  *
- *  Copyright (c) 2001-2023 Nick Dowell
+ *  Copyright (c) 2001-2026 Nick Dowell
  *
  *  This file is part of amsynth.
  *
@@ -26,14 +26,64 @@
 
 /**
  * @brief A distortion (waveshaping) effect unit
+ *
+ * The transfer curve, sign(x) |x|^(1 - crunch), is tabulated when crunch
+ * changes, with kStepsPerOctave linearly interpolated points per octave of
+ * |x| (relative error < 4e-5). A change of crunch crossfades from the old
+ * table to the new one over kFadeFrames; further changes wait for the fade
+ * to finish, so automation costs at most one table per kFadeFrames. While
+ * crunch is 0 the curve is the identity and the buffer is left untouched.
+ *
+ * With oversampling the curve is applied at twice the sample rate, between
+ * a pair of polyphase half-band FIR filters, so that the harmonics it adds
+ * above half the sample rate are filtered out rather than aliased. This
+ * delays the output by getLatency() frames and costs about four times as
+ * much as shaping at the sample rate.
  */
 class Distortion
 {
 public:
+	static constexpr int kStepsPerOctave = 32;
+	static constexpr int kFadeFrames = 512;
+	// Half-band filter taps either side of the centre, which is followed by
+	// kHalfBandTaps - 1 frames of delay in each direction
+	static constexpr int kHalfBandTaps = 8;
+	static constexpr int kOversamplingLatency = 2 * kHalfBandTaps - 1;
+	// Tabulated for |x| from 2^kMinOctave up to 2^(kMinOctave + kOctaves); smaller values map to 0
+	static constexpr int kMinOctave = -32;
+	static constexpr int kOctaves = 40;
+
+	Distortion();
+
 	void	SetCrunch		(float);
+	void	SetOversampling	(bool);
+	bool	getOversampling	() const { return mOversampling; }
+	unsigned	getLatency	() const { return mOversampling ? kOversamplingLatency : 0; }
 	void	Process			(float *buffer, unsigned);
+	void	reset			();
+
 private:
-	SmoothedParam crunch{1};
+	static constexpr int kTableSize = kOctaves * kStepsPerOctave + 2;
+	static constexpr int kMaxBlock = 64;
+
+	void	buildCurve		(float *table, float crunch);
+	void	startFade		();
+	void	shape			(float *buffer, int nframes, int fadePosition);
+	void	processBlock	(float *buffer, int nframes);
+	void	processOversampled	(float *buffer, int nframes);
+
+	float	mCrunch = 0;
+	float	mCurveCrunch = 0;		// the crunch of the table being faded to, or in use
+	bool	mOversampling = false;
+
+	float	mCurves[2][kTableSize];
+	int		mCurrent = 0;			// the table in use, or being faded from
+	int		mFadePosition = kFadeFrames;
+
+	float	mHalfBand[kHalfBandTaps];	// odd taps, from the centre out
+	float	mUpHistory[2 * kHalfBandTaps - 1];
+	float	mDownEvenHistory[2 * kHalfBandTaps - 1];
+	float	mDownOddHistory[kHalfBandTaps];
 };
 
 #endif
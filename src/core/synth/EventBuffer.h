@@ -0,0 +1,87 @@
+/*
+ *  EventBuffer.h
+ *
+ *  Copyright (c) 2026 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _EVENTBUFFER_H
+#define _EVENTBUFFER_H
+
+#include "core/types.h"
+
+/**
+ * A list of events with a fixed capacity, stored inline, so that hosts can
+ * collect a buffer's MIDI on the audio thread without touching the heap.
+ *
+ * Keep one per plug-in instance or audio driver rather than on the stack;
+ * events that arrive once it is full are dropped.
+ */
+template <typename T, unsigned Capacity>
+class EventBuffer
+{
+public:
+	static constexpr unsigned kCapacity = Capacity;
+
+	bool push_back(const T &event)
+	{
+		if (mSize == Capacity)
+			return false;
+		mEvents[mSize++] = event;
+		return true;
+	}
+
+	// Inserts after any events with the same or an earlier offset_frames, so
+	// the buffer stays in the order Synthesizer::process() expects; cheap when
+	// events arrive in order
+	bool insertSorted(const T &event)
+	{
+		if (mSize == Capacity)
+			return false;
+		unsigned i = mSize++;
+		for (; i > 0 && mEvents[i - 1].offset_frames > event.offset_frames; i--)
+			mEvents[i] = mEvents[i - 1];
+		mEvents[i] = event;
+		return true;
+	}
+
+	void clear() { mSize = 0; }
+
+	bool empty() const { return mSize == 0; }
+	unsigned size() const { return mSize; }
+
+	T *data() { return mEvents; }
+	const T *data() const { return mEvents; }
+
+	const T *begin() const { return mEvents; }
+	const T *end() const { return mEvents + mSize; }
+
+	T &operator[](unsigned i) { return mEvents[i]; }
+	const T &operator[](unsigned i) const { return mEvents[i]; }
+
+private:
+	T mEvents[Capacity];
+	unsigned mSize = 0;
+};
+
+// More than a host is likely to deliver in one buffer, at 16 bytes each
+typedef EventBuffer<amsynth_midi_event_t, 2048> MidiEventBuffer;
+
+// MidiController sends at most one message per CC per buffer
+typedef EventBuffer<amsynth_midi_cc_t, 128> MidiOutputBuffer;
+
+#endif
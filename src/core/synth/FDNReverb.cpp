@@ -0,0 +1,292 @@
+/*
+ *  FDNReverb.cpp
+ *
+ *  Copyright (c) 2026 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "FDNReverb.h"
+
+#include "freeverb/tuning.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cfloat>
+#include <cmath>
+
+// Delay line lengths at 44.1 kHz; mutually prime, and spread over the same
+// range as freeverb's combs
+static const int kLineTuning[FDNReverb::kLines] = { 1031, 1117, 1201, 1289, 1367, 1451, 1531, 1613 };
+
+// freeverb's allpass lengths, as mono input diffusers
+static const int kDiffuserTuning[FDNReverb::kDiffusers] = {
+	allpasstuningL1, allpasstuningL2, allpasstuningL3, allpasstuningL4 };
+
+// Rows of an 8x8 Hadamard matrix, so that the input and the two outputs see
+// uncorrelated mixes of the lines
+static const float kInputSigns[FDNReverb::kLines] =  { 1, -1,  1, -1,  1, -1,  1, -1 };
+static const float kOutputSignsL[FDNReverb::kLines] = { 1,  1, -1, -1,  1,  1, -1, -1 };
+static const float kOutputSignsR[FDNReverb::kLines] = { 1,  1,  1,  1, -1, -1, -1, -1 };
+
+// freeverb's room size sets the feedback of combs of about this length
+static const float kCombTuningMean = (combtuningL1 + combtuningL2 + combtuningL3 + combtuningL4 +
+									  combtuningL5 + combtuningL6 + combtuningL7 + combtuningL8) / 8.f;
+
+// Gives about the same loudness as freeverb
+static const float kInputGain = fixedgain;
+
+// Unlike freeverb's undenormalise(), which zeroes negative values too
+static inline float flushDenormal(float s)
+{
+	return fabsf(s) < FLT_MIN ? 0.0f : s;
+}
+
+// Summed pairwise, in a fixed order that vectorises
+static inline float sum(const float *x)
+{
+	return ((x[0] + x[1]) + (x[2] + x[3])) + ((x[4] + x[5]) + (x[6] + x[7]));
+}
+
+FDNReverb::FDNReverb()
+{
+	static_assert(kLines == 8, "sum() and the sign tables assume 8 lines");
+
+	std::fill(mFilterStore, mFilterStore + kLines, 0.f);
+	std::fill(mDelay, mDelay + kLines, 0);
+	for (allpass &diffuser : mDiffusers)
+		diffuser.setfeedback(0.5f);
+
+	SetSampleRate(44100);
+	setRoomSize(initialroom);
+	setDamp(initialdamp);
+	setWet(initialwet);
+	setDry(initialdry);
+	setWidth(initialwidth);
+}
+
+void
+FDNReverb::SetSampleRate(int rate)
+{
+	int diffuserSizes[kDiffusers];
+	for (int i = 0; i < kDiffusers; i++)
+		diffuserSizes[i] = TUNING(kDiffuserTuning[i], rate);
+	for (int c = 0; c < kLines; c++)
+		mDelay[c] = TUNING(kLineTuning[c], rate);
+	mBufSize = *std::max_element(mDelay, mDelay + kLines);
+	mBlockSize = std::min((int) kMaxBlock, *std::min_element(mDelay, mDelay + kLines));
+
+	if (rate != mArenaRate) {
+		size_t size = mBufSize * kLines;
+		for (int i = 0; i < kDiffusers; i++)
+			size += diffuserSizes[i];
+		std::vector<float>(size, 0.0f).swap(mArena);
+		mArenaRate = rate;
+	}
+
+	float *next = mArena.data();
+	mBuffer = (Frame *) next;
+	next += mBufSize * kLines;
+	mWriteIndex = 0;
+	for (int i = 0; i < kDiffusers; i++) {
+		mDiffusers[i].setbuffer(next, diffuserSizes[i]);
+		next += diffuserSizes[i];
+	}
+
+	mTailLength = mBufSize;
+	for (int i = 0; i < kDiffusers; i++)
+		mTailLength += diffuserSizes[i];
+
+	update();
+	mute();
+}
+
+void
+FDNReverb::mute()
+{
+	std::fill(mArena.begin(), mArena.end(), 0.0f);
+	std::fill(mFilterStore, mFilterStore + kLines, 0.0f);
+}
+
+void
+FDNReverb::setRoomSize(float value)
+{
+	mRoomSize = (value * scaleroom) + offsetroom;
+	update();
+}
+
+void
+FDNReverb::setDamp(float value)
+{
+	mDamp = value * scaledamp;
+	update();
+}
+
+void
+FDNReverb::setWet(float value)
+{
+	mWet = value * scalewet;
+	update();
+}
+
+void
+FDNReverb::setDry(float value)
+{
+	mDry = value * scaledry;
+}
+
+void
+FDNReverb::setWidth(float value)
+{
+	mWidth = value;
+	update();
+}
+
+void
+FDNReverb::update()
+{
+	mWet1 = mWet * (mWidth / 2 + 0.5f);
+	mWet2 = mWet * ((1 - mWidth) / 2);
+
+	mDamp1 = mDamp;
+	mDamp2 = 1 - mDamp;
+
+	// Room size is freeverb's comb feedback; each line gets the gain that
+	// decays at the same rate per second as a comb of the mean length
+	const float combLength = kCombTuningMean * mArenaRate / 44100.f;
+	for (int c = 0; c < kLines; c++)
+		mFeedback[c] = powf(mRoomSize, mDelay[c] / combLength);
+}
+
+void
+FDNReverb::processWet(float *input, float *outL, float *outR, int numSamples)
+{
+	assert(numSamples <= mBlockSize);
+
+	for (allpass &diffuser : mDiffusers)
+		diffuser.process(input, numSamples);
+
+	// Every sample read here was written at least one delay ago, so the
+	// whole block can be read before any of it is written
+	float delayed[kMaxBlock][kLines];
+	for (int c = 0; c < kLines; c++) {
+		int idx = mWriteIndex - mDelay[c];
+		if (idx < 0) idx += mBufSize;
+		for (int i = 0; i < numSamples; ) {
+			const int count = std::min(numSamples - i, mBufSize - idx);
+			for (int j = 0; j < count; j++)
+				delayed[i + j][c] = mBuffer[idx + j][c];
+			i += count;
+			idx = 0;
+		}
+	}
+
+	// Local copies, so that the compiler can keep them in registers
+	float store[kLines], feedback[kLines];
+	std::copy(mFilterStore, mFilterStore + kLines, store);
+	std::copy(mFeedback, mFeedback + kLines, feedback);
+	const float d1 = mDamp1, d2 = mDamp2;
+
+	for (int i = 0; i < numSamples; i++) {
+		float damped[kLines], left[kLines], right[kLines];
+		for (int c = 0; c < kLines; c++) {
+			const float out = flushDenormal(delayed[i][c]);
+			store[c] = flushDenormal((out * d2) + (store[c] * d1));
+			damped[c] = store[c] * feedback[c];
+			left[c] = out * kOutputSignsL[c];
+			right[c] = out * kOutputSignsR[c];
+		}
+
+		// Householder reflection: I - 2/N * ones
+		const float reflection = sum(damped) * (2.f / kLines);
+		const float in = input[i];
+		float *feedin = mBuffer[mWriteIndex];
+		for (int c = 0; c < kLines; c++)
+			feedin[c] = damped[c] - reflection + in * kInputSigns[c];
+		if (++mWriteIndex >= mBufSize) mWriteIndex = 0;
+
+		outL[i] = sum(left);
+		outR[i] = sum(right);
+	}
+
+	std::copy(store, store + kLines, mFilterStore);
+}
+
+void
+FDNReverb::processMix(const float *inputL, const float *inputR, float *outputL, float *outputR,
+					  unsigned numSamples, int stride)
+{
+	float input[kMaxBlock], outL[kMaxBlock], outR[kMaxBlock];
+
+	while (numSamples > 0) {
+		const int count = (int) std::min(numSamples, (unsigned) mBlockSize);
+
+		for (int i = 0; i < count; i++)
+			input[i] = (inputL[i * stride] + inputR[i * stride]) * kInputGain;
+
+		processWet(input, outL, outR, count);
+
+		for (int i = 0; i < count; i++) {
+			// De-zipper
+			const float d = (mDryZ += ((mDry - mDryZ) * 0.005F));
+			const float w1 = (mWet1Z += ((mWet1 - mWet1Z) * 0.005F));
+			const float w2 = (mWet2Z += ((mWet2 - mWet2Z) * 0.005F));
+
+			// Read before writing, as the outputs may be the inputs
+			const float dryL = *inputL, dryR = *inputR;
+			*outputL += outL[i] * w1 + outR[i] * w2 + dryL * d;
+			*outputR += outR[i] * w1 + outL[i] * w2 + dryR * d;
+
+			inputL += stride;
+			inputR += stride;
+			outputL += stride;
+			outputR += stride;
+		}
+
+		numSamples -= count;
+	}
+}
+
+void
+FDNReverb::processMix(const float *inputM, float inputGain, float *outputL, float *outputR, unsigned numSamples)
+{
+	float input[kMaxBlock], outL[kMaxBlock], outR[kMaxBlock];
+	const float gain = inputGain * kInputGain;
+
+	while (numSamples > 0) {
+		const int count = (int) std::min(numSamples, (unsigned) mBlockSize);
+
+		for (int i = 0; i < count; i++)
+			input[i] = inputM[i] * gain;
+
+		processWet(input, outL, outR, count);
+
+		for (int i = 0; i < count; i++) {
+			// De-zipper
+			const float d = (mDryZ += ((mDry - mDryZ) * 0.005F));
+			const float w1 = (mWet1Z += ((mWet1 - mWet1Z) * 0.005F));
+			const float w2 = (mWet2Z += ((mWet2 - mWet2Z) * 0.005F));
+
+			outputL[i] += outL[i] * w1 + outR[i] * w2 + outputL[i] * d;
+			outputR[i] += outR[i] * w1 + outL[i] * w2 + outputR[i] * d;
+		}
+
+		inputM += count;
+		outputL += count;
+		outputR += count;
+		numSamples -= count;
+	}
+}
@@ -0,0 +1,103 @@
+/*
+ *  FDNReverb.h
+ *
+ *  Copyright (c) 2026 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _FDNREVERB_H
+#define _FDNREVERB_H
+
+#include "freeverb/allpass.hpp"
+
+#include <vector>
+
+/**
+ * A feedback delay network reverb, a cheaper alternative to freeverb with the
+ * same controls.
+ *
+ * The mono sum of the input is diffused by a chain of allpasses and fed to
+ * kLines delay lines, which are fed back through a damping low-pass and a
+ * Householder matrix (each line minus 2/kLines of their sum). That matrix
+ * mixes every line into every other at the cost of one sum, so echo density
+ * builds as quickly as it would with a dense matrix. The left and right
+ * outputs tap the lines with orthogonal sign patterns.
+ *
+ * The lines share one ring buffer of frames, one float per line, and are
+ * processed in lockstep with one line per SIMD lane, as freeverb's combbank.
+ */
+class FDNReverb
+{
+public:
+	static constexpr int kLines = 8;
+	static constexpr int kDiffusers = 4;
+	static constexpr int kMaxBlock = 64;
+
+	FDNReverb();
+
+	// Allocates the delay lines for rate; not to be called on the audio thread
+	void	SetSampleRate	(int rate);
+	void	mute			();
+	// Samples for the input to make a full pass through the network
+	long	getTailLength	() const { return mTailLength; }
+
+	// The same ranges and scaling as the equivalent revmodel controls
+	void	setRoomSize		(float value);
+	void	setDamp			(float value);
+	void	setWet			(float value);
+	void	setDry			(float value);
+	void	setWidth		(float value);
+
+	// Reverberates the sum of the inputs and mixes it into the outputs, which
+	// may be the same buffers, as revmodel::processmix()
+	void	processMix		(const float *inputL, const float *inputR, float *outputL, float *outputR,
+							 unsigned numSamples, int stride);
+	// As above with the outputs as the inputs, for outputs holding a panned
+	// mono signal: reverberates inputM * inputGain, which should be their
+	// sum, instead of summing them again
+	void	processMix		(const float *inputM, float inputGain, float *outputL, float *outputR,
+							 unsigned numSamples);
+
+private:
+	typedef float Frame[kLines];
+
+	void	update			();
+	void	processWet		(float *input, float *outL, float *outR, int numSamples);
+
+	float	mRoomSize = 0, mDamp = 0, mWet = 0, mDry = 0, mWidth = 0;
+	float	mWet1 = 0, mWet2 = 0;
+	float	mDryZ = 0, mWet1Z = 0, mWet2Z = 0;
+
+	float	mFeedback[kLines];	// per line, so that every line decays at the same rate
+	float	mDamp1 = 0, mDamp2 = 1;
+	float	mFilterStore[kLines];
+
+	allpass	mDiffusers[kDiffusers];
+
+	Frame	*mBuffer = nullptr;
+	int		mBufSize = 0;		// frames in use, the longest delay
+	int		mWriteIndex = 0;
+	int		mDelay[kLines];
+	int		mBlockSize = 0;		// samples that can be read before any are written
+	long	mTailLength = 0;
+
+	// The delay lines and diffusers, sized for the current rate
+	std::vector<float>	mArena;
+	int		mArenaRate = 0;
+};
+
+#endif
@@ -24,19 +24,22 @@
 
 #include <algorithm>
 #include <cassert>
+#include <cstring>
 #include <math.h>
 
 void
 SynthFilter::reset()
 {
 	d1 = d2 = d3 = d4 = 0;
+	s1 = s2 = s3 = s4 = 0;
+	svfG = 0;
 }
 
-void
-SynthFilter::ProcessSamples(float *buffer, int numSamples, float cutoff, float res, Type type, Slope slope)
+bool
+SynthFilter::computeCoefficients(Coefficients &c, float cutoff, float res, Type type) const
 {
 	if (type == Type::kBypass) {
-		return;
+		return false;
 	}
 	
 	cutoff = std::min(cutoff, nyquist * 0.99f); // filter is unstable at PI
@@ -45,24 +48,22 @@ SynthFilter::ProcessSamples(float *buffer, int numSamples, float cutoff, float r
 	const double w = (cutoff / rate); // cutoff freq [ 0 <= w <= 0.5 ]
 	const double r = std::max(0.001, 2.0 * (1.0 - res)); // r is 1/Q (sqrt(2) for a butterworth response)
 
-	const double k = tan(w * m::pi);
+	const double k = dsp::tan(w * m::pi);
 	const double k2 = k * k;
 	const double rk = r * k;
 	const double bh = 1.0 + rk + k2;
 
-	double a0, a1, a2, b1, b2;
-
 	switch (type) {
 		case Type::kLowPass:
 			//
 			// Bilinear transformation of H(s) = 1 / (s^2 + s/Q + 1)
 			// See "Digital Audio Signal Processing" by Udo Zölzer
 			//
-			a0 = k2 / bh;
-			a1 = a0 * 2.0;
-			a2 = a0;
-			b1 = (2.0 * (k2 - 1.0)) / bh;
-			b2 = (1.0 - rk + k2) / bh;
+			c.a0 = k2 / bh;
+			c.a1 = c.a0 * 2.0;
+			c.a2 = c.a0;
+			c.b1 = (2.0 * (k2 - 1.0)) / bh;
+			c.b2 = (1.0 - rk + k2) / bh;
 			break;
 
 		case Type::kHighPass:
@@ -70,11 +71,11 @@ SynthFilter::ProcessSamples(float *buffer, int numSamples, float cutoff, float r
 			// Bilinear transformation of H(s) = s^2 / (s^2 + s/Q + 1)
 			// See "Digital Audio Signal Processing" by Udo Zölzer
 			//
-			a0 =  1.0 / bh;
-			a1 = -2.0 / bh;
-			a2 =  a0;
-			b1 = (2.0 * (k2 - 1.0)) / bh;
-			b2 = (1.0 - rk + k2) / bh;
+			c.a0 =  1.0 / bh;
+			c.a1 = -2.0 / bh;
+			c.a2 =  c.a0;
+			c.b1 = (2.0 * (k2 - 1.0)) / bh;
+			c.b2 = (1.0 - rk + k2) / bh;
 			break;
 		
 		case Type::kBandPass:
@@ -82,11 +83,11 @@ SynthFilter::ProcessSamples(float *buffer, int numSamples, float cutoff, float r
 			// Bilinear transformation of H(s) = (s/Q) / (s^2 + s/Q + 1)
 			// See "Digital Audio Signal Processing" by Udo Zölzer
 			//
-			a0 =  rk / bh;
-			a1 =  0.0;
-			a2 = -rk / bh;
-			b1 = (2.0 * (k2 - 1.0)) / bh;
-			b2 = (1.0 - rk + k2) / bh;
+			c.a0 =  rk / bh;
+			c.a1 =  0.0;
+			c.a2 = -rk / bh;
+			c.b1 = (2.0 * (k2 - 1.0)) / bh;
+			c.b2 = (1.0 - rk + k2) / bh;
 			break;
 			
 		case Type::kBandStop:
@@ -95,52 +96,206 @@ SynthFilter::ProcessSamples(float *buffer, int numSamples, float cutoff, float r
 			// coefficients for the bandstop filter, so these were derived by studying
 			// http://www.earlevel.com/main/2012/11/26/biquad-c-source-code/
 			//
-			a0 = (1.0 + k2) / bh;
-			a1 = (2.0 * (k2 - 1.0)) / bh;
-			a2 =  a0;
-			b1 =  a1;
-			b2 = (1.0 - rk + k2) / bh;
+			c.a0 = (1.0 + k2) / bh;
+			c.a1 = (2.0 * (k2 - 1.0)) / bh;
+			c.a2 =  c.a0;
+			c.b1 =  c.a1;
+			c.b2 = (1.0 - rk + k2) / bh;
 			break;
 
 		case Type::kBypass:
-			return;
+			return false;
 
 		default:
 			assert(nullptr == "invalid FilterType");
-			return;
+			return false;
+	}
+
+	return true;
+}
+
+bool
+SynthFilter::computeSVFCoefficients(SVFCoefficients &c, float cutoff, float res, Type type) const
+{
+	if (type == Type::kBypass) {
+		return false;
+	}
+
+	cutoff = std::min(cutoff, nyquist * 0.99f);
+	cutoff = std::max(cutoff, 10.0f);
+
+	// The same prewarped cutoff and damping (1/Q) as the biquad
+	c.g = (float) dsp::tan((cutoff / rate) * m::pi);
+	c.k = std::max(0.001f, 2.f * (1.f - res));
+
+	// Output = m0 * input + m1 * bandpass + m2 * lowpass
+	switch (type) {
+		case Type::kLowPass:  c.m0 = 0; c.m1 =    0; c.m2 =  1; break;
+		case Type::kHighPass: c.m0 = 1; c.m1 = -c.k; c.m2 = -1; break;
+		case Type::kBandPass: c.m0 = 0; c.m1 =  c.k; c.m2 =  0; break;
+		case Type::kBandStop: c.m0 = 1; c.m1 = -c.k; c.m2 =  0; break;
+		default:
+			assert(nullptr == "invalid FilterType");
+			return false;
+	}
+
+	return true;
+}
+
+SynthFilter::CoefficientCache::CoefficientCache()
+{
+	for (Entry &entry : entries) {
+		entry.cutoff = -1; // never matches
+	}
+}
+
+SynthFilter::CoefficientCache::Entry &
+SynthFilter::CoefficientCache::find(bool &hit, Engine engine, const SynthFilter &filter, float cutoff, float res, Type type)
+{
+	uint32_t bits;
+	memcpy(&bits, &cutoff, sizeof(bits));
+	Entry &entry = entries[((bits * 2654435761u) >> 27) % kSize];
+
+	hit = entry.cutoff == cutoff && entry.res == res && entry.rate == filter.rate &&
+		  entry.type == type && entry.engine == engine;
+	if (hit) {
+		hits++;
+	} else {
+		misses++;
+		entry.cutoff = cutoff;
+		entry.res = res;
+		entry.rate = filter.rate;
+		entry.type = type;
+		entry.engine = engine;
+	}
+	return entry;
+}
+
+bool
+SynthFilter::CoefficientCache::get(Coefficients &c, const SynthFilter &filter, float cutoff, float res, Type type)
+{
+	if (type == Type::kBypass) {
+		return false;
+	}
+	bool hit;
+	Entry &entry = find(hit, Engine::kBiquad, filter, cutoff, res, type);
+	if (!hit && !filter.computeCoefficients(entry.biquad, cutoff, res, type)) {
+		entry.cutoff = -1;
+		return false;
+	}
+	c = entry.biquad;
+	return true;
+}
+
+bool
+SynthFilter::CoefficientCache::get(SVFCoefficients &c, const SynthFilter &filter, float cutoff, float res, Type type)
+{
+	if (type == Type::kBypass) {
+		return false;
+	}
+	bool hit;
+	Entry &entry = find(hit, Engine::kSVF, filter, cutoff, res, type);
+	if (!hit && !filter.computeSVFCoefficients(entry.svf, cutoff, res, type)) {
+		entry.cutoff = -1;
+		return false;
+	}
+	c = entry.svf;
+	return true;
+}
+
+void
+SynthFilter::ProcessSamples(float *buffer, int numSamples, float cutoff, float res, Type type, Slope slope)
+{
+	Coefficients c;
+	if (!computeCoefficients(c, cutoff, res, type)) {
+		return;
 	}
 
 	switch (slope) {
-		case Slope::k12:
-			for (int i=0; i<numSamples; i++) { double y, x = buffer[i];
+		case Slope::k12: process<Slope::k12>(buffer, numSamples, c); break;
+		case Slope::k24: process<Slope::k24>(buffer, numSamples, c); break;
+		default: assert(nullptr == "invalid FilterSlope"); break;
+	}
+}
 
-				y  =      (a0 * x) + d1;
-				d1 = d2 + (a1 * x) - (b1 * y);
-				d2 =      (a2 * x) - (b2 * y);
+template <SynthFilter::Slope slope>
+void
+SynthFilter::process(float *buffer, int numSamples, const Coefficients &c)
+{
+	const double a0 = c.a0, a1 = c.a1, a2 = c.a2, b1 = c.b1, b2 = c.b2;
 
-				buffer[i] = (float) y;
-			}
-			break;
+	for (int i=0; i<numSamples; i++) { double y, x = buffer[i];
 
-		case Slope::k24:
-			for (int i=0; i<numSamples; i++) { double y, x = buffer[i];
+		y  =      (a0 * x) + d1;
+		d1 = d2 + (a1 * x) - (b1 * y);
+		d2 =      (a2 * x) - (b2 * y);
 
-				y  =      (a0 * x) + d1;
-				d1 = d2 + (a1 * x) - (b1 * y);
-				d2 =      (a2 * x) - (b2 * y);
+		if (slope == Slope::k24) {
+			x = y;
 
-				x = y;
+			y  =      (a0 * x) + d3;
+			d3 = d4 + (a1 * x) - (b1 * y);
+			d4 =      (a2 * x) - (b2 * y);
+		}
 
-				y  =      (a0 * x) + d3;
-				d3 = d4 + (a1 * x) - (b1 * y);
-				d4 =      (a2 * x) - (b2 * y);
+		buffer[i] = (float) y;
+	}
+}
 
-				buffer[i] = (float) y;
-			}
-			break;
+template void SynthFilter::process<SynthFilter::Slope::k12>(float *, int, const Coefficients &);
+template void SynthFilter::process<SynthFilter::Slope::k24>(float *, int, const Coefficients &);
 
-		default:
-			assert(nullptr == "invalid FilterSlope");
-			break;
+template <int N, SynthFilter::Slope slope>
+void
+SynthFilter::ProcessSamplesLanes(float *buffer, int numSamples, SynthFilter *const *filters,
+								 const Coefficients *coefficients)
+{
+	Lanes<N> lanes;
+	lanes.load(filters, coefficients);
+
+	for (int i = 0; i < numSamples; i++, buffer += N) {
+		for (int n = 0; n < N; n++) {
+			buffer[n] = lanes.template tick<slope>(n, buffer[n]);
+		}
+	}
+
+	lanes.store(filters);
+}
+
+template <SynthFilter::Slope slope>
+void
+SynthFilter::processSVF(float *buffer, int numSamples, const SVFCoefficients &c)
+{
+	SynthFilter *filter = this;
+	ProcessSVFLanes<1, slope>(buffer, numSamples, &filter, &c);
+}
+
+template void SynthFilter::processSVF<SynthFilter::Slope::k12>(float *, int, const SVFCoefficients &);
+template void SynthFilter::processSVF<SynthFilter::Slope::k24>(float *, int, const SVFCoefficients &);
+
+template <int N, SynthFilter::Slope slope>
+void
+SynthFilter::ProcessSVFLanes(float *buffer, int numSamples, SynthFilter *const *filters,
+							 const SVFCoefficients *coefficients)
+{
+	SVFLanes<N> lanes;
+	lanes.load(filters, coefficients, numSamples);
+
+	for (int i = 0; i < numSamples; i++, buffer += N) {
+		for (int n = 0; n < N; n++) {
+			buffer[n] = lanes.template tick<slope>(n, buffer[n]);
+		}
 	}
+
+	lanes.store(filters);
 }
+
+#define INSTANTIATE_LANES(N) \
+	template void SynthFilter::ProcessSVFLanes<N, SynthFilter::Slope::k12>(float *, int, SynthFilter *const *, const SVFCoefficients *); \
+	template void SynthFilter::ProcessSVFLanes<N, SynthFilter::Slope::k24>(float *, int, SynthFilter *const *, const SVFCoefficients *); \
+	template void SynthFilter::ProcessSamplesLanes<N, SynthFilter::Slope::k12>(float *, int, SynthFilter *const *, const Coefficients *); \
+	template void SynthFilter::ProcessSamplesLanes<N, SynthFilter::Slope::k24>(float *, int, SynthFilter *const *, const Coefficients *);
+
+INSTANTIATE_LANES(2)
+INSTANTIATE_LANES(4)
+INSTANTIATE_LANES(8)
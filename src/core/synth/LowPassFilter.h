@@ -22,6 +22,8 @@
 #ifndef _LOWPASSFILTER_H
 #define _LOWPASSFILTER_H
 
+#include <stdint.h>
+
 class SynthFilter
 {
 public:
@@ -39,12 +41,276 @@ public:
 		k24,
 	};
 
+	/**
+	 * kBiquad is the double precision biquad that presets were designed with.
+	 * kSVF is a single precision trapezoidal (zero-delay feedback) state
+	 * variable filter with the same response at a fixed cutoff, which stays
+	 * well behaved while the cutoff moves and suits SIMD lanes.
+	 */
+	enum class Engine {
+		kBiquad,
+		kSVF,
+	};
+
 	void SetSampleRate(int rateIn) { rate = (float)rateIn; nyquist = rate / 2.0f; }
 
 	void reset();
 
 	void ProcessSamples(float *, int, float cutoff, float res, Type type, Slope slope);
 
+	struct Coefficients {
+		double a0, a1, a2, b1, b2;
+	};
+
+	// Returns false if the signal should pass through unmodified.
+	bool computeCoefficients(Coefficients &, float cutoff, float res, Type type) const;
+
+	/**
+	 * Filters the buffer with coefficients from computeCoefficients(). The
+	 * slope is a template parameter so that callers which already know it
+	 * get a loop without any branches in it.
+	 */
+	template <Slope slope>
+	void process(float *buffer, int numSamples, const Coefficients &);
+
+	/**
+	 * Runs N filters in lockstep, one per lane of an interleaved buffer
+	 * (buffer[i * N + lane]). Each lane produces exactly the same output as
+	 * process() would for that filter, but the N recurrences are
+	 * independent so the compiler can keep them in vector registers.
+	 */
+	template <int N, Slope slope>
+	static void ProcessSamplesLanes(float *buffer, int numSamples, SynthFilter *const *filters,
+									const Coefficients *coefficients);
+
+	struct SVFCoefficients {
+		float g, k, m0, m1, m2;
+	};
+
+	// Returns false if the signal should pass through unmodified.
+	bool computeSVFCoefficients(SVFCoefficients &, float cutoff, float res, Type type) const;
+
+	/**
+	 * Filters the buffer with the state variable filter. g (the prewarped
+	 * cutoff) moves linearly from the previous call's value to the new one
+	 * across the block, so cutoff modulation does not step at block edges.
+	 */
+	template <Slope slope>
+	void processSVF(float *buffer, int numSamples, const SVFCoefficients &);
+
+	/**
+	 * Runs N state variable filters in lockstep on an interleaved buffer,
+	 * as ProcessSamplesLanes() does for the biquad.
+	 */
+	template <int N, Slope slope>
+	static void ProcessSVFLanes(float *buffer, int numSamples, SynthFilter *const *filters,
+								const SVFCoefficients *coefficients);
+
+	/**
+	 * Remembers recently computed coefficients so that voices playing with
+	 * the same cutoff, resonance and type - a chord on a patch without key
+	 * tracking, or a held note once its filter envelope settles - skip the
+	 * tan() and divisions. Entries are keyed on the exact cutoff and sample
+	 * rate, so a hit returns the same coefficients a miss would compute.
+	 * Not thread safe; give each rendering thread its own.
+	 */
+	class CoefficientCache
+	{
+	public:
+		CoefficientCache();
+
+		// As computeCoefficients() and computeSVFCoefficients()
+		bool get(Coefficients &, const SynthFilter &, float cutoff, float res, Type type);
+		bool get(SVFCoefficients &, const SynthFilter &, float cutoff, float res, Type type);
+
+		uint32_t hits = 0;
+		uint32_t misses = 0;
+
+	private:
+		struct Entry
+		{
+			float cutoff, res, rate;
+			Type type;
+			Engine engine;
+			union {
+				Coefficients biquad;
+				SVFCoefficients svf;
+			};
+		};
+
+		static constexpr int kSize = 32;
+
+		Entry &find(bool &hit, Engine engine, const SynthFilter &, float cutoff, float res, Type type);
+
+		Entry entries[kSize];
+	};
+
+	// As above, through the cache if there is one
+	bool computeCoefficients(Coefficients &c, float cutoff, float res, Type type, CoefficientCache *cache) const
+	{
+		return cache ? cache->get(c, *this, cutoff, res, type) : computeCoefficients(c, cutoff, res, type);
+	}
+	bool computeSVFCoefficients(SVFCoefficients &c, float cutoff, float res, Type type, CoefficientCache *cache) const
+	{
+		return cache ? cache->get(c, *this, cutoff, res, type) : computeSVFCoefficients(c, cutoff, res, type);
+	}
+
+	/**
+	 * The coefficients and state of N filters copied into local arrays, for
+	 * callers that run the filter one sample at a time inside a larger loop.
+	 * tick() computes exactly what process() would for that sample.
+	 */
+	template <int N>
+	struct Lanes
+	{
+		double a0[N], a1[N], a2[N], b1[N], b2[N];
+		double d1[N], d2[N], d3[N], d4[N];
+
+		// Computes the coefficients for each filter and loads them with its
+		// state. Returns false if the signal should pass through unmodified.
+		// Takes the block length, unused here, to match SVFLanes::load().
+		bool load(SynthFilter *const *filters, const float *cutoff, float res, Type type, int /*numSamples*/,
+				  CoefficientCache *cache)
+		{
+			Coefficients coefficients[N] = {};
+			bool filtering = true;
+			for (int n = 0; n < N; n++) {
+				if (!filters[n]->computeCoefficients(coefficients[n], cutoff[n], res, type, cache))
+					filtering = false;
+			}
+			load(filters, coefficients);
+			return filtering;
+		}
+
+		void load(SynthFilter *const *filters, const Coefficients *coefficients)
+		{
+			for (int n = 0; n < N; n++) {
+				a0[n] = coefficients[n].a0;
+				a1[n] = coefficients[n].a1;
+				a2[n] = coefficients[n].a2;
+				b1[n] = coefficients[n].b1;
+				b2[n] = coefficients[n].b2;
+				d1[n] = filters[n]->d1;
+				d2[n] = filters[n]->d2;
+				d3[n] = filters[n]->d3;
+				d4[n] = filters[n]->d4;
+			}
+		}
+
+		void store(SynthFilter *const *filters) const
+		{
+			for (int n = 0; n < N; n++) {
+				filters[n]->d1 = d1[n];
+				filters[n]->d2 = d2[n];
+				filters[n]->d3 = d3[n];
+				filters[n]->d4 = d4[n];
+			}
+		}
+
+		template <Slope slope>
+		inline float tick(int n, double x)
+		{
+			double y;
+
+			y     =         (a0[n] * x) + d1[n];
+			d1[n] = d2[n] + (a1[n] * x) - (b1[n] * y);
+			d2[n] =         (a2[n] * x) - (b2[n] * y);
+
+			if (slope == Slope::k24) {
+				x = y;
+
+				y     =         (a0[n] * x) + d3[n];
+				d3[n] = d4[n] + (a1[n] * x) - (b1[n] * y);
+				d4[n] =         (a2[n] * x) - (b2[n] * y);
+			}
+
+			return (float) y;
+		}
+	};
+
+	/**
+	 * As Lanes, for the state variable filter. The coefficients a1..a3 depend
+	 * on g, which ramps through the block, so they are derived per sample.
+	 */
+	template <int N>
+	struct SVFLanes
+	{
+		float g[N], dg[N], k[N], m0[N], m1[N], m2[N];
+		float s1[N], s2[N], s3[N], s4[N];
+
+		void load(SynthFilter *const *filters, const SVFCoefficients *coefficients, int numSamples)
+		{
+			for (int n = 0; n < N; n++) {
+				const SVFCoefficients &c = coefficients[n];
+				const float g0 = filters[n]->svfG > 0 ? filters[n]->svfG : c.g;
+				g[n] = g0;
+				dg[n] = numSamples > 0 ? (c.g - g0) / numSamples : 0;
+				k[n] = c.k;
+				m0[n] = c.m0;
+				m1[n] = c.m1;
+				m2[n] = c.m2;
+				s1[n] = filters[n]->s1;
+				s2[n] = filters[n]->s2;
+				s3[n] = filters[n]->s3;
+				s4[n] = filters[n]->s4;
+				filters[n]->svfG = c.g;
+			}
+		}
+
+		bool load(SynthFilter *const *filters, const float *cutoff, float res, Type type, int numSamples,
+				  CoefficientCache *cache)
+		{
+			SVFCoefficients coefficients[N] = {};
+			bool filtering = true;
+			for (int n = 0; n < N; n++) {
+				if (!filters[n]->computeSVFCoefficients(coefficients[n], cutoff[n], res, type, cache))
+					filtering = false;
+			}
+			if (filtering)
+				load(filters, coefficients, numSamples);
+			return filtering;
+		}
+
+		void store(SynthFilter *const *filters) const
+		{
+			for (int n = 0; n < N; n++) {
+				filters[n]->s1 = s1[n];
+				filters[n]->s2 = s2[n];
+				filters[n]->s3 = s3[n];
+				filters[n]->s4 = s4[n];
+			}
+		}
+
+		template <Slope slope>
+		inline float tick(int n, float x)
+		{
+			const float gn = (g[n] += dg[n]);
+			const float a1 = 1.f / (1.f + gn * (gn + k[n]));
+			const float a2 = gn * a1;
+			const float a3 = gn * a2;
+
+			float v3 = x - s2[n];
+			float v1 = a1 * s1[n] + a2 * v3;
+			float v2 = s2[n] + a2 * s1[n] + a3 * v3;
+			s1[n] = 2.f * v1 - s1[n];
+			s2[n] = 2.f * v2 - s2[n];
+			float y = m0[n] * x + m1[n] * v1 + m2[n] * v2;
+
+			if (slope == Slope::k24) {
+				x = y;
+
+				v3 = x - s4[n];
+				v1 = a1 * s3[n] + a2 * v3;
+				v2 = s4[n] + a2 * s3[n] + a3 * v3;
+				s3[n] = 2.f * v1 - s3[n];
+				s4[n] = 2.f * v2 - s4[n];
+				y = m0[n] * x + m1[n] * v1 + m2[n] * v2;
+			}
+
+			return y;
+		}
+	};
+
 private:
 
 	float rate = 44100;
@@ -53,6 +319,13 @@ private:
 	double d2 = 0;
 	double d3 = 0;
 	double d4 = 0;
+
+	// state variable filter
+	float s1 = 0;
+	float s2 = 0;
+	float s3 = 0;
+	float s4 = 0;
+	float svfG = 0; // g at the end of the last block, 0 after reset
 };
 
 #endif
@@ -30,6 +30,7 @@
 #include <fstream>
 #include <iostream>
 
+static_assert(MidiOutputBuffer::kCapacity >= MAX_CC, "generateMidiOutput() may send every CC");
 
 MidiController::MidiController()
 {
@@ -129,16 +130,17 @@ MidiController::HandleMidiData(const unsigned char* bytes, unsigned numBytes)
 void
 MidiController::pitch_wheel_change(float val)
 {
+	_pitchWheelValue = val;
 	if (_handler) _handler->HandleMidiPitchWheel(val);
 }
 
 void
-MidiController::dispatch_note(unsigned char, unsigned char note, unsigned char vel)
+MidiController::dispatch_note(unsigned char ch, unsigned char note, unsigned char vel)
 {
 	static const float scale = 1.f/127.f;
     if (!_handler) return;
-	if (vel) _handler->HandleMidiNoteOn((int) note, (float)vel * scale);
-	else     _handler->HandleMidiNoteOff((int) note, (float)vel * scale);
+	if (vel) _handler->HandleMidiNoteOn((int) note, (float)vel * scale, (int) ch);
+	else     _handler->HandleMidiNoteOff((int) note, (float)vel * scale, (int) ch);
 }
 
 void
@@ -191,7 +193,7 @@ MidiController::controller_change(unsigned char cc, unsigned char value)
 			break;
 		case MIDI_CC_RESET_ALL_CONTROLLERS:
 			// https://web.archive.org/web/20160105110518/http://www.midi.org/techspecs/rp15.php
-			_handler->HandleMidiPitchWheel(0);
+			pitch_wheel_change(0);
 			break;
 		case MIDI_CC_ALL_NOTES_OFF:
 			if (value == 0)
@@ -301,7 +303,7 @@ MidiController::setControllerForParameter(Param paramId, int cc)
 }
 
 void
-MidiController::generateMidiOutput(std::vector<amsynth_midi_cc_t> &output)
+MidiController::generateMidiOutput(MidiOutputBuffer &output)
 {
 	unsigned char outputChannel = std::max(0, assignedChannel - 1);
 	
@@ -319,6 +321,60 @@ MidiController::generateMidiOutput(std::vector<amsynth_midi_cc_t> &output)
 	}
 }
 
+int
+MidiController::getRampTarget(const unsigned char *bytes, unsigned numBytes, float &value) const
+{
+	if (numBytes != 3 || !(bytes[0] & 0x80) || (bytes[1] & 0x80) || (bytes[2] & 0x80) || !presetController)
+		return -1;
+	if (assignedChannel > 0 && (bytes[0] & 0x0f) != assignedChannel - 1)
+		return -1;
+
+	switch (bytes[0] & 0xf0) {
+	case MIDI_STATUS_CONTROLLER: {
+		int paramId = _cc_to_param_map[bytes[1]];
+		if (paramId < 0 || presetController->getCurrentPreset().getParameter(paramId).getStep() > 0.f)
+			return -1;
+		value = bytes[2];
+		return bytes[1];
+	}
+	case MIDI_STATUS_PITCH_WHEEL:
+		value = (float) ((bytes[1] | (bytes[2] << 7)) - 0x2000) / (float) 0x2000;
+		return kPitchWheelRampTarget;
+	default:
+		return -1;
+	}
+}
+
+float
+MidiController::getRampValue(int target) const
+{
+	if (target == kPitchWheelRampTarget)
+		return _pitchWheelValue;
+	return presetController->getCurrentPreset().getParameter(_cc_to_param_map[target]).getNormalisedValue() * 127.f;
+}
+
+void
+MidiController::setRampValue(int target, float value)
+{
+	if (target == kPitchWheelRampTarget) {
+		pitch_wheel_change(value);
+		return;
+	}
+	Parameter &parameter = presetController->getCurrentPreset().getParameter(_cc_to_param_map[target]);
+	parameter.setNormalisedValue(value / 127.f);
+	_midi_cc_vals[target] = parameter.getMidiValue();
+	_lastActiveController = target;
+}
+
+void
+MidiController::skipRampEvent(const unsigned char *bytes)
+{
+	// Leaves the parser where HandleMidiData() would after a complete message
+	status = bytes[0];
+	channel = bytes[0] & 0x0f;
+	data = 0xff;
+}
+
 int
 MidiController::getLastActiveController()
 {
@@ -25,6 +25,7 @@
 #include "PresetController.h"
 #include "Parameter.h"
 #include "../types.h"
+#include "EventBuffer.h"
 
 
 #define MAX_CC 128
@@ -34,8 +35,8 @@ typedef unsigned char uchar;
 class MidiEventHandler
 {
 public:
-	virtual void HandleMidiNoteOn(int /*note*/, float /*velocity*/) = 0;
-	virtual void HandleMidiNoteOff(int /*note*/, float /*velocity*/) = 0;
+	virtual void HandleMidiNoteOn(int /*note*/, float /*velocity*/, int /*channel*/) = 0;
+	virtual void HandleMidiNoteOff(int /*note*/, float /*velocity*/, int /*channel*/) = 0;
 	virtual void HandleMidiPitchWheel(float /*value*/) = 0;
 	virtual void HandleMidiPitchWheelSensitivity(uchar semitones) = 0;
 	virtual void HandleMidiAllSoundOff() = 0;
@@ -63,10 +64,27 @@ public:
 	int		getControllerForParameter(Param paramId);
 	void	setControllerForParameter(Param paramId, int cc);
 
-	void 	generateMidiOutput	(std::vector<amsynth_midi_cc_t> &);
+	void 	generateMidiOutput	(MidiOutputBuffer &);
 
 	int		getLastActiveController();
 
+	/**
+	 * Continuous controllers - CCs mapped to a parameter without steps, and
+	 * the pitch wheel - may be applied as ramps instead of at the exact frame
+	 * of each event. getRampTarget() returns the controller an event moves
+	 * (the CC number, or kPitchWheelRampTarget) and sets value to its new
+	 * position (0 to 127, or -1 to 1 for the pitch wheel); other events,
+	 * including any holding more than one message, return -1 and must go
+	 * through HandleMidiData(). Ramped events are still passed, in order, to
+	 * skipRampEvent() so that running status is tracked.
+	 */
+	static constexpr int kPitchWheelRampTarget = MAX_CC;
+	static constexpr int kNumRampTargets = MAX_CC + 1;
+	int		getRampTarget	(const unsigned char *bytes, unsigned numBytes, float &value) const;
+	float	getRampValue	(int target) const;
+	void	setRampValue	(int target, float value);
+	void	skipRampEvent	(const unsigned char *bytes);
+
 	unsigned char assignedChannel = 0; // 0 denotes any channel
 
 private:
@@ -80,6 +98,7 @@ private:
     PresetController *presetController = nullptr;
     unsigned char status, data, channel;
 	int _lastActiveController = -1;
+	float _pitchWheelValue = 0;
 	unsigned char _midi_cc_vals[MAX_CC];
 	MidiEventHandler* _handler = nullptr;
 	unsigned char _rpn_msb = 0xff;
@@ -21,6 +21,8 @@
 
 #include "Oscillator.h"
 
+#include "Wavetables.h"
+
 #include <algorithm>
 #include <cassert>
 #include <climits>
@@ -34,7 +36,7 @@ static inline float ffmodf(float x, float y) {
 }
 
 #define DO_OSC_SYNC(__osc_rads__) \
-	if (mSyncEnabled) { \
+	if (kSync) { \
 		mSyncRads = mSyncRads + twopi_rate * mSyncFrequency; \
 		if (mSyncRads >= m::twoPi) { \
 			mSyncRads -= m::twoPi; \
@@ -42,9 +44,77 @@ static inline float ffmodf(float x, float y) {
 		} \
 	}
 
-void Oscillator::SetWaveform	(Waveform w)			{ waveform = w; }
 void Oscillator::reset			()						{ rads = 0.0; }
 
+Oscillator::Oscillator()
+{
+	updateProcessFunction();
+}
+
+// These are called every block, so only rebuild when something changed
+void
+Oscillator::SetWaveform(Waveform w)
+{
+	assert(w >= Waveform::kSine && w <= Waveform::kRandom);
+	if (w != waveform) {
+		waveform = w;
+		updateProcessFunction();
+	}
+}
+
+void
+Oscillator::setEngine(Engine engine)
+{
+	if (engine != mEngine) {
+		mEngine = engine;
+		updateProcessFunction();
+	}
+}
+
+void
+Oscillator::setSyncEnabled(bool sync)
+{
+	if (sync != mSyncEnabled) {
+		mSyncEnabled = sync;
+		updateProcessFunction();
+	}
+}
+
+void
+Oscillator::updateProcessFunction()
+{
+	// [waveform][sync]
+	static const ProcessFunction kClassic[][2] = {
+		{ &Oscillator::doSine<false>,   &Oscillator::doSine<true> },
+		{ &Oscillator::doSquare<false>, &Oscillator::doSquare<true> },
+		{ &Oscillator::doSaw<false>,    &Oscillator::doSaw<true> },
+		{ &Oscillator::doNoise,         &Oscillator::doNoise },
+		{ &Oscillator::doRandom,        &Oscillator::doRandom },
+	};
+	static const ProcessFunction kWavetable[][2] = {
+		{ &Oscillator::doWavetableSine<false>,  &Oscillator::doWavetableSine<true> },
+		{ &Oscillator::doWavetablePulse<false>, &Oscillator::doWavetablePulse<true> },
+		{ &Oscillator::doWavetableSaw<false>,   &Oscillator::doWavetableSaw<true> },
+		{ &Oscillator::doNoise,                 &Oscillator::doNoise },
+		{ &Oscillator::doRandom,                &Oscillator::doRandom },
+	};
+	static const ProcessFunction kPolyBLEP[][2] = {
+		{ &Oscillator::doSine<false>,          &Oscillator::doSine<true> },
+		{ &Oscillator::doPolyBLEPPulse<false>, &Oscillator::doPolyBLEPPulse<true> },
+		{ &Oscillator::doPolyBLEPSaw<false>,   &Oscillator::doPolyBLEPSaw<true> },
+		{ &Oscillator::doNoise,                &Oscillator::doNoise },
+		{ &Oscillator::doRandom,               &Oscillator::doRandom },
+	};
+
+	const ProcessFunction (*table)[2] = kClassic;
+	switch (mEngine) {
+	case Engine::kClassic:   table = kClassic;   break;
+	case Engine::kWavetable: table = kWavetable; break;
+	case Engine::kPolyBLEP:  table = kPolyBLEP;  break;
+	}
+	mProcess = table[(int)waveform][mSyncEnabled ? 1 : 0];
+}
+
 void
 Oscillator::SetSampleRate(int rateIn)
 {
@@ -66,28 +136,23 @@ Oscillator::ProcessSamples	(float *buffer, int nFrames, float freq_hz, float pw,
 	mFrequency.configure(mFrequency.getFinalValue(), std::min(freq_hz, maxFreq), nFrames);
 	mPulseWidth = pw;
 	mSyncFrequency = sync_freq;
-	
-	switch (waveform) {
-	case Waveform::kSine:     doSine      (buffer, nFrames); break;
-	case Waveform::kPulse:    doSquare    (buffer, nFrames); break;
-	case Waveform::kSaw:      doSaw       (buffer, nFrames); break;
-	case Waveform::kNoise:    doNoise     (buffer, nFrames); break;
-	case Waveform::kRandom:   doRandom    (buffer, nFrames); break;
-	default: assert(nullptr == "invalid waveform");
-	}
+
+	(this->*mProcess)(buffer, nFrames);
 }
 
+template <bool kSync>
 void
 Oscillator::doSine(float *buffer, int nFrames)
 {
     for (int i = 0; i < nFrames; i++) {
 		DO_OSC_SYNC(rads);
-		buffer[i] = sinf(rads += twopi_rate * mFrequency.nextValue());
+		buffer[i] = dsp::sin(rads += twopi_rate * mFrequency.nextValue());
 	}
 	rads = ffmodf(rads, m::twoPi);			// overflows are bad!
 }
 
-void 
+template <bool kSync>
+void
 Oscillator::doSquare(float *buffer, int nFrames)
 {
 	const float radsper = twopi_rate * mFrequency.getFinalValue();
@@ -149,7 +214,8 @@ static inline float saw(float rads, float shape)
 	return (1 - 2 * t) / (1 - a);
 }
 
-void 
+template <bool kSync>
+void
 Oscillator::doSaw(float *buffer, int nFrames)
 {
 #ifdef ALIAS_REDUCTION
@@ -173,13 +239,317 @@ Oscillator::doSaw(float *buffer, int nFrames)
 #endif
 }
 
+// The wavetable and PolyBLEP engines work through a block in chunks of this
+// many frames so that the phases can be computed up front in a local buffer
+static const int kChunkFrames = 64;
+
+// Below this, a saw shape's falling segment is narrower than the lower mipmap
+// levels can resolve and the shape is played as a plain saw instead
+static const float kMinSawSlopeWidth = 1.f / 64.f;
+
+template <bool kSync>
+void
+Oscillator::wavetablePositions(float *positions, int nFrames)
+{
+	// The phase has to be advanced serially (sync can reset it at any sample),
+	// but the table reads that follow are independent of each other
+	const float scale = Wavetables::kSize / m::twoPi;
+	float lrads = rads;
+	for (int i = 0; i < nFrames; i++) {
+		DO_OSC_SYNC(lrads);
+		lrads += twopi_rate * mFrequency.nextValue();
+		if (lrads >= m::twoPi)
+			lrads -= m::twoPi;
+		positions[i] = lrads * scale;
+	}
+	rads = lrads;
+}
+
+template <bool kSync>
+void
+Oscillator::doWavetableSine(float *buffer, int nFrames)
+{
+	const float *table = Wavetables::get().sine();
+	float positions[kChunkFrames];
+	for (int offset = 0; offset < nFrames; offset += kChunkFrames) {
+		const int n = std::min(nFrames - offset, kChunkFrames);
+		float *out = buffer + offset;
+		wavetablePositions<kSync>(positions, n);
+		for (int i = 0; i < n; i++)
+			out[i] = wavetableLookup(table, positions[i]);
+	}
+}
+
+template <bool kSync>
+void
+Oscillator::doWavetablePulse(float *buffer, int nFrames)
+{
+	// A pulse of duty cycle D is the difference of two saws D cycles apart:
+	// (2D - 1) - saw(t) + saw(t - D) is +1 for t < D and -1 after
+	const float increment = std::max(mFrequency.getValue(), mFrequency.getFinalValue()) / rate;
+	const float *table = Wavetables::get().saw(Wavetables::levelForIncrement(increment));
+	const float duty = 0.5f + 0.5f * std::min(mPulseWidth, 0.9f);
+	const float dc = 2.f * duty - 1.f;
+	const float shift = (1.f - duty) * Wavetables::kSize;
+
+	float positions[kChunkFrames];
+	for (int offset = 0; offset < nFrames; offset += kChunkFrames) {
+		const int n = std::min(nFrames - offset, kChunkFrames);
+		float *out = buffer + offset;
+		wavetablePositions<kSync>(positions, n);
+		for (int i = 0; i < n; i++)
+			out[i] = dc - wavetableLookup(table, positions[i]) + wavetableLookup(table, positions[i] + shift);
+	}
+}
+
+template <bool kSync>
+void
+Oscillator::doWavetableSaw(float *buffer, int nFrames)
+{
+	// The classic saw() shape rises for a fraction a of the cycle and falls for
+	// the rest. Its integral is a difference of two parabolas a cycle apart, so
+	// the band-limited shape is that difference scaled by 1 / (a (1 - a)).
+	const float increment = std::max(mFrequency.getValue(), mFrequency.getFinalValue()) / rate;
+	const int level = Wavetables::levelForIncrement(increment);
+	const float a = (mPulseWidth + 1.0f) / 2.0f;
+
+	const bool isSaw = 1.f - a < kMinSawSlopeWidth || a < kMinSawSlopeWidth;
+	const float *table = isSaw ? Wavetables::get().saw(level) : Wavetables::get().parabola(level);
+	float shift1 = 0, shift2 = 0, gain;
+	if (1.f - a < kMinSawSlopeWidth) {
+		shift1 = 0.5f * Wavetables::kSize;
+		gain = mPolarity;
+	} else if (a < kMinSawSlopeWidth) {
+		gain = -mPolarity;
+	} else {
+		shift1 = (1.f - a / 2.f) * Wavetables::kSize;
+		shift2 = (a / 2.f) * Wavetables::kSize;
+		gain = mPolarity / (a * (1.f - a));
+	}
+
+	float positions[kChunkFrames];
+	for (int offset = 0; offset < nFrames; offset += kChunkFrames) {
+		const int n = std::min(nFrames - offset, kChunkFrames);
+		float *out = buffer + offset;
+		wavetablePositions<kSync>(positions, n);
+		if (isSaw) {
+			for (int i = 0; i < n; i++)
+				out[i] = gain * wavetableLookup(table, positions[i] + shift1);
+		} else {
+			for (int i = 0; i < n; i++)
+				out[i] = gain * (wavetableLookup(table, positions[i] + shift1) - wavetableLookup(table, positions[i] + shift2));
+		}
+	}
+}
+
+// PolyBLEP / PolyBLAMP
+//
+// The naive waveform is computed from the phase and the aliasing introduced by
+// each discontinuity is cancelled by adding a two-sample polynomial residual
+// either side of it. The corrections for the oscillator's own edges depend
+// only on the phase and increment of each sample, so those loops have no data
+// dependent branches. Hard sync resets are rare and are handled afterwards as
+// individual BLEP events.
+//
+// The per-sample helpers clamp rather than select between a polynomial and
+// zero, so that they compile to min/max instructions.
+
+struct Oscillator::SyncEvent
+{
+	int		frame;		// first sample after the reset
+	float	elapsed;	// time from the reset to that sample, in samples
+	float	phase;		// phase that was cut short by the reset
+};
+
+static inline float clampMax(float x, float max) { return x < max ? x : max; }
+static inline float clampMin(float x, float min) { return x > min ? x : min; }
+
+// The part of polyBLEP() that follows an edge at phase 0
+static inline float polyBLEPAfter(float t, float dt)
+{
+	const float x = 1.f - clampMax(t / dt, 1.f);
+	return -0.5f * x * x;
+}
+
+// The part of polyBLEP() that anticipates an edge at the end of the cycle
+static inline float polyBLEPBefore(float t, float dt)
+{
+	const float x = 1.f + clampMin((t - 1.f) / dt, -1.f);
+	return 0.5f * x * x;
+}
+
+// Residual for a step of +1 at phase 0, for a sample at phase t (dt <= 0.5)
+static inline float polyBLEP(float t, float dt)
+{
+	return polyBLEPAfter(t, dt) + polyBLEPBefore(t, dt);
+}
+
+// Residual for a change of slope of +1 per sample at phase c, for a sample at
+// phase t
+static inline float polyBLAMP(float t, float c, float dt)
+{
+	float d = t - c;
+	d += (d < -0.5f ? 1.f : 0.f) - (d >= 0.5f ? 1.f : 0.f);
+	const float x = 1.f - clampMax(std::fabs(d) / dt, 1.f);
+	return x * x * x * (1.f / 6.f);
+}
+
+// Residuals either side of a step of +1 that happened `elapsed` samples
+// before the sample that follows it
+static inline float syncBLEPAfter(float elapsed) { return -0.5f * (1.f - elapsed) * (1.f - elapsed); }
+static inline float syncBLEPBefore(float elapsed) { return 0.5f * elapsed * elapsed; }
+
+static inline float wrapPhase(float t) { return t + (t < 0.f ? 1.f : 0.f) - (t >= 1.f ? 1.f : 0.f); }
+
+// saw() for a = 2 / rise, with fall = 2 / (1 - a). The rising segment is
+// centred on phase 0, so with the phase taken in [-a/2, 1 - a/2) the shape is
+// the lower of the two lines.
+static inline float skewedTriangle(float t, float trough, float rise, float fall)
+{
+	const float u = t - (t >= trough ? 1.f : 0.f);
+	return clampMax(u * rise, (0.5f - u) * fall);
+}
+
+template <bool kSync>
+int
+Oscillator::polyBLEPPhases(float *phases, float *increments, int nFrames, SyncEvent *events)
+{
+	const double syncIncrement = twopi_rate * mSyncFrequency;
+	const float rate_1 = 1.f / rate;
+	int numEvents = 0;
+	float t = rads / m::twoPi;
+	for (int i = 0; i < nFrames; i++) {
+		const float dt = mFrequency.nextValue() * rate_1;
+		t += dt;
+		if (kSync && syncIncrement > 0) {
+			mSyncRads += syncIncrement;
+			if (mSyncRads >= m::twoPi) {
+				mSyncRads -= m::twoPi;
+				const float elapsed = (float)(mSyncRads / syncIncrement);
+				events[numEvents++] = { i, elapsed, wrapPhase(t - elapsed * dt) };
+				t = elapsed * dt;
+			}
+		}
+		t = wrapPhase(t);
+		phases[i] = t;
+		increments[i] = dt;
+	}
+	rads = t * m::twoPi;
+	return numEvents;
+}
+
+// A reset that lands on the first sample of the next chunk needs a correction
+// on the last sample of this one, so it is predicted from the current rates
+bool
+Oscillator::predictSyncEvent(float phase, float increment, SyncEvent &event)
+{
+	const double syncIncrement = twopi_rate * mSyncFrequency;
+	if (!mSyncEnabled || syncIncrement <= 0 || mSyncRads + syncIncrement < m::twoPi)
+		return false;
+	event.elapsed = (float)((mSyncRads + syncIncrement - m::twoPi) / syncIncrement);
+	event.phase = wrapPhase(phase + (1.f - event.elapsed) * increment);
+	return true;
+}
+
+template <bool kSync>
+void
+Oscillator::doPolyBLEPPulse(float *buffer, int nFrames)
+{
+	const float duty = 0.5f + 0.5f * std::min(mPulseWidth, 0.9f);
+	auto naive = [duty] (float t) { return t < duty ? 1.f : -1.f; };
+	const float wrapStep = 2.f; // naive(0) - naive(1)
+
+	float phases[kChunkFrames], increments[kChunkFrames];
+	SyncEvent events[kChunkFrames];
+	for (int offset = 0; offset < nFrames; offset += kChunkFrames) {
+		const int n = std::min(nFrames - offset, kChunkFrames);
+		float *out = buffer + offset;
+		const int numEvents = polyBLEPPhases<kSync>(phases, increments, n, events);
+
+		for (int i = 0; i < n; i++) {
+			const float t = phases[i], dt = increments[i];
+			const float t2 = wrapPhase(t - duty);
+			out[i] = (t < duty ? 1.f : -1.f) + 2.f * polyBLEP(t, dt) - 2.f * polyBLEP(t2, dt);
+		}
+
+		for (int e = 0; e < numEvents; e++) {
+			const SyncEvent &event = events[e];
+			const float step = naive(0.f) - naive(event.phase);
+			// the edge at phase 0 already got the correction for a natural wrap
+			out[event.frame] += (step - wrapStep) * syncBLEPAfter(event.elapsed);
+			if (event.frame > 0) {
+				const int prev = event.frame - 1;
+				out[prev] += step * syncBLEPBefore(event.elapsed) - wrapStep * polyBLEPBefore(phases[prev], increments[prev]);
+			}
+		}
+		SyncEvent next;
+		if (kSync && predictSyncEvent(phases[n - 1], increments[n - 1], next)) {
+			const float step = naive(0.f) - naive(next.phase);
+			out[n - 1] += step * syncBLEPBefore(next.elapsed) - wrapStep * polyBLEPBefore(phases[n - 1], increments[n - 1]);
+		}
+	}
+}
+
+template <bool kSync>
+void
+Oscillator::doPolyBLEPSaw(float *buffer, int nFrames)
+{
+	// Same shape as saw(): rises for a fraction a of the cycle, centred on
+	// phase 0, and falls for the rest. The two corners get PolyBLAMP
+	// corrections, unless the fall is too short to fit between them, in which
+	// case it is treated as a step at phase 0.5 with a PolyBLEP correction.
+	const float a = std::min(std::max((mPulseWidth + 1.0f) / 2.0f, 0.5f), 1.f);
+	const float maxIncrement = std::max(mFrequency.getValue(), mFrequency.getFinalValue()) / rate;
+	const bool isStep = 1.f - a < 2.f * maxIncrement;
+	const float peak = a / 2.f, trough = 1.f - a / 2.f;
+	const float rise = 2.f / a, fall = isStep ? 0.f : 2.f / (1.f - a);
+	auto naive = [=] (float t) {
+		return isStep ? (wrapPhase(t + 0.5f) - 0.5f) * rise : skewedTriangle(t, trough, rise, fall);
+	};
+
+	float phases[kChunkFrames], increments[kChunkFrames];
+	SyncEvent events[kChunkFrames];
+	for (int offset = 0; offset < nFrames; offset += kChunkFrames) {
+		const int n = std::min(nFrames - offset, kChunkFrames);
+		float *out = buffer + offset;
+		const int numEvents = polyBLEPPhases<kSync>(phases, increments, n, events);
+
+		if (isStep) {
+			for (int i = 0; i < n; i++) {
+				const float t = phases[i], dt = increments[i];
+				const float t2 = wrapPhase(t + 0.5f);
+				out[i] = mPolarity * ((t2 - 0.5f) * rise - rise * polyBLEP(t2, dt));
+			}
+		} else {
+			const float slopeChange = rise + fall;
+			for (int i = 0; i < n; i++) {
+				const float t = phases[i], dt = increments[i];
+				const float y = skewedTriangle(t, trough, rise, fall);
+				out[i] = mPolarity * (y + slopeChange * dt * (polyBLAMP(t, trough, dt) - polyBLAMP(t, peak, dt)));
+			}
+		}
+
+		// The shape is continuous at phase 0, so a reset only needs the BLEP
+		// for the jump from wherever the phase was cut short
+		for (int e = 0; e < numEvents; e++) {
+			const SyncEvent &event = events[e];
+			const float step = mPolarity * (naive(0.f) - naive(event.phase));
+			out[event.frame] += step * syncBLEPAfter(event.elapsed);
+			if (event.frame > 0)
+				out[event.frame - 1] += step * syncBLEPBefore(event.elapsed);
+		}
+		SyncEvent next;
+		if (kSync && predictSyncEvent(phases[n - 1], increments[n - 1], next))
+			out[n - 1] += mPolarity * (naive(0.f) - naive(next.phase)) * syncBLEPBefore(next.elapsed);
+	}
+}
+
 static const float kTwoOverUlongMax = 2.0f / (float)ULONG_MAX;
 
-static inline float randf()
+static inline float randf(unsigned long &random)
 {
 	// Calculate pseudo-random 32 bit number based on linear congruential method.
 	// http://www.musicdsp.org/showone.php?id=59
-	static unsigned long random = 22222;
 	random = (random * 196314165) + 907633515;
 	return (float)random * kTwoOverUlongMax - 1.0f;
 }
@@ -191,7 +561,7 @@ Oscillator::doRandom(float *buffer, int nFrames)
     for (int i = 0; i < nFrames; i++) {
 	if (random_count > period) {
 	    random_count = 0;
-		random = randf();
+		random = randf(mRandomState);
 	}
 	random_count++;
 	buffer[i] = random;
@@ -202,5 +572,5 @@ void
 Oscillator::doNoise(float *buffer, int nFrames)
 {
     for (int i = 0; i < nFrames; i++)
-		buffer[i] = randf();
+		buffer[i] = randf(mRandomState);
 }
@@ -29,6 +29,13 @@
  * 
  * Provides several different output waveforms (sine, saw, square, noise, 
  * random).
+ *
+ * The sine, pulse and saw waveforms can be generated by one of several
+ * engines. kClassic computes each sample directly and is what presets were
+ * designed with; kWavetable reads band-limited tables (see Wavetables.h), which
+ * is cheaper and does not alias in the upper octaves. kPolyBLEP generates the
+ * pulse and saw waveforms directly and smooths their discontinuities (and the
+ * hard sync reset) with polynomial corrections; sine is generated as kClassic.
  */
 class Oscillator
 {
@@ -41,6 +48,14 @@ public:
 		kRandom
 	};
 
+	enum class Engine {
+		kClassic,
+		kWavetable,
+		kPolyBLEP
+	};
+
+	Oscillator();
+
 	void	SetSampleRate	(int rateIn);
 	
 	void	ProcessSamples		(float*, int, float freq_hz, float pw, float sync_freq = 0);
@@ -50,17 +65,25 @@ public:
 
 	void reset();
 	
-	void	setSyncEnabled(bool sync) { mSyncEnabled = sync; }
+	void	setSyncEnabled(bool sync);
 	void	setPolarity (float polarity); // +1 or -1
 
+	void	setEngine		(Engine engine);
+	Engine	getEngine		() const { return mEngine; }
+
+	// Each oscillator has its own noise generator so that voices can be rendered concurrently
+	void	setRandomSeed	(unsigned long seed) { mRandomState = seed; }
+
 private:
     float rads = 0;
 	float twopi_rate = 0;
 	float random = 0;
     int rate = 44100;
 	int random_count = 0;
+	unsigned long mRandomState = 22222;
 
 	Waveform waveform = Waveform::kSine;
+	Engine	mEngine = Engine::kClassic;
 	Lerper	mFrequency;
 	float	mPulseWidth = 0;
 	float	mPolarity = 1;
@@ -69,11 +92,29 @@ private:
 	bool	mSyncEnabled = false;
 	double	mSyncRads = 0;
 	
-    void doSine(float*, int nFrames);
-    void doSquare(float*, int nFrames);
-    void doSaw(float*, int nFrames);
-    void doNoise(float*, int nFrames);
+	// The waveform, engine and sync settings select one of the do*() functions
+	// below. Each is specialised on whether sync is enabled, so the per-sample
+	// loops do not test it.
+	typedef void (Oscillator::*ProcessFunction)(float *, int nFrames);
+	ProcessFunction	mProcess;
+	void	updateProcessFunction();
+
+	template <bool kSync> void doSine(float*, int nFrames);
+	template <bool kSync> void doSquare(float*, int nFrames);
+	template <bool kSync> void doSaw(float*, int nFrames);
+	void doNoise(float*, int nFrames);
 	void doRandom(float*, int nFrames);
+
+	template <bool kSync> void wavetablePositions(float*, int nFrames);
+	template <bool kSync> void doWavetableSine(float*, int nFrames);
+	template <bool kSync> void doWavetablePulse(float*, int nFrames);
+	template <bool kSync> void doWavetableSaw(float*, int nFrames);
+
+	struct SyncEvent;
+	template <bool kSync> int polyBLEPPhases(float *phases, float *increments, int nFrames, SyncEvent *events);
+	bool predictSyncEvent(float phase, float increment, SyncEvent &event);
+	template <bool kSync> void doPolyBLEPPulse(float*, int nFrames);
+	template <bool kSync> void doPolyBLEPSaw(float*, int nFrames);
 };
 
 #endif				/// _OSCILLATOR_H
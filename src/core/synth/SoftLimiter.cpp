@@ -1,7 +1,7 @@
 /*
  *  SoftLimiter.cpp
  *
- *  Copyright (c) 2001-2012 Nick Dowell
+ *  Copyright (c) 2001-2026 Nick Dowell
  *
  *  This file is part of amsynth.
  *
@@ -20,8 +20,10 @@
  */
 
 #include "SoftLimiter.h"
-#include <math.h>
-#include <iostream>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
 
 #define AT 0.001		// attack time in seconds
 #define RT 0.5			// release time in seconds
@@ -30,45 +32,111 @@
 void
 SoftLimiter::SetSampleRate	(int rate)
 {
-	xpeak=0;
-	attack=1-exp(-2.2/(AT*(float)rate));
-	release=1-exp(-2.2/(RT*(float)rate));
-	thresh=(float)log(THRESHOLD); // thresh in linear scale :)
+	// The per-sample coefficients, compounded over a segment
+	const double attack = 1 - exp(-2.2 / (AT * rate));
+	const double release = 1 - exp(-2.2 / (RT * rate));
+	mAttack = (float) (1 - pow(1 - attack, kControlPeriod));
+	mRelease = (float) pow(1 - release, kControlPeriod);
+	mThreshold = THRESHOLD;
+	reset();
+}
+
+void
+SoftLimiter::SetLookahead	(bool lookahead)
+{
+	if (lookahead == mLookahead)
+		return;
+	mLookahead = lookahead;
+	reset();
+}
+
+void
+SoftLimiter::reset	()
+{
+	mEnvelope = 0;
+	mSegmentPeak = 0;
+	mPhase = 0;
+	mGainStart = mGainEnd = mLastTarget = 1;
+	std::fill(mDelayL, mDelayL + kDelaySize, 0.f);
+	std::fill(mDelayR, mDelayR + kDelaySize, 0.f);
+	mDelayWrite = 0;
+}
+
+void
+SoftLimiter::Process	(float *l, float *r, unsigned nframes)
+{
+	while (nframes > 0) {
+		const int count = std::min((int) nframes, kControlPeriod - mPhase);
+		processSegment(l, r, count);
+		mPhase += count;
+		if (mPhase == kControlPeriod)
+			endSegment();
+		l += count;
+		r += count;
+		nframes -= count;
+	}
 }
 
 void
-SoftLimiter::Process	(float *l, float *r, unsigned nframes, int stride)
+SoftLimiter::processSegment	(float *l, float *r, int nframes)
 {
-	double x;
-	unsigned i;
-	for (i=0; i<nframes; i++)
-	{
-		x = fabs(*l) + fabs (*r);
-		
-		if (x>xpeak) xpeak=(1-release)*xpeak + attack*(x-xpeak);
-		else xpeak=(1-release)*xpeak;
-			
-		if (xpeak>0){
-//			x = 1/xpeak;
-			x = log(xpeak);
-			x -= thresh;
-			if (x<0) x = 0;
-//			x *= ((1/Ratio)-1); 
-			/* 1<= Ratio < infinity = compressor
-			   ratio=infinity = limiter
-			   0 < ratio < 1 = expander
-			   0 = gate
-			*/
-			else x *= -1;
-			x = exp(x);
-		} else x=1;
-		
-		// apply gain
-		*l *= x;
-		*r *= x;
-		
-		// Increment sample pointers, allowing for interleave (if any)
-		l += stride;
-		r += stride;
+	float peak = mSegmentPeak;
+	for (int i = 0; i < nframes; i++)
+		peak = std::max(peak, fabsf(l[i]) + fabsf(r[i]));
+	mSegmentPeak = peak;
+
+	if (mLookahead) {
+		float *inL = mDelayL + mDelayWrite + mPhase, *inR = mDelayR + mDelayWrite + mPhase;
+		int read = mDelayWrite - kLookaheadFrames;
+		if (read < 0) read += kDelaySize;
+		const float *outL = mDelayL + read + mPhase, *outR = mDelayR + read + mPhase;
+		std::copy(l, l + nframes, inL);
+		std::copy(r, r + nframes, inR);
+		std::copy(outL, outL + nframes, l);
+		std::copy(outR, outR + nframes, r);
 	}
+
+	// The common case: nothing near the threshold
+	if (mGainStart == 1 && mGainEnd == 1)
+		return;
+
+	// Computed from the position in the segment, so as not to depend on where it is split
+	const float step = (mGainEnd - mGainStart) / kControlPeriod;
+	for (int i = 0; i < nframes; i++) {
+		const float g = mGainStart + step * (float) (mPhase + 1 + i);
+		l[i] *= g;
+		r[i] *= g;
+	}
+}
+
+void
+SoftLimiter::endSegment	()
+{
+	const float peak = mSegmentPeak;
+	if (mLookahead)
+		mEnvelope = std::max(peak, mEnvelope * mRelease);
+	else if (peak > mEnvelope)
+		mEnvelope += (peak - mEnvelope) * mAttack;
+	else
+		mEnvelope *= mRelease;
+
+	// thresh / envelope is the gain of the original log domain limiter with
+	// an infinite ratio; only computed once the envelope crosses the threshold
+	const float target = mEnvelope > mThreshold ? mThreshold / mEnvelope : 1.f;
+
+	mGainStart = mGainEnd;
+	if (mLookahead) {
+		// The next segment out of the delay line is the one before last seen;
+		// the gain ends it at or below the targets of both it and its successor
+		mGainEnd = std::min(mLastTarget, target);
+	} else {
+		mGainEnd = target;
+	}
+	mLastTarget = target;
+
+	mSegmentPeak = 0;
+	mPhase = 0;
+	mDelayWrite += kControlPeriod;
+	if (mDelayWrite == kDelaySize)
+		mDelayWrite = 0;
 }
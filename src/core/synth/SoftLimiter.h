@@ -1,7 +1,7 @@
 /*
  *  SoftLimiter.h
  *
- *  Copyright (c) 2001-2012 Nick Dowell
+ *  Copyright (c) 2001-2026 Nick Dowell
  *
  *  This file is part of amsynth.
  *
@@ -22,13 +22,61 @@
 #ifndef _SOFTLIMITER_H
 #define _SOFTLIMITER_H
 
+/**
+ * Keeps the sum of the magnitudes of the left and right channels below a
+ * threshold.
+ *
+ * The peak envelope and the gain are updated once per kControlPeriod frames,
+ * on segments counted from the first frame processed rather than from the
+ * start of each block, so the output does not depend on how the input is
+ * split into blocks. The gain is interpolated across each segment. While the
+ * envelope is below the threshold the gain stays at 1 and the samples are
+ * left untouched.
+ *
+ * Without look-ahead the gain follows the segment that has just been seen,
+ * so the start of a sudden peak passes through before the gain comes down,
+ * as with an analog limiter. With look-ahead the output is delayed by
+ * getLatency() frames and the gain reaches the level for each segment
+ * before the segment is output, so no sample exceeds the threshold.
+ */
 class SoftLimiter
 {
 public:
+	static constexpr int kControlPeriod = 16;
+	static constexpr int kLookaheadFrames = 2 * kControlPeriod;
+
 	void	SetSampleRate	(int rate);
-	void	Process	(float *l, float *r, unsigned, int stride=1);
-  private:
-	double xpeak, attack, release, thresh;
+	void	SetLookahead	(bool lookahead);
+	bool	getLookahead	() const { return mLookahead; }
+	// Frames by which the output is delayed
+	unsigned	getLatency	() const { return mLookahead ? kLookaheadFrames : 0; }
+
+	// Processes planar blocks in place
+	void	Process	(float *l, float *r, unsigned nframes);
+	void	reset	();
+
+	float	getEnvelope	() const { return mEnvelope; }
+
+private:
+	static constexpr int kDelaySize = kLookaheadFrames + kControlPeriod;
+
+	void	processSegment	(float *l, float *r, int nframes);
+	void	endSegment		();
+
+	float	mAttack = 1, mRelease = 1;	// envelope coefficients per segment
+	float	mThreshold = 1;
+	bool	mLookahead = false;
+
+	float	mEnvelope = 0;
+	float	mSegmentPeak = 0;
+	int		mPhase = 0;					// frames into the current segment
+	float	mGainStart = 1, mGainEnd = 1;	// interpolated across the current segment
+	float	mLastTarget = 1;			// the gain wanted for the last segment seen
+
+	// The look-ahead delay line; whole segments, so a segment never wraps
+	float	mDelayL[kDelaySize];
+	float	mDelayR[kDelaySize];
+	int		mDelayWrite = 0;
 };
 
 #endif
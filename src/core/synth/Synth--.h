@@ -22,8 +22,14 @@
 #ifndef _SYNTH_MM_H
 #define _SYNTH_MM_H
 
+#if HAVE_CONFIG_H
+#include "config.h"
+#endif
+
 #include <algorithm>
 #include <cmath>
+#include <cstdint>
+#include <cstring>
 
 namespace m {
 	// The mathematical constant e
@@ -38,6 +44,114 @@ namespace m {
 	static const float nan = std::nanf("");
 }
 
+/**
+ * Approximations of the libm functions used on the audio thread.
+ *
+ * They are branch-free so that loops calling them can be vectorised, and are
+ * accurate to a few float ulps over the ranges noted below (tests/tests.cpp
+ * checks the bounds against libm). Arguments outside those ranges are not
+ * diagnosed.
+ */
+namespace fast {
+
+	static inline float bitsToFloat(uint32_t bits) { float x; memcpy(&x, &bits, sizeof(x)); return x; }
+	static inline uint32_t floatToBits(float x) { uint32_t bits; memcpy(&bits, &x, sizeof(bits)); return bits; }
+
+	// 2^x for -126 <= x <= 126 (clamped outside), relative error < 2e-7
+	static inline float exp2(float x)
+	{
+		x = std::min(std::max(x, -126.f), 126.f);
+		const int i = (int)(x + 126.5f) - 126; // round to nearest
+		const float u = (x - (float)i) * 0.693147181f; // |u| <= ln(2) / 2
+		float p = 1.f / 5040;
+		p = p * u + 1.f / 720;
+		p = p * u + 1.f / 120;
+		p = p * u + 1.f / 24;
+		p = p * u + 1.f / 6;
+		p = p * u + 0.5f;
+		p = p * u + 1.f;
+		p = p * u + 1.f;
+		return p * bitsToFloat((uint32_t)(i + 127) << 23);
+	}
+
+	// log2(x) for positive normal x, absolute error < 2e-7 + 6e-8 * |log2(x)|
+	static inline float log2(float x)
+	{
+		const uint32_t bits = floatToBits(x);
+		float e = (float)((int)(bits >> 23) - 127);
+		float mant = bitsToFloat((bits & 0x007fffff) | 0x3f800000); // [1, 2)
+		const float big = mant > 1.41421356f ? 1.f : 0.f;
+		mant *= 1.f - 0.5f * big; // [sqrt(0.5), sqrt(2))
+		e += big;
+		// ln(m) = 2 atanh((m - 1) / (m + 1)), |t| < 0.172
+		const float t = (mant - 1.f) / (mant + 1.f);
+		const float t2 = t * t;
+		float p = 1.f / 9;
+		p = p * t2 + 1.f / 7;
+		p = p * t2 + 1.f / 5;
+		p = p * t2 + 1.f / 3;
+		p = p * t2 + 1.f;
+		return e + 2.f * t * p * 1.44269504f;
+	}
+
+	static inline float exp(float x) { return exp2(x * 1.44269504f); }
+	static inline float log(float x) { return log2(x) * 0.693147181f; }
+
+	// x^y for x >= 0, relative error < 1e-6 * (1 + |y log2(x)|)
+	static inline float pow(float x, float y)
+	{
+		const float r = exp2(y * log2(x));
+		return x > 0.f ? r : 0.f;
+	}
+
+	// sin(x) for |x| < 1e4, absolute error < 3e-7
+	static inline float sin(float x)
+	{
+		// x - 2 pi round(x / 2 pi). 2 pi is split so that k * 6.28125 is exact
+		const float half = x < 0.f ? -0.5f : 0.5f;
+		const float k = (float)(int)(x * 0.159154943f + half);
+		x = (x - k * 6.28125f) - k * 1.93530718e-3f; // [-pi, pi]
+		// sin(x) = sin(pi - x) folds it into [-pi/2, pi/2]
+		const float fold = x > m::halfPi ? m::pi : (x < -m::halfPi ? -m::pi : 0.f);
+		x = fold - x * (fold != 0.f ? 1.f : -1.f);
+		const float x2 = x * x;
+		float p = -1.f / 39916800;
+		p = p * x2 + 1.f / 362880;
+		p = p * x2 - 1.f / 5040;
+		p = p * x2 + 1.f / 120;
+		p = p * x2 - 1.f / 6;
+		p = p * x2 + 1.f;
+		return p * x;
+	}
+
+	static inline float cos(float x) { return sin(x + m::halfPi); }
+
+	// tan(x) for |x| < pi/2, relative error < 2e-5 for |x| < 1.555
+	static inline float tan(float x) { return sin(x) / cos(x); }
+}
+
+/**
+ * The transcendental functions called by the DSP code. With the fast-math
+ * build option (ENABLE_FAST_MATH) they use the approximations above, otherwise
+ * the standard library. Each overload matches the precision of the call site
+ * it replaced.
+ */
+namespace dsp {
+#ifdef ENABLE_FAST_MATH
+	static inline float sin(float x) { return fast::sin(x); }
+	static inline double tan(double x) { return fast::tan((float)x); }
+	static inline float pow(float x, float y) { return fast::pow(x, y); }
+	static inline double exp(double x) { return fast::exp((float)x); }
+	static inline double log(double x) { return fast::log((float)x); }
+#else
+	static inline float sin(float x) { return sinf(x); }
+	static inline double tan(double x) { return ::tan(x); }
+	static inline float pow(float x, float y) { return powf(x, y); }
+	static inline double exp(double x) { return ::exp(x); }
+	static inline double log(double x) { return ::log(x); }
+#endif
+}
+
 class Lerper
 {
 public:
@@ -138,6 +252,11 @@ public:
 	{
 		_z = z;
 	}
+
+	inline float get() const
+	{
+		return _z;
+	}
 	
 private:
 	float _z;
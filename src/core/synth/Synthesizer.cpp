@@ -21,6 +21,7 @@
 
 #include "Synthesizer.h"
 
+#include "DenormalGuard.h"
 #include "MidiController.h"
 #include "PresetController.h"
 #include "VoiceAllocationUnit.h"
@@ -32,11 +33,25 @@
 #include <cstring>
 
 
+// The last event reached by a controller ramp, which the ramp continues from,
+// and the controller's next event, which it ramps towards
+struct Synthesizer::RampPoint
+{
+	unsigned frame = 0;
+	float value = 0;
+	bool valid = false;
+	bool pending = false; // reached, but not yet applied
+	unsigned next = 0; // index of the next event, or the event count if none
+	unsigned nextFrame = 0;
+	float nextValue = 0;
+};
+
 Synthesizer::Synthesizer()
 : _sampleRate(-1)
 , _midiController(nullptr)
 , _presetController(nullptr)
 , _voiceAllocationUnit(nullptr)
+, rampPoints_(new RampPoint[MidiController::kNumRampTargets])
 {
 	_voiceAllocationUnit = new VoiceAllocationUnit;
 	_voiceAllocationUnit->SetSampleRate((int) _sampleRate);
@@ -62,6 +77,7 @@ Synthesizer::~Synthesizer()
 	delete _midiController;
 	delete _presetController;
 	delete _voiceAllocationUnit;
+	delete [] rampPoints_;
 }
 
 void Synthesizer::setProperty(const char *name, const char *value)
@@ -80,6 +96,45 @@ void Synthesizer::setProperty(const char *name, const char *value)
 	if (name == std::string(PROP_NAME(pitch_bend_range)))
 		setPitchBendRangeSemitones(std::stoi(value));
 
+	if (name == std::string(PROP_NAME(render_threads)))
+		setRenderThreads(std::stoi(value));
+
+	if (name == std::string(PROP_NAME(block_size)))
+		setBlockSize(std::stoi(value));
+
+	if (name == std::string(PROP_NAME(controller_ramps)))
+		setControllerRamps(std::stoi(value));
+
+	if (name == std::string(PROP_NAME(oscillator_engine)))
+		setOscillatorEngine(value ? value : "");
+
+	if (name == std::string(PROP_NAME(envelope_shape)))
+		setEnvelopeShape(value ? value : "");
+
+	if (name == std::string(PROP_NAME(filter_engine)))
+		setFilterEngine(value ? value : "");
+
+	if (name == std::string(PROP_NAME(voice_kernel)))
+		setVoiceKernel(value ? value : "");
+
+	if (name == std::string(PROP_NAME(lfo_mode)))
+		setLFOMode(value ? value : "");
+
+	if (name == std::string(PROP_NAME(reverb_engine)))
+		setReverbEngine(value ? value : "");
+
+	if (name == std::string(PROP_NAME(distortion_oversampling)))
+		setDistortionOversampling(std::stoi(value));
+
+	if (name == std::string(PROP_NAME(limiter_lookahead)))
+		setLimiterLookahead(std::stoi(value));
+
+	if (name == std::string(PROP_NAME(pipelined_effects)))
+		setPipelinedEffects(std::stoi(value));
+
+	if (name == std::string(PROP_NAME(voice_retire_threshold)))
+		setVoiceRetireThreshold(std::stof(value));
+
 	if (name == std::string(PROP_NAME(tuning_kbm_file)))
 		loadTuningKeymap(value);
 
@@ -98,6 +153,19 @@ std::map<std::string, std::string> Synthesizer::getProperties()
 	props[PROP_NAME(max_polyphony)] = std::to_string(getMaxNumVoices());
 	props[PROP_NAME(midi_channel)] = std::to_string(getMidiChannel());
 	props[PROP_NAME(pitch_bend_range)] = std::to_string(getPitchBendRangeSemitones());
+	props[PROP_NAME(render_threads)] = std::to_string(getRenderThreads());
+	props[PROP_NAME(block_size)] = std::to_string(getBlockSize());
+	props[PROP_NAME(controller_ramps)] = getControllerRamps() ? "1" : "0";
+	props[PROP_NAME(oscillator_engine)] = getOscillatorEngine();
+	props[PROP_NAME(envelope_shape)] = getEnvelopeShape();
+	props[PROP_NAME(filter_engine)] = getFilterEngine();
+	props[PROP_NAME(voice_kernel)] = getVoiceKernel();
+	props[PROP_NAME(lfo_mode)] = getLFOMode();
+	props[PROP_NAME(reverb_engine)] = getReverbEngine();
+	props[PROP_NAME(distortion_oversampling)] = getDistortionOversampling() ? "1" : "0";
+	props[PROP_NAME(limiter_lookahead)] = getLimiterLookahead() ? "1" : "0";
+	props[PROP_NAME(pipelined_effects)] = getPipelinedEffects() ? "1" : "0";
+	props[PROP_NAME(voice_retire_threshold)] = std::to_string((int)getVoiceRetireThreshold());
 	if (!_voiceAllocationUnit->tuningMap.getKeyMapFile().empty())
 		props[PROP_NAME(tuning_kbm_file)] = _voiceAllocationUnit->tuningMap.getKeyMapFile();
 	if (!_voiceAllocationUnit->tuningMap.getScaleFile().empty())
@@ -216,6 +284,149 @@ void Synthesizer::setMaxNumVoices(int value)
 	_voiceAllocationUnit->SetMaxVoices(value);
 }
 
+int Synthesizer::getRenderThreads()
+{
+	return _voiceAllocationUnit->getRenderThreads();
+}
+
+void Synthesizer::setRenderThreads(int value)
+{
+	_voiceAllocationUnit->setRenderThreads(value);
+}
+
+int Synthesizer::getBlockSize()
+{
+	return _voiceAllocationUnit->getBlockSize();
+}
+
+void Synthesizer::setBlockSize(int frames)
+{
+	_voiceAllocationUnit->setBlockSize(frames);
+}
+
+bool Synthesizer::getControllerRamps()
+{
+	return controllerRamps_.load(std::memory_order_relaxed);
+}
+
+void Synthesizer::setControllerRamps(bool ramps)
+{
+	controllerRamps_.store(ramps);
+}
+
+static const char *kOscillatorEngineNames[] = { "classic", "wavetable", "polyblep" };
+
+std::string Synthesizer::getOscillatorEngine()
+{
+	return kOscillatorEngineNames[(int)_voiceAllocationUnit->getOscillatorEngine()];
+}
+
+void Synthesizer::setOscillatorEngine(const std::string &name)
+{
+	Oscillator::Engine engine = Oscillator::Engine::kClassic;
+	for (int i = 0; i < (int)(sizeof(kOscillatorEngineNames) / sizeof(kOscillatorEngineNames[0])); i++) {
+		if (name == kOscillatorEngineNames[i])
+			engine = (Oscillator::Engine)i;
+	}
+	_voiceAllocationUnit->setOscillatorEngine(engine);
+}
+
+std::string Synthesizer::getEnvelopeShape()
+{
+	return _voiceAllocationUnit->getEnvelopeShape() == ADSR::Shape::kExponential ? "exponential" : "linear";
+}
+
+void Synthesizer::setEnvelopeShape(const std::string &name)
+{
+	_voiceAllocationUnit->setEnvelopeShape(name == "exponential" ? ADSR::Shape::kExponential : ADSR::Shape::kLinear);
+}
+
+std::string Synthesizer::getFilterEngine()
+{
+	return _voiceAllocationUnit->getFilterEngine() == SynthFilter::Engine::kSVF ? "svf" : "biquad";
+}
+
+void Synthesizer::setFilterEngine(const std::string &name)
+{
+	_voiceAllocationUnit->setFilterEngine(name == "svf" ? SynthFilter::Engine::kSVF : SynthFilter::Engine::kBiquad);
+}
+
+std::string Synthesizer::getVoiceKernel()
+{
+	return _voiceAllocationUnit->getFusedKernel() ? "fused" : "staged";
+}
+
+void Synthesizer::setVoiceKernel(const std::string &name)
+{
+	_voiceAllocationUnit->setFusedKernel(name == "fused");
+}
+
+std::string Synthesizer::getLFOMode()
+{
+	return _voiceAllocationUnit->getSharedLFO() ? "global" : "voice";
+}
+
+void Synthesizer::setLFOMode(const std::string &name)
+{
+	_voiceAllocationUnit->setSharedLFO(name == "global");
+}
+
+std::string Synthesizer::getReverbEngine()
+{
+	return _voiceAllocationUnit->getReverbEngine() == VoiceAllocationUnit::ReverbEngine::kFDN ? "fdn" : "freeverb";
+}
+
+void Synthesizer::setReverbEngine(const std::string &name)
+{
+	_voiceAllocationUnit->setReverbEngine(name == "fdn" ? VoiceAllocationUnit::ReverbEngine::kFDN
+														 : VoiceAllocationUnit::ReverbEngine::kFreeverb);
+}
+
+bool Synthesizer::getDistortionOversampling()
+{
+	return _voiceAllocationUnit->getDistortionOversampling();
+}
+
+void Synthesizer::setDistortionOversampling(bool oversampling)
+{
+	_voiceAllocationUnit->setDistortionOversampling(oversampling);
+}
+
+bool Synthesizer::getLimiterLookahead()
+{
+	return _voiceAllocationUnit->getLimiterLookahead();
+}
+
+void Synthesizer::setLimiterLookahead(bool lookahead)
+{
+	_voiceAllocationUnit->setLimiterLookahead(lookahead);
+}
+
+bool Synthesizer::getPipelinedEffects()
+{
+	return _voiceAllocationUnit->getPipelinedEffects();
+}
+
+void Synthesizer::setPipelinedEffects(bool pipelined)
+{
+	_voiceAllocationUnit->setPipelinedEffects(pipelined);
+}
+
+unsigned Synthesizer::getLatency()
+{
+	return _voiceAllocationUnit->getLatency();
+}
+
+float Synthesizer::getVoiceRetireThreshold()
+{
+	return _voiceAllocationUnit->getVoiceRetireThreshold();
+}
+
+void Synthesizer::setVoiceRetireThreshold(float dBFS)
+{
+	_voiceAllocationUnit->setVoiceRetireThreshold(dBFS);
+}
+
 unsigned char Synthesizer::getMidiChannel()
 {
 	return _midiController->assignedChannel;
@@ -259,27 +470,79 @@ void Synthesizer::process(unsigned int nframes,
 						  const std::vector<amsynth_midi_event_t> &midi_in,
 						  std::vector<amsynth_midi_cc_t> &midi_out,
 						  float *audio_l, float *audio_r, unsigned audio_stride)
+{
+	MidiOutputBuffer output;
+	process(nframes, midi_in.data(), (unsigned)midi_in.size(), output, audio_l, audio_r, audio_stride);
+	midi_out.insert(midi_out.end(), output.begin(), output.end());
+}
+
+void Synthesizer::process(unsigned int nframes,
+						  const amsynth_midi_event_t *midi_in, unsigned midi_in_count,
+						  MidiOutputBuffer &midi_out,
+						  float *audio_l, float *audio_r, unsigned audio_stride)
 {
 	if (_sampleRate < 0) {
 		assert(nullptr == "sample rate has not been set");
 		return;
 	}
+	// Here rather than in each plug-in and audio driver, so that every host path is covered
+	DenormalGuard denormalGuard;
 	if (needsResetAllVoices_) {
 		needsResetAllVoices_ = false;
 		_voiceAllocationUnit->resetAllVoices();
 	}
-	std::vector<amsynth_midi_event_t>::const_iterator event = midi_in.begin();
+	const amsynth_midi_event_t *event = midi_in, *midi_in_end = midi_in + midi_in_count;
+	const unsigned max_block_size = (unsigned)_voiceAllocationUnit->getBlockSize();
 	unsigned frames_left_in_buffer = nframes, frame_index = 0;
+
+	// Controller ramps start from the values at the start of the buffer
+	const bool ramps = controllerRamps_.load(std::memory_order_relaxed);
+	bool ramps_in_flight = ramps && midi_in_count > 0;
+	unsigned ramp_cursor = 0;
+	float ramp_value;
+	if (ramps) {
+		for (int i = 0; i < MidiController::kNumRampTargets; i++) {
+			rampPoints_[i].valid = false;
+			rampPoints_[i].next = midi_in_count;
+		}
+		// Backwards, so that each controller ends up with its first event
+		for (unsigned i = midi_in_count; i-- > 0; ) {
+			int target = _midiController->getRampTarget(midi_in[i].buffer, midi_in[i].length, ramp_value);
+			if (target >= 0) {
+				rampPoints_[target].next = i;
+				rampPoints_[target].nextFrame = midi_in[i].offset_frames;
+				rampPoints_[target].nextValue = ramp_value;
+			}
+		}
+	}
+
 	while (frames_left_in_buffer) {
-		while (event != midi_in.end() && event->offset_frames <= frame_index) {
-			_midiController->HandleMidiData(event->buffer, event->length);
+		while (event != midi_in_end && event->offset_frames <= frame_index) {
+			// Ramped events have been applied by updateControllerRamps()
+			if (!ramps || _midiController->getRampTarget(event->buffer, event->length, ramp_value) < 0)
+				_midiController->HandleMidiData(event->buffer, event->length);
+			else
+				_midiController->skipRampEvent(event->buffer);
 			++event;
 		}
 		
-		unsigned block_size_frames = std::min(frames_left_in_buffer, (unsigned)VoiceBoard::kMaxProcessBufferSize);
-		if (event != midi_in.end() && event->offset_frames > frame_index) {
-			unsigned frames_until_next_event = event->offset_frames - frame_index;
-			block_size_frames = std::min(block_size_frames, frames_until_next_event);
+		unsigned block_size_frames = std::min(frames_left_in_buffer, max_block_size);
+		// Events are sorted, so the scan can stop at the end of the block
+		for (auto next = event; next != midi_in_end && next->offset_frames < frame_index + block_size_frames; ++next) {
+			if (ramps && _midiController->getRampTarget(next->buffer, next->length, ramp_value) >= 0)
+				continue;
+			if (next->offset_frames > frame_index) {
+				unsigned frames_until_next_event = next->offset_frames - frame_index;
+				block_size_frames = std::min(block_size_frames, frames_until_next_event);
+			}
+			break;
+		}
+		if (ramps_in_flight) {
+			// Voices update their pitch, filter and amp once per slice of
+			// kMaxProcessBufferSize frames, so ramping in longer blocks would
+			// step the controllers at a coarser rate than the voices can follow
+			block_size_frames = std::min(block_size_frames, (unsigned)VoiceBoard::kMaxProcessBufferSize);
+			ramps_in_flight = updateControllerRamps(midi_in, midi_in_count, ramp_cursor, frame_index + block_size_frames);
 		}
 		
 		_voiceAllocationUnit->Process(audio_l + (frame_index * audio_stride),
@@ -289,9 +552,65 @@ void Synthesizer::process(unsigned int nframes,
 		frame_index += block_size_frames;
 		frames_left_in_buffer -= block_size_frames;
 	}
-	while (event != midi_in.end()) {
-		_midiController->HandleMidiData(event->buffer, event->length);
+	while (event != midi_in_end) {
+		// As above, except for any events beyond the end of the buffer
+		int target = ramps ? _midiController->getRampTarget(event->buffer, event->length, ramp_value) : -1;
+		if (target < 0) {
+			_midiController->HandleMidiData(event->buffer, event->length);
+		} else {
+			_midiController->skipRampEvent(event->buffer);
+			if (event->offset_frames > nframes)
+				_midiController->setRampValue(target, ramp_value);
+		}
 		++event;
 	}
 	_midiController->generateMidiOutput(midi_out);
 }
+
+// Moves each ramped controller to where it will be at frame `end`, on a line
+// from its value at the start of the buffer, or its last event, to its next
+// event. Returns whether any controller still has an event to ramp towards.
+// Each event is reached by the cursor once, and looked past at most once per
+// controller while finding that controller's next event, so the cost does
+// not grow with the number of slices.
+bool Synthesizer::updateControllerRamps(const amsynth_midi_event_t *midi_in, unsigned midi_in_count, unsigned &cursor, unsigned end)
+{
+	float value;
+	for (; cursor < midi_in_count && midi_in[cursor].offset_frames <= end; cursor++) {
+		const amsynth_midi_event_t &event = midi_in[cursor];
+		int target = _midiController->getRampTarget(event.buffer, event.length, value);
+		if (target < 0)
+			continue;
+		RampPoint &point = rampPoints_[target];
+		point.frame = event.offset_frames;
+		point.value = value;
+		point.valid = point.pending = true;
+		unsigned i = cursor + 1;
+		while (i < midi_in_count && _midiController->getRampTarget(midi_in[i].buffer, midi_in[i].length, value) != target)
+			i++;
+		point.next = i;
+		if (i < midi_in_count) {
+			point.nextFrame = midi_in[i].offset_frames;
+			point.nextValue = value;
+		}
+	}
+
+	bool in_flight = false;
+	for (int target = 0; target < MidiController::kNumRampTargets; target++) {
+		RampPoint &point = rampPoints_[target];
+		if (point.next < midi_in_count) {
+			if (!point.valid) {
+				point.frame = 0;
+				point.value = _midiController->getRampValue(target);
+				point.valid = true;
+			}
+			const float position = (float)(end - point.frame) / (float)(point.nextFrame - point.frame);
+			_midiController->setRampValue(target, point.value + (point.nextValue - point.value) * position);
+			in_flight = true;
+		} else if (point.pending) {
+			_midiController->setRampValue(target, point.value);
+		}
+		point.pending = false;
+	}
+	return in_flight;
+}
@@ -24,22 +24,37 @@
 
 #include "core/controls.h"
 #include "core/types.h"
+#include "core/synth/EventBuffer.h"
 
+#include <atomic>
 #include <map>
 #include <string>
 #include <vector>
 
 enum class PropertyID
 {
+	block_size,
+	controller_ramps,
+	distortion_oversampling,
+	envelope_shape,
+	filter_engine,
+	lfo_mode,
+	limiter_lookahead,
 	max_polyphony,
 	midi_channel,
+	oscillator_engine,
+	pipelined_effects,
 	pitch_bend_range,
 	preset_bank_name,
 	preset_name,
 	preset_number,
+	render_threads,
+	reverb_engine,
 	tuning_kbm_file,
 	tuning_scl_file,
 	tuning_mts_esp_disabled,
+	voice_kernel,
+	voice_retire_threshold,
 };
 
 #ifdef NDEBUG
@@ -89,6 +104,63 @@ public:
 	int getMaxNumVoices();
 	void setMaxNumVoices(int value);
 
+	int getRenderThreads();
+	void setRenderThreads(int value);
+
+	// The most frames rendered at a time, 16 to 512; larger blocks use less CPU
+	// but add latency in pipelined mode
+	int getBlockSize();
+	void setBlockSize(int frames);
+
+	// "classic", "wavetable" or "polyblep"
+	std::string getOscillatorEngine();
+	void setOscillatorEngine(const std::string &name);
+
+	// "linear" (the default) or "exponential"
+	std::string getEnvelopeShape();
+	void setEnvelopeShape(const std::string &name);
+
+	// "biquad" (the default) or "svf"
+	std::string getFilterEngine();
+	void setFilterEngine(const std::string &name);
+
+	// "staged" (the default) or "fused"
+	std::string getVoiceKernel();
+	void setVoiceKernel(const std::string &name);
+
+	// "voice" gives each voice its own LFO, "global" shares one between all voices
+	std::string getLFOMode();
+	void setLFOMode(const std::string &name);
+
+	// "freeverb" (the default) or "fdn"; not to be called on the audio thread
+	std::string getReverbEngine();
+	void setReverbEngine(const std::string &name);
+
+	// Oversamples the distortion, adding a few frames of latency
+	bool getDistortionOversampling();
+	void setDistortionOversampling(bool oversampling);
+
+	// Delays the output by a few frames so that the limiter catches every peak
+	bool getLimiterLookahead();
+	void setLimiterLookahead(bool lookahead);
+
+	// Runs the effects on a helper thread, delaying the output by getLatency()
+	// frames; not to be called on the audio thread
+	bool getPipelinedEffects();
+	void setPipelinedEffects(bool pipelined);
+	// Frames by which the output lags, for hosts to compensate
+	unsigned getLatency();
+
+	// Applies MIDI CCs mapped to parameters, and the pitch wheel, as ramps
+	// updated every few frames instead of splitting the block at each event,
+	// so that dense controller data costs no more than sparse
+	bool getControllerRamps();
+	void setControllerRamps(bool ramps);
+
+	// dBFS; released voices quieter than this stop early
+	float getVoiceRetireThreshold();
+	void setVoiceRetireThreshold(float dBFS);
+
 	static constexpr unsigned char kMidiChannel_Any = 0;
 	unsigned char getMidiChannel();
 	void setMidiChannel(unsigned char);
@@ -98,6 +170,15 @@ public:
 
 	void setSampleRate(int sampleRate);
 
+	// Renders nframes, applying midi_in (sorted by offset_frames) on the way
+	// and appending any MIDI CC feedback to midi_out. Never allocates, so it
+	// is safe to call from a realtime audio thread.
+	void process(unsigned nframes,
+				 const amsynth_midi_event_t *midi_in, unsigned midi_in_count,
+				 MidiOutputBuffer &midi_out,
+				 float *audio_l, float *audio_r, unsigned audio_stride = 1);
+
+	// As above, for callers off the audio thread, e.g. tests and offline rendering
 	void process(unsigned nframes,
 				 const std::vector<amsynth_midi_event_t> &midi_in,
 				 std::vector<amsynth_midi_cc_t> &midi_out,
@@ -115,8 +196,14 @@ public:
 	
 private:
 
+	bool updateControllerRamps(const amsynth_midi_event_t *midi_in, unsigned midi_in_count, unsigned &cursor, unsigned end);
+
 	bool needsResetAllVoices_ = false;
 	Properties propertyStore_;
+
+	struct RampPoint;
+	std::atomic<bool> controllerRamps_{false};
+	RampPoint *rampPoints_; // one per MidiController ramp target
 };
 
 #endif /* defined(__amsynth__Synthesizer__) */
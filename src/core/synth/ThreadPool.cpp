@@ -0,0 +1,314 @@
+/*
+ *  ThreadPool.cpp
+ *
+ *  Copyright (c) 2026 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "ThreadPool.h"
+
+#include "DenormalGuard.h"
+
+#include <algorithm>
+#include <climits>
+
+#if defined(__linux__)
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#elif defined(__APPLE__)
+#include <dispatch/dispatch.h>
+#elif !defined(_WIN32)
+#include <cerrno>
+#include <semaphore.h>
+#endif
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#if defined(_MSC_VER)
+#pragma comment(lib, "Synchronization.lib") // WaitOnAddress
+#endif
+#else
+#include <pthread.h>
+#endif
+
+#if defined(__i386__) || defined(__x86_64__) || defined(_M_IX86) || defined(_M_X64)
+#include <immintrin.h>
+#define CPU_RELAX() _mm_pause()
+#elif defined(__aarch64__) || defined(__arm__)
+#define CPU_RELAX() __asm__ __volatile__("yield")
+#else
+#define CPU_RELAX() ((void)0)
+#endif
+
+// Roughly 50-200us depending on the CPU; long enough for a worker to still be
+// awake when the next audio block arrives at small buffer sizes
+static const int kSpinIterations = 4096;
+
+static inline uint64_t pack(uint32_t begin, uint32_t end) { return ((uint64_t)begin << 32) | end; }
+static inline uint32_t rangeBegin(uint64_t range) { return (uint32_t)(range >> 32); }
+static inline uint32_t rangeEnd(uint64_t range) { return (uint32_t)range; }
+
+// A worker that has given up spinning counts itself in mSleepers, then checks
+// the generation once more before it sleeps. start() bumps the generation
+// before it reads mSleepers, so either the worker sees the new generation or
+// start() sees the worker and wakes it. None of the wakes below take a lock,
+// so they are safe on the audio thread.
+
+#if defined(__linux__) || defined(_WIN32)
+
+static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex requires a plain 32-bit word");
+
+struct ThreadPool::Sleep {};
+
+void
+ThreadPool::waitForWork(uint32_t generation)
+{
+	for (int i = 0; i < kSpinIterations; i++) {
+		if (mGeneration.load(std::memory_order_acquire) != generation)
+			return;
+		CPU_RELAX();
+	}
+	while (mGeneration.load(std::memory_order_acquire) == generation) {
+		mSleepers.fetch_add(1);
+		if (mGeneration.load() == generation) {
+#if defined(__linux__)
+			syscall(SYS_futex, reinterpret_cast<uint32_t *>(&mGeneration), FUTEX_WAIT_PRIVATE, generation, nullptr, nullptr, 0);
+#else
+			WaitOnAddress(reinterpret_cast<uint32_t *>(&mGeneration), &generation, sizeof(generation), INFINITE);
+#endif
+		}
+		mSleepers.fetch_sub(1);
+	}
+}
+
+void
+ThreadPool::wakeWorkers()
+{
+#if defined(__linux__)
+	syscall(SYS_futex, reinterpret_cast<uint32_t *>(&mGeneration), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+	WakeByAddressAll(reinterpret_cast<uint32_t *>(&mGeneration));
+#endif
+}
+
+#else
+
+// Posted once per sleeping worker. A worker that counted itself but then saw
+// the new generation leaves its post unclaimed, which only costs the next
+// sleep an extra trip round the loop.
+struct ThreadPool::Sleep
+{
+#if defined(__APPLE__)
+	dispatch_semaphore_t semaphore = dispatch_semaphore_create(0);
+	~Sleep() { dispatch_release(semaphore); }
+	void wait() { dispatch_semaphore_wait(semaphore, DISPATCH_TIME_FOREVER); }
+	void post() { dispatch_semaphore_signal(semaphore); }
+#else
+	sem_t semaphore;
+	Sleep() { sem_init(&semaphore, 0, 0); }
+	~Sleep() { sem_destroy(&semaphore); }
+	void wait() { while (sem_wait(&semaphore) != 0 && errno == EINTR) {} }
+	void post() { sem_post(&semaphore); }
+#endif
+};
+
+void
+ThreadPool::waitForWork(uint32_t generation)
+{
+	for (int i = 0; i < kSpinIterations; i++) {
+		if (mGeneration.load(std::memory_order_acquire) != generation)
+			return;
+		CPU_RELAX();
+	}
+	while (mGeneration.load(std::memory_order_acquire) == generation) {
+		mSleepers.fetch_add(1);
+		if (mGeneration.load() == generation)
+			mSleep->wait();
+		mSleepers.fetch_sub(1);
+	}
+}
+
+void
+ThreadPool::wakeWorkers()
+{
+	for (int i = mSleepers.load(); i > 0; i--)
+		mSleep->post();
+}
+
+#endif
+
+ThreadPool::ThreadPool(int numThreads)
+:	mNumThreads(std::min(std::max(numThreads, 1), (int)kMaxThreads))
+,	mSleep(new Sleep)
+{
+	for (int i = 1; i < mNumThreads; i++)
+		mWorkers.emplace_back(&ThreadPool::workerMain, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	mQuit.store(true);
+	mGeneration.fetch_add(1);
+	wakeWorkers();
+	for (auto &worker : mWorkers)
+		worker.join();
+	delete mSleep;
+}
+
+void
+ThreadPool::run(TaskFunction function, void *context, int numTasks)
+{
+	if (numTasks <= 0)
+		return;
+
+	start(function, context, numTasks, 0);
+	runTasks(0);
+	wait();
+}
+
+void
+ThreadPool::runAsync(TaskFunction function, void *context, int numTasks)
+{
+	if (numTasks <= 0)
+		return;
+
+	if (mNumThreads == 1) {
+		for (int i = 0; i < numTasks; i++)
+			function(context, i);
+		return;
+	}
+
+	start(function, context, numTasks, 1);
+}
+
+void
+ThreadPool::start(TaskFunction function, void *context, int numTasks, int firstThread)
+{
+	if (!mSchedulingInherited)
+		inheritSchedulingPolicy();
+
+	// Everything a worker needs is published before the queues are filled, and
+	// a worker only reads it after claiming a task, so a worker that is still
+	// scanning the queues from the previous run cannot see stale values.
+	mFunction.store(function, std::memory_order_relaxed);
+	mContext.store(context, std::memory_order_relaxed);
+	mRemaining.store(numTasks, std::memory_order_relaxed);
+	const int numThreads = mNumThreads - firstThread;
+	for (int i = 0; i < mNumThreads; i++) {
+		const int n = i - firstThread;
+		uint32_t begin = n < 0 ? 0 : (uint32_t)((int64_t)numTasks * n / numThreads);
+		uint32_t end = n < 0 ? 0 : (uint32_t)((int64_t)numTasks * (n + 1) / numThreads);
+		mQueues[i].range.store(pack(begin, end), std::memory_order_release);
+	}
+
+	mGeneration.fetch_add(1);
+	if (mSleepers.load())
+		wakeWorkers();
+}
+
+void
+ThreadPool::wait()
+{
+	for (int i = 0; mRemaining.load(std::memory_order_acquire) != 0; i++) {
+		if (i < kSpinIterations)
+			CPU_RELAX();
+		else
+			std::this_thread::yield();
+	}
+}
+
+bool
+ThreadPool::popFront(int queue, int &task)
+{
+	std::atomic<uint64_t> &range = mQueues[queue].range;
+	uint64_t current = range.load(std::memory_order_acquire);
+	while (rangeBegin(current) < rangeEnd(current)) {
+		if (range.compare_exchange_weak(current, pack(rangeBegin(current) + 1, rangeEnd(current)), std::memory_order_acq_rel)) {
+			task = (int)rangeBegin(current);
+			return true;
+		}
+	}
+	return false;
+}
+
+bool
+ThreadPool::popBack(int queue, int &task)
+{
+	std::atomic<uint64_t> &range = mQueues[queue].range;
+	uint64_t current = range.load(std::memory_order_acquire);
+	while (rangeBegin(current) < rangeEnd(current)) {
+		if (range.compare_exchange_weak(current, pack(rangeBegin(current), rangeEnd(current) - 1), std::memory_order_acq_rel)) {
+			task = (int)rangeEnd(current) - 1;
+			return true;
+		}
+	}
+	return false;
+}
+
+void
+ThreadPool::runTasks(int thread)
+{
+	int task;
+	while (popFront(thread, task)) {
+		mFunction.load(std::memory_order_relaxed)(mContext.load(std::memory_order_relaxed), task);
+		mRemaining.fetch_sub(1, std::memory_order_release);
+	}
+	for (int i = 1; i < mNumThreads; i++) {
+		int victim = (thread + i) % mNumThreads;
+		while (popBack(victim, task)) {
+			mFunction.load(std::memory_order_relaxed)(mContext.load(std::memory_order_relaxed), task);
+			mRemaining.fetch_sub(1, std::memory_order_release);
+		}
+	}
+}
+
+void
+ThreadPool::workerMain(int thread)
+{
+	// Workers only ever run audio tasks, so keep denormals flushed for good
+	DenormalGuard denormalGuard;
+	uint32_t generation = 0;
+	for (;;) {
+		waitForWork(generation);
+		generation = mGeneration.load(std::memory_order_acquire);
+		if (mQuit.load())
+			return;
+		runTasks(thread);
+	}
+}
+
+void
+ThreadPool::inheritSchedulingPolicy()
+{
+	// Workers are started from a non-realtime thread; give them the priority
+	// of the audio thread the first time it hands them work
+#if defined(_WIN32)
+	int priority = GetThreadPriority(GetCurrentThread());
+	for (auto &worker : mWorkers)
+		SetThreadPriority(worker.native_handle(), priority);
+#else
+	int policy;
+	struct sched_param param;
+	if (pthread_getschedparam(pthread_self(), &policy, &param) == 0) {
+		for (auto &worker : mWorkers)
+			pthread_setschedparam(worker.native_handle(), policy, &param);
+	}
+#endif
+	mSchedulingInherited = true;
+}
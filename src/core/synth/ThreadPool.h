@@ -0,0 +1,122 @@
+/*
+ *  ThreadPool.h
+ *
+ *  Copyright (c) 2026 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include <atomic>
+#include <cstdint>
+#include <thread>
+#include <vector>
+
+/**
+ * A small pool of worker threads for splitting audio rendering across cores.
+ *
+ * run() is called from the audio thread and does not allocate or take locks.
+ * Tasks are dealt out in contiguous ranges, one range per thread, and a thread
+ * that finishes its own range steals from the back of the others. Idle workers
+ * spin briefly before sleeping on a futex (WaitOnAddress() on Windows, a
+ * semaphore on macOS and other platforms), so back-to-back audio blocks do not
+ * pay for a kernel wakeup. Waking a sleeping worker does not take a lock.
+ *
+ * Tasks must not depend on which thread runs them or in what order; callers
+ * that need deterministic output should write per-task results and combine
+ * them in task order once run() returns.
+ */
+class ThreadPool
+{
+public:
+
+	typedef void (*TaskFunction)(void *context, int task);
+
+	static constexpr int kMaxThreads = 16;
+
+	/**
+	 * numThreads includes the thread that calls run(), so a pool of N threads
+	 * starts N-1 workers.
+	 */
+	explicit ThreadPool(int numThreads);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool &) = delete;
+	ThreadPool & operator=(const ThreadPool &) = delete;
+
+	int		getNumThreads	() const { return mNumThreads; }
+
+	/**
+	 * Calls function(context, i) for every i in [0, numTasks) and returns once
+	 * all of them have completed. The calling thread executes tasks too.
+	 */
+	void	run				(TaskFunction function, void *context, int numTasks);
+
+	/**
+	 * As run(), but returns without waiting and without running any tasks on
+	 * the calling thread, which can get on with other work meanwhile. wait()
+	 * must be called before the next run() or runAsync(). A pool without
+	 * workers runs the tasks before returning.
+	 */
+	void	runAsync		(TaskFunction function, void *context, int numTasks);
+
+	// Returns once every task has completed
+	void	wait			();
+
+private:
+
+	void	start			(TaskFunction function, void *context, int numTasks, int firstThread);
+
+	// A range of unclaimed tasks packed as (begin << 32 | end) so that the
+	// owner (taking from the front) and thieves (taking from the back) can
+	// both claim a task with a single compare-and-swap. Padded so that each
+	// queue sits on its own cache line (alignas would need C++17 aligned new).
+	struct Queue
+	{
+		std::atomic<uint64_t> range{0};
+		char padding[64 - sizeof(std::atomic<uint64_t>)];
+	};
+
+	bool	popFront		(int queue, int &task);
+	bool	popBack			(int queue, int &task);
+	void	runTasks		(int thread);
+	void	workerMain		(int thread);
+	void	waitForWork		(uint32_t generation);
+	void	wakeWorkers		();
+	void	inheritSchedulingPolicy	();
+
+	int							mNumThreads;
+	Queue						mQueues[kMaxThreads];
+	std::vector<std::thread>	mWorkers;
+
+	std::atomic<TaskFunction>	mFunction{nullptr};
+	std::atomic<void *>			mContext{nullptr};
+
+	char								mPadding0[64];
+	std::atomic<int>					mRemaining{0};
+	char								mPadding1[64];
+	std::atomic<uint32_t>				mGeneration{0};
+	std::atomic<int>					mSleepers{0};
+	std::atomic<bool>					mQuit{false};
+	bool								mSchedulingInherited = false;
+
+	struct Sleep;
+	Sleep	*mSleep;
+};
+
+#endif
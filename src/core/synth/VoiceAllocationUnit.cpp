@@ -22,21 +22,28 @@
 #include "VoiceAllocationUnit.h"
 
 #include "Distortion.h"
+#include "FDNReverb.h"
 #include "SoftLimiter.h"
+#include "ThreadPool.h"
 #include "VoiceBoard.h"
+#include "Wavetables.h"
 #include "freeverb/revmodel.hpp"
 
 #ifdef WITH_MTS_ESP
 #include "MTS-ESP/Client/libMTSClient.h"
 #endif
 
+#include <algorithm>
 #include <assert.h>
 #include <cstring>
 #include <iostream>
 #include <math.h>
 
 
-const unsigned kBufferSize = 1024;
+const unsigned kMaxTasks = VoiceAllocationUnit::kMaxVoices / VoiceAllocationUnit::kVoicesPerTask;
+
+// Output below this level (-120 dBFS) with no voices playing counts as silence
+const float kIdleThreshold = 1e-6f;
 
 
 VoiceAllocationUnit::VoiceAllocationUnit ()
@@ -45,6 +52,7 @@ VoiceAllocationUnit::VoiceAllocationUnit ()
 ,	mPortamentoMode(PortamentoModeAlways)
 ,	sustain (0)
 ,	_keyboardMode(KeyboardModePoly)
+,	_keyPressCounter (0)
 ,	mMasterVol (1.0)
 ,	mPanGainLeft(1)
 ,	mPanGainRight(1)
@@ -57,17 +65,21 @@ VoiceAllocationUnit::VoiceAllocationUnit ()
 {
 	limiter = new SoftLimiter;
 	reverb = new revmodel;
+	fdnReverb = new FDNReverb;
 	distortion = new Distortion;
-	mBuffer = new float [kBufferSize * 2];
+	mBuffer = new float [kMaxBlockSize];
+	mTaskBuffers = new float [kMaxTasks * kMaxBlockSize];
+	mCoefficientCaches = new SynthFilter::CoefficientCache [kMaxTasks];
+	mPatch = new VoicePatch;
+	mLFO = new ModulationLFO;
+	mLFO->setRandomSeed(11111);
+	mLFOBuffer = new float [kMaxBlockSize];
+	mPipelineBuffers = new float [2 * kPipelineSlotSize];
+	mEffectsBuffer = new float [2 * kMaxBlockSize];
+	static_assert(kAmsynthParameterCount <= 64, "mDeferredEffectParameters has a bit per parameter");
 
-	for (int i = 0; i < 128; i++)
-	{
-		keyPressed[i] = false;
-		active[i] = false;
-		_voices.push_back (new VoiceBoard);
-	}
-	
-	memset(&_keyPresses, 0, sizeof(_keyPresses));
+	SetMaxVoices (0);
+	resetAllVoices();
 
 	SetSampleRate (44100);
 }
@@ -77,187 +89,379 @@ VoiceAllocationUnit::~VoiceAllocationUnit	()
 #ifdef WITH_MTS_ESP
 	MTS_DeregisterClient(mtsClient);
 #endif
-	while (_voices.size()) { delete _voices.back(); _voices.pop_back(); }
+	// First, as its thread may still be running the effects
+	delete mEffectsThread.load();
+	for (auto *board : mVoiceBoards) delete board;
+	delete mPatch;
+	delete mLFO;
+	delete [] mLFOBuffer;
 	delete limiter;
 	delete reverb;
+	delete fdnReverb;
 	delete distortion;
 	delete [] mBuffer;
+	delete [] mTaskBuffers;
+	delete [] mCoefficientCaches;
+	delete [] mPipelineBuffers;
+	delete [] mEffectsBuffer;
+	delete mThreadPool;
+	delete mPendingThreadPool.load();
+	delete mRetiredThreadPool.load();
 }
 
 void
 VoiceAllocationUnit::SetSampleRate	(int rate)
 {
+	waitForEffects();
 	limiter->SetSampleRate (rate);
-	for (unsigned i=0; i<_voices.size(); ++i) _voices[i]->SetSampleRate (rate);
+	mLFO->SetSampleRate (rate);
+	mSampleRate = rate;
+	for (auto *board : mVoiceBoards) if (board) board->SetSampleRate (rate);
     reverb->setrate(rate);
+	fdnReverb->SetSampleRate (rate);
+	// Silence must last a full pass through the reverb before its delay lines
+	// can be assumed to be empty
+	mIdleFrames = getReverbTailLength();
+	mSilentFrames = 0;
+	mIdle = false;
 }
 
 void
-VoiceAllocationUnit::HandleMidiNoteOn(int note, float velocity)
+VoiceAllocationUnit::SetMaxVoices(int voices)
+{
+	mMaxVoices = voices;
+	const int size = voices > 0 ? std::min(voices, (int) kMaxVoices) : kMaxVoices;
+
+	// Withdraw the last change if the audio thread has not taken it up, so
+	// that mTakenPoolChange is the last one it has taken or is taking up
+	if (!mPendingPoolChange.exchange(0))
+		mTakenPoolChange = mPublishedPoolChange;
+
+	// Once it has finished with that change it only uses the boards below its
+	// size, and cannot start on another until the next one is published here
+	if (mAdoptedPoolChange.load() == mTakenPoolChange) {
+		for (int i = std::max(size, (int) (mTakenPoolChange & 0xff)); i < kMaxVoices; i++) {
+			delete mVoiceBoards[i];
+			mVoiceBoards[i] = nullptr;
+		}
+	}
+
+	for (int i = 0; i < size; i++) {
+		if (!mVoiceBoards[i]) {
+			mVoiceBoards[i] = new VoiceBoard(*mPatch);
+			mVoiceBoards[i]->setRandomSeed(i);
+			mVoiceBoards[i]->SetSampleRate(mSampleRate);
+		}
+	}
+
+	mPublishedPoolChange = (++mPoolGeneration << 8) | (unsigned) size;
+	mPendingPoolChange.store(mPublishedPoolChange);
+}
+
+void
+VoiceAllocationUnit::setRenderThreads(int threads)
+{
+	threads = std::min(std::max(threads, 1), (int)ThreadPool::kMaxThreads);
+	if (threads == mRenderThreads)
+		return;
+	mRenderThreads = threads;
+
+	// The audio thread swaps in the new pool at the start of its next block and
+	// hands the old one back through mRetiredThreadPool to be deleted here, so
+	// threads are never started or joined on the audio thread.
+	delete mRetiredThreadPool.exchange(nullptr);
+	delete mPendingThreadPool.exchange(new ThreadPool(threads));
+}
+
+void
+VoiceAllocationUnit::setOscillatorEngine(Oscillator::Engine engine)
+{
+	// Build the shared tables here rather than on the audio thread
+	if (engine == Oscillator::Engine::kWavetable)
+		Wavetables::get();
+	mPatch->oscillatorEngine = engine;
+}
+
+void
+VoiceAllocationUnit::setEnvelopeShape(ADSR::Shape shape)
+{
+	mPatch->ampEnv.shape = shape;
+	mPatch->filterEnv.shape = shape;
+}
+
+ADSR::Shape
+VoiceAllocationUnit::getEnvelopeShape() const
+{
+	return mPatch->ampEnv.shape;
+}
+
+void
+VoiceAllocationUnit::setFilterEngine(SynthFilter::Engine engine)
+{
+	mPatch->setFilterEngine(engine);
+}
+
+SynthFilter::Engine
+VoiceAllocationUnit::getFilterEngine() const
+{
+	return mPatch->filterEngine;
+}
+
+void
+VoiceAllocationUnit::setFusedKernel(bool fused)
+{
+	mPatch->setFusedKernel(fused);
+}
+
+bool
+VoiceAllocationUnit::getFusedKernel() const
+{
+	return mPatch->fusedKernel;
+}
+
+void
+VoiceAllocationUnit::setSharedLFO(bool shared)
+{
+	mPatch->sharedLFO = shared ? mLFOBuffer : nullptr;
+}
+
+bool
+VoiceAllocationUnit::getSharedLFO() const
+{
+	return mPatch->sharedLFO != nullptr;
+}
+
+unsigned
+VoiceAllocationUnit::getReverbTailLength() const
+{
+	return (unsigned) (mReverbEngine == ReverbEngine::kFDN ? fdnReverb->getTailLength() : reverb->gettaillength());
+}
+
+void
+VoiceAllocationUnit::setVoiceRetireThreshold(float dBFS)
+{
+	mVoiceRetireThreshold = std::max(dBFS, (float) kVoiceRetireNever);
+	mPatch->retireThreshold = mVoiceRetireThreshold > kVoiceRetireNever ? powf(10.f, mVoiceRetireThreshold / 20.f) : 0.f;
+}
+
+Oscillator::Engine
+VoiceAllocationUnit::getOscillatorEngine() const
+{
+	return mPatch->oscillatorEngine;
+}
+
+void
+VoiceAllocationUnit::adoptPendingThreadPool()
+{
+	if (!mPendingThreadPool.load(std::memory_order_relaxed) || mRetiredThreadPool.load())
+		return;
+	ThreadPool *pool = mPendingThreadPool.exchange(nullptr);
+	if (pool) {
+		mRetiredThreadPool.store(mThreadPool);
+		mThreadPool = pool;
+	}
+}
+
+void
+VoiceAllocationUnit::adoptPendingPoolSize()
+{
+	if (!mPendingPoolChange.load(std::memory_order_relaxed))
+		return;
+	const unsigned change = mPendingPoolChange.exchange(0);
+	if (!change)
+		return;
+	const int size = (int) (change & 0xff);
+	// Voices dropped from the pool are silenced and taken off the free list
+	for (int i = size; i < mPoolSize; i++) {
+		if (mVoices[i].active) {
+			mVoices[i].board->reset();
+			retireVoice(i);
+		}
+		listRemove(mFreeHead, nullptr, i);
+		mVoices[i].board = nullptr;
+	}
+	for (int i = size - 1; i >= mPoolSize; i--) {
+		mVoices[i].board = mVoiceBoards[i];
+		listAppend(mFreeHead, nullptr, i);
+	}
+	mPoolSize = size;
+	mAdoptedPoolChange.store(change);
+}
+
+void
+VoiceAllocationUnit::adoptPendingReverbEngine()
+{
+	const ReverbEngine engine = mPendingReverbEngine.load(std::memory_order_relaxed);
+	if (engine == mReverbEngine)
+		return;
+	// The effects thread may still be running the old engine
+	waitForEffects();
+	// The new engine still holds whatever it was last given, so it starts silent
+	if (engine == ReverbEngine::kFDN)
+		fdnReverb->mute();
+	else
+		reverb->mute();
+	mReverbEngine = engine;
+	mIdleFrames = getReverbTailLength();
+}
+
+void
+VoiceAllocationUnit::HandleMidiNoteOn(int note, float velocity, int channel)
 {
 	assert (note >= 0);
 	assert (note < 128);
+	assert (channel >= 0);
+	assert (channel < 16);
 
 	// Checks if the note is within the note ranges activated in the current keyboard map.
 	// The above assertions guarantee the safety of this check.
-	if (!shouldPlayNote(note))
+	if (!shouldPlayNote(note, channel))
 		return;
 
-	float pitch = (float) noteToPitch(note);
+	adoptPendingPoolSize();
+
+	float pitch = (float) noteToPitch(note, channel);
 	if (pitch < 0) { // unmapped key
 		return;
 	}
 	
 	float portamentoTime = mPortamentoTime;
-	if (mPortamentoMode == PortamentoModeLegato) {
-		int count = 0;
-		for (int i=0; i<128; i++) {
-			if (keyPressed[i]) {
-				count++;
-			}
-		}
-		if (count == 0) {
-			portamentoTime = 0;
-		}
+	if (mPortamentoMode == PortamentoModeLegato && mNumKeysPressed == 0) {
+		portamentoTime = 0;
 	}
 	
-	keyPressed[note] = true;
+	if (!keyPressed[channel][note]) {
+		keyPressed[channel][note] = true;
+		mNumKeysPressed++;
+	}
 	
 	if (_keyboardMode == KeyboardModePoly) {
 
-		if (mMaxVoices) {
-			unsigned count = 0;
-			for (int i=0; i<128; i++)
-				count = count + (active[i] ? 1 : 0);
-			if (count >= (unsigned) mMaxVoices) {
-				int idx = -1;
-				// strategy 1) find the oldest voice in release phase
-				unsigned keyPress = _keyPressCounter + 1;
-				for (int i=0; i<128; i++) {
-					if (active[i] && !keyPressed[i]) {
-						if (keyPress > _keyPresses[i]) {
-							keyPress = _keyPresses[i];
-							idx = i;
-						}
-					}
-				}
-				if (idx < 0) {
-					// strategy 2) find the oldest voice
-					keyPress = _keyPressCounter + 1;
-					for (int i=0; i<128; i++) {
-						if (active[i]) {
-							if (keyPress > _keyPresses[i]) {
-								keyPress = _keyPresses[i];
-								idx = i;
-							}
-						}
-					}
-				}
-				assert(0 <= idx && idx < 128);
-				active[idx] = false;
-			}
+		// A note that is still sounding re-uses its voice
+		int index = mNoteVoices[channel][note];
+		if (index < 0) {
+			index = allocateVoice();
+			mVoices[index].channel = channel;
+			mVoices[index].note = note;
+			mNoteVoices[channel][note] = (short) index;
 		}
 
-		_keyPresses[note] = (++_keyPressCounter);
+		Voice &voice = mVoices[index];
+		voice.age = (++_keyPressCounter);
+		voice.keyPressed = true;
+		voice.sustained = false;
+		heapFix(voice.heapIndex);
 
 		if (mLastNoteFrequency > 0.0f) {
-			_voices[note]->setFrequency(mLastNoteFrequency, pitch, portamentoTime);
+			voice.board->setFrequency(mLastNoteFrequency, pitch, portamentoTime);
 		} else {
-			_voices[note]->setFrequency(pitch, pitch, 0);
+			voice.board->setFrequency(pitch, pitch, 0);
 		}
 
-		if (_voices[note]->isSilent())
-			_voices[note]->reset();
-		
-		_voices[note]->setVelocity(velocity);
-		_voices[note]->triggerOn(true);
+		if (voice.board->isSilent())
+			voice.board->reset();
 		
-		active[note] = true;
+		voice.board->setVelocity(velocity);
+		voice.board->triggerOn(true);
 	}
 	
 	if (_keyboardMode == KeyboardModeMono || _keyboardMode == KeyboardModeLegato) {
 
-		int previousNote = -1;
-		unsigned keyPress = 0;
-		for (int i = 0; i < 128; i++) {
-			if (keyPress < _keyPresses[i]) {
-				keyPress = _keyPresses[i];
-				previousNote = i;
-			}
-		}
-
-		_keyPresses[note] = (++_keyPressCounter);
+		const int key = channel * 128 + note;
+		const bool previousKey = mKeyTail >= 0;
+		if (mKeyListed[key])
+			keyListRemove(key);
+		keyListAppend(key);
 		
-		VoiceBoard *voice = _voices[0];
+		// Mono modes always play on the first voice so that portamento
+		// continues from its last frequency
+		bool wasActive = mVoices[0].active;
+		if (!wasActive)
+			activateVoice(0);
+		VoiceBoard *voice = mVoices[0].board;
 		
 		voice->setVelocity(velocity);
 		voice->setFrequency(voice->getFrequency(), pitch, portamentoTime);
 		
-		if (_keyboardMode == KeyboardModeMono || previousNote == -1)
-			voice->triggerOn(!active[0]);
-		
-		active[0] = true;
+		if (_keyboardMode == KeyboardModeMono || !previousKey)
+			voice->triggerOn(!wasActive);
 	}
 
 	mLastNoteFrequency = pitch;
 }
 
 void
-VoiceAllocationUnit::HandleMidiNoteOff(int note, float /*velocity*/)
+VoiceAllocationUnit::HandleMidiNoteOff(int note, float /*velocity*/, int channel)
 {
 	// No action is required if the note is outside the active range of notes.
-	if (!shouldPlayNote(note))
+	if (!shouldPlayNote(note, channel))
 		return;
 
-	keyPressed[note] = false;
-
-	if (sustain)
-		return;
+	if (keyPressed[channel][note]) {
+		keyPressed[channel][note] = false;
+		mNumKeysPressed--;
+	}
 
 	if (_keyboardMode == KeyboardModePoly) {
-		_voices[note]->triggerOff();
+		int index = mNoteVoices[channel][note];
+		if (index < 0)
+			return;
+		Voice &voice = mVoices[index];
+		voice.keyPressed = false;
+		heapFix(voice.heapIndex);
+		if (sustain)
+			voice.sustained = true;
+		else
+			voice.board->triggerOff();
+		return;
 	}
 
+	if (sustain)
+		return;
+
 	if (_keyboardMode == KeyboardModeMono || _keyboardMode == KeyboardModeLegato) {
-		int currentNote = -1;
-		unsigned keyPress = 0;
-		for (int i = 0; i < 128; i++) {
-			if (keyPress < _keyPresses[i]) {
-				keyPress = _keyPresses[i];
-				currentNote = i;
-			}
-		}
-		
-		_keyPresses[note] = 0;
-		
-		int nextNote = -1;
-		for (unsigned i = 0, tmp = 0; i < 128; i++) {
-			if (tmp < _keyPresses[i] && (keyPressed[i] || sustain)) {
-				tmp = _keyPresses[i];
-				nextNote = i;
-			}
-		}
-		
-		if (!keyPress) {
-			_keyPressCounter = 0;
-		}
-		
-		if (note != currentNote) {
+		// With the pedal up every other listed key is still held
+		const int key = channel * 128 + note;
+		if (!mKeyListed[key])
 			return;
-		}
-		
-		VoiceBoard *voice = _voices[0];
-		
-		if (0 <= nextNote) {
-			voice->setFrequency(voice->getFrequency(), (float) noteToPitch(nextNote), mPortamentoTime);
-			if (_keyboardMode == KeyboardModeMono)
-				voice->triggerOn(false);
-		} else {
-			voice->triggerOff();
-		}
+		const bool sounding = key == mKeyTail;
+		keyListRemove(key);
+		if (sounding)
+			playLastKey();
 	}
 }
 
+void
+VoiceAllocationUnit::playLastKey()
+{
+	VoiceBoard *voice = mVoices[0].board;
+	if (mKeyTail >= 0) {
+		voice->setFrequency(voice->getFrequency(), (float) noteToPitch(mKeyTail % 128, mKeyTail / 128), mPortamentoTime);
+		if (_keyboardMode == KeyboardModeMono)
+			voice->triggerOn(false);
+	} else {
+		voice->triggerOff();
+	}
+}
+
+void
+VoiceAllocationUnit::keyListRemove(int key)
+{
+	if (mKeyPrev[key] >= 0) mKeyNext[mKeyPrev[key]] = mKeyNext[key]; else mKeyHead = mKeyNext[key];
+	if (mKeyNext[key] >= 0) mKeyPrev[mKeyNext[key]] = mKeyPrev[key]; else mKeyTail = mKeyPrev[key];
+	mKeyListed[key] = false;
+}
+
+void
+VoiceAllocationUnit::keyListAppend(int key)
+{
+	mKeyPrev[key] = (short) mKeyTail;
+	mKeyNext[key] = -1;
+	if (mKeyTail >= 0) mKeyNext[mKeyTail] = (short) key; else mKeyHead = key;
+	mKeyTail = key;
+	mKeyListed[key] = true;
+}
+
 void
 VoiceAllocationUnit::HandleMidiPitchWheel(float value)
 {
@@ -274,7 +478,12 @@ void
 VoiceAllocationUnit::HandleMidiAllSoundOff()
 {
 	resetAllVoices();
+	waitForEffects();
+	memset(mPipelineBuffers, 0, 2 * kPipelineSlotSize * sizeof (float));
 	reverb->mute();
+	fdnReverb->mute();
+	limiter->reset();
+	distortion->reset();
 }
 
 void
@@ -289,53 +498,454 @@ VoiceAllocationUnit::HandleMidiSustainPedal(uchar value)
 	if ((sustain = (value > 0)))
 		return;
 
-	for (unsigned i = 0; i < _voices.size(); i++) {
-		if (!keyPressed[i] && _keyPresses[i] > 0) {
-			HandleMidiNoteOff(i, 0);
+	if (_keyboardMode == KeyboardModePoly) {
+		for (int i = mActiveHead; i >= 0; i = mVoices[i].next) {
+			if (mVoices[i].sustained) {
+				mVoices[i].sustained = false;
+				mVoices[i].board->triggerOff();
+			}
 		}
+		return;
 	}
+
+	// Drop the keys released under the pedal, and if the sounding key was one
+	// of them move to the most recent key still held
+	const int sounding = mKeyTail;
+	for (int key = mKeyHead; key >= 0; ) {
+		const int next = mKeyNext[key];
+		if (!keyPressed[key / 128][key % 128])
+			keyListRemove(key);
+		key = next;
+	}
+	if (sounding >= 0 && sounding != mKeyTail)
+		playLastKey();
 }
 
 void
 VoiceAllocationUnit::resetAllVoices()
 {
-	for (unsigned i=0; i<_voices.size(); i++) {
-		active[i] = false;
-		keyPressed[i] = false;
-		_keyPresses[i] = 0;
-		_voices[i]->reset();
+	mActiveHead = mActiveTail = -1;
+	mFreeHead = -1;
+	for (int i = mPoolSize - 1; i >= 0; i--) {
+		Voice &voice = mVoices[i];
+		voice.board->reset();
+		voice.channel = voice.note = -1;
+		voice.active = voice.keyPressed = voice.sustained = false;
+		voice.heapIndex = -1;
+		voice.prev = -1;
+		voice.next = mFreeHead;
+		if (mFreeHead >= 0)
+			mVoices[mFreeHead].prev = i;
+		mFreeHead = i;
 	}
+	mNumActiveVoices = 0;
+	mHeapSize = 0;
+	memset(mNoteVoices, -1, sizeof(mNoteVoices));
+
+	memset(keyPressed, 0, sizeof(keyPressed));
+	memset(mKeyListed, 0, sizeof(mKeyListed));
+	mKeyHead = mKeyTail = -1;
+	mNumKeysPressed = 0;
 	_keyPressCounter = 0;
 	sustain = false;
 }
 
+int
+VoiceAllocationUnit::allocateVoice()
+{
+	while (mNumActiveVoices >= mPoolSize) {
+		// steal the oldest voice in release phase, or failing that the oldest voice
+		int stolen = mHeap[0];
+		mVoices[stolen].board->reset();
+		retireVoice(stolen);
+	}
+	int index = mFreeHead;
+	assert(index >= 0);
+	activateVoice(index);
+	return index;
+}
+
+void
+VoiceAllocationUnit::activateVoice(int index)
+{
+	Voice &voice = mVoices[index];
+	assert(!voice.active);
+	listRemove(mFreeHead, nullptr, index);
+	listAppend(mActiveHead, &mActiveTail, index);
+	voice.active = true;
+	voice.age = _keyPressCounter;
+	voice.heapIndex = mHeapSize;
+	mHeap[mHeapSize++] = index;
+	heapFix(voice.heapIndex);
+	mNumActiveVoices++;
+}
+
+void
+VoiceAllocationUnit::retireVoice(int index)
+{
+	Voice &voice = mVoices[index];
+	assert(voice.active);
+	heapRemove(voice.heapIndex);
+	listRemove(mActiveHead, &mActiveTail, index);
+	listAppend(mFreeHead, nullptr, index);
+	if (voice.note >= 0 && mNoteVoices[voice.channel][voice.note] == index)
+		mNoteVoices[voice.channel][voice.note] = -1;
+	voice.channel = voice.note = -1;
+	voice.active = voice.keyPressed = voice.sustained = false;
+	mNumActiveVoices--;
+}
+
+bool
+VoiceAllocationUnit::heapLess(int a, int b) const
+{
+	const Voice &va = mVoices[mHeap[a]], &vb = mVoices[mHeap[b]];
+	if (va.keyPressed != vb.keyPressed)
+		return !va.keyPressed;
+	return va.age < vb.age;
+}
+
+void
+VoiceAllocationUnit::heapSwap(int i, int j)
+{
+	std::swap(mHeap[i], mHeap[j]);
+	mVoices[mHeap[i]].heapIndex = i;
+	mVoices[mHeap[j]].heapIndex = j;
+}
+
+void
+VoiceAllocationUnit::heapFix(int i)
+{
+	while (i > 0 && heapLess(i, (i - 1) / 2)) {
+		heapSwap(i, (i - 1) / 2);
+		i = (i - 1) / 2;
+	}
+	for (;;) {
+		int smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+		if (left < mHeapSize && heapLess(left, smallest)) smallest = left;
+		if (right < mHeapSize && heapLess(right, smallest)) smallest = right;
+		if (smallest == i) break;
+		heapSwap(i, smallest);
+		i = smallest;
+	}
+}
+
+void
+VoiceAllocationUnit::heapRemove(int i)
+{
+	mVoices[mHeap[i]].heapIndex = -1;
+	if (i != --mHeapSize) {
+		mHeap[i] = mHeap[mHeapSize];
+		mVoices[mHeap[i]].heapIndex = i;
+		heapFix(i);
+	}
+}
+
+// The free list is singly ended, so tail may be null
+
+void
+VoiceAllocationUnit::listRemove(int &head, int *tail, int index)
+{
+	Voice &voice = mVoices[index];
+	if (voice.prev >= 0) mVoices[voice.prev].next = voice.next; else head = voice.next;
+	if (voice.next >= 0) mVoices[voice.next].prev = voice.prev; else if (tail) *tail = voice.prev;
+	voice.prev = voice.next = -1;
+}
+
+void
+VoiceAllocationUnit::listAppend(int &head, int *tail, int index)
+{
+	Voice &voice = mVoices[index];
+	if (tail) {
+		voice.prev = *tail;
+		voice.next = -1;
+		if (*tail >= 0) mVoices[*tail].next = index; else head = index;
+		*tail = index;
+	} else {
+		voice.prev = -1;
+		voice.next = head;
+		if (head >= 0) mVoices[head].prev = index;
+		head = index;
+	}
+}
+
 void
 VoiceAllocationUnit::Process		(float *l, float *r, unsigned nframes, int stride)
 {
-	assert(nframes <= VoiceBoard::kMaxProcessBufferSize);
+	assert(nframes <= kMaxBlockSize);
+
+	if (mPipelinePosition == 0)
+		updatePipelineMode();
+
+	// The effects thread works on whole pipeline blocks; split calls that straddle two
+	if (mPipelined && mPipelinePosition + nframes > mPipelineBlockSize) {
+		const unsigned first = mPipelineBlockSize - mPipelinePosition;
+		Process (l, r, first, stride);
+		Process (l + first * stride, r + first * stride, nframes - first, stride);
+		return;
+	}
 
 	memset(mBuffer, 0, nframes * sizeof (float));
 
-	for (unsigned i=0; i<_voices.size(); i++) {
-		if (active[i]) {
-			if (_voices[i]->isSilent()) {
-				active[i] = false;
-			} else {
-				_voices[i]->SetPitchBend(mPitchBendValue);
-				_voices[i]->ProcessSamplesMix (mBuffer, nframes, mMasterVol);
+	adoptPendingPoolSize();
+	adoptPendingReverbEngine();
+
+	VoiceBoard *voices[kMaxVoices];
+	int numVoices = 0;
+	const unsigned blockSize = (unsigned) getBlockSize();
+
+	for (int i = mActiveHead; i >= 0; ) {
+		int next = mVoices[i].next;
+		VoiceBoard *board = mVoices[i].board;
+		if (board->isSilent()) {
+			retireVoice(i);
+		} else if (board->isInaudible()) {
+			unsigned blocks = (board->getFramesRemaining() + blockSize - 1) / blockSize;
+			mStatistics.voiceBlocksSaved.fetch_add(blocks, std::memory_order_relaxed);
+			board->reset();
+			retireVoice(i);
+		} else {
+			mVoices[i].board->SetPitchBend(mPitchBendValue);
+			voices[numVoices++] = mVoices[i].board;
+		}
+		i = next;
+	}
+
+	adoptPendingThreadPool();
+
+	if (mIdle) {
+		if (numVoices == 0) {
+			for (unsigned i=0; i<nframes; i++) {
+				l[i * stride] = 0;
+				r[i * stride] = 0;
+			}
+			return;
+		}
+		mIdle = false;
+	}
+
+	if (mPatch->sharedLFO) {
+		for (unsigned i=0; i<nframes; i+=VoiceBoard::kMaxProcessBufferSize)
+			mLFO->process (mLFOBuffer + i, (int) std::min(nframes - i, (unsigned) VoiceBoard::kMaxProcessBufferSize), *mPatch);
+	}
+
+	int numTasks = 1;
+	if (mThreadPool && mThreadPool->getNumThreads() > 1 && numVoices > kVoicesPerTask) {
+		numTasks = (numVoices + kVoicesPerTask - 1) / kVoicesPerTask;
+		mTaskVoices = voices;
+		mTaskNumVoices = numVoices;
+		mTaskNumFrames = (int) nframes;
+		mThreadPool->run (&VoiceAllocationUnit::renderTask, this, numTasks);
+		for (int task=0; task<numTasks; task++) {
+			const float *taskBuffer = mTaskBuffers + task * kMaxBlockSize;
+			for (unsigned i=0; i<nframes; i++) {
+				mBuffer[i] += taskBuffer[i];
 			}
 		}
+	} else if (mBatchRendering) {
+		VoiceBoard::ProcessSamplesMixBatch (voices, numVoices, mBuffer, nframes, mMasterVol, mCoefficientCaches);
+	} else {
+		for (int i=0; i<numVoices; i++) {
+			voices[i]->ProcessSamplesMix (mBuffer, nframes, mMasterVol, mCoefficientCaches);
+		}
+	}
+
+	uint32_t hits = 0, misses = 0;
+	for (int task=0; task<numTasks; task++) {
+		hits += mCoefficientCaches[task].hits;
+		misses += mCoefficientCaches[task].misses;
+		mCoefficientCaches[task].hits = mCoefficientCaches[task].misses = 0;
+	}
+	mStatistics.filterCoefficientHits.fetch_add(hits, std::memory_order_relaxed);
+	mStatistics.filterCoefficientMisses.fetch_add(misses, std::memory_order_relaxed);
+
+	if (mPipelined) {
+		processPipelined (l, r, nframes, stride, numVoices);
+		return;
+	}
+
+	processEffects (mBuffer, l, r, nframes, stride, mPanGainLeft, mPanGainRight);
+
+	updateIdleState (l, r, nframes, stride, numVoices);
+}
+
+void
+VoiceAllocationUnit::processEffects	(float *buffer, float *l, float *r, unsigned nframes, int stride, float panLeft, float panRight)
+{
+	limiter->SetLookahead (mLimiterLookahead.load(std::memory_order_relaxed));
+	distortion->SetOversampling (mDistortionOversampling.load(std::memory_order_relaxed));
+
+	distortion->Process (buffer, nframes);
+
+	// The effects work on planar blocks; interleaved output is rendered aside and copied
+	float *planarL = stride == 1 ? l : mEffectsBuffer;
+	float *planarR = stride == 1 ? r : mEffectsBuffer + kMaxBlockSize;
+
+	for (unsigned i=0; i<nframes; i++) {
+		planarL[i] = buffer[i] * panLeft;
+		planarR[i] = buffer[i] * panRight;
+	}
+
+	if (mReverbEngine == ReverbEngine::kFDN)
+		fdnReverb->processMix (buffer, panLeft + panRight, planarL, planarR, nframes);
+	else
+		reverb->processmix (planarL, planarR, planarL, planarR, nframes, 1);
+	limiter->Process (planarL, planarR, nframes);
+
+	if (stride != 1) {
+		for (unsigned i=0; i<nframes; i++) {
+			l[i * stride] = planarL[i];
+			r[i * stride] = planarR[i];
+		}
+	}
+}
+
+void
+VoiceAllocationUnit::processPipelined	(float *l, float *r, unsigned nframes, int stride, int numVoices)
+{
+	float *slot = mPipelineBuffers + mPipelineSlot * kPipelineSlotSize;
+	memcpy(slot + mPipelinePosition, mBuffer, nframes * sizeof (float));
+
+	// The other slot's effects have been running since this slot was started,
+	// alongside the voices rendered since
+	waitForEffects();
+
+	const float *wetL = mPipelineBuffers + (mPipelineSlot ^ 1) * kPipelineSlotSize + kMaxBlockSize;
+	const float *wetR = wetL + kMaxBlockSize;
+	for (unsigned i=0; i<nframes; i++) {
+		l[i * stride] = wetL[mPipelinePosition + i];
+		r[i * stride] = wetR[mPipelinePosition + i];
+	}
+
+	updateIdleState (l, r, nframes, stride, numVoices);
+
+	mPipelinePosition += nframes;
+	if (mPipelinePosition == mPipelineBlockSize) {
+		mEffectsSlot = mPipelineSlot;
+		mEffectsPanLeft = mPanGainLeft;
+		mEffectsPanRight = mPanGainRight;
+		mEffectsThread.load(std::memory_order_relaxed)->runAsync (&VoiceAllocationUnit::effectsTask, this, 1);
+		mEffectsRunning = true;
+		mPipelineSlot ^= 1;
+		mPipelinePosition = 0;
+	}
+}
+
+void
+VoiceAllocationUnit::effectsTask(void *context, int)
+{
+	VoiceAllocationUnit *vau = (VoiceAllocationUnit *) context;
+	float *slot = vau->mPipelineBuffers + vau->mEffectsSlot * kPipelineSlotSize;
+	float *wetL = slot + kMaxBlockSize, *wetR = wetL + kMaxBlockSize;
+	vau->processEffects (slot, wetL, wetR, vau->mPipelineBlockSize, 1, vau->mEffectsPanLeft, vau->mEffectsPanRight);
+}
+
+void
+VoiceAllocationUnit::waitForEffects()
+{
+	if (!mEffectsRunning)
+		return;
+	mEffectsThread.load(std::memory_order_relaxed)->wait();
+	mEffectsRunning = false;
+
+	for (int param = 0; mDeferredEffectParameters; param++) {
+		if (mDeferredEffectParameters & (1ull << param)) {
+			mDeferredEffectParameters &= ~(1ull << param);
+			setEffectParameter ((Param) param, mDeferredEffectValues[param]);
+		}
 	}
+}
+
+void
+VoiceAllocationUnit::updatePipelineMode()
+{
+	const bool pipelined = mPipelineRequested.load(std::memory_order_relaxed) &&
+						   mEffectsThread.load(std::memory_order_acquire);
+	const unsigned blockSize = (unsigned) getBlockSize();
+	if (pipelined == mPipelined && blockSize == mPipelineBlockSize)
+		return;
+	waitForEffects();
+	mPipelined = pipelined;
+	mPipelineBlockSize = blockSize;
+	mPipelineSlot = 0;
+	// The first block out of the pipeline is silence
+	memset(mPipelineBuffers, 0, 2 * kPipelineSlotSize * sizeof (float));
+}
+
+unsigned
+VoiceAllocationUnit::getLatency() const
+{
+	// Not the effects' getLatency(), which only change once the effects next run
+	const unsigned limiterLatency = getLimiterLookahead() ? SoftLimiter::kLookaheadFrames : 0;
+	const unsigned distortionLatency = getDistortionOversampling() ? Distortion::kOversamplingLatency : 0;
+	return (getPipelinedEffects() ? (unsigned) getBlockSize() : 0) + limiterLatency + distortionLatency;
+}
+
+void
+VoiceAllocationUnit::setBlockSize(int frames)
+{
+	mBlockSize.store(std::min(std::max(frames, (int) kMinBlockSize), (int) kMaxBlockSize));
+}
 
-	distortion->Process (mBuffer, nframes);
+void
+VoiceAllocationUnit::setPipelinedEffects(bool pipelined)
+{
+	// Started here rather than on the audio thread, and kept until destruction
+	if (pipelined && !mEffectsThread.load())
+		mEffectsThread.store(new ThreadPool(2));
+	mPipelineRequested.store(pipelined);
+}
+
+void
+VoiceAllocationUnit::updateIdleState	(const float *l, const float *r, unsigned nframes, int stride, int numVoices)
+{
+	if (numVoices > 0) {
+		mSilentFrames = 0;
+		return;
+	}
 
+	float peak = 0;
 	for (unsigned i=0; i<nframes; i++) {
-		l[i * stride] = mBuffer[i] * mPanGainLeft;
-		r[i * stride] = mBuffer[i] * mPanGainRight;
+		peak = std::max(peak, fabsf(l[i * stride]) + fabsf(r[i * stride]));
+	}
+
+	if (peak >= kIdleThreshold || limiter->getEnvelope() >= kIdleThreshold) {
+		mSilentFrames = 0;
+		return;
 	}
 
-	reverb->processmix (l, r, l, r, nframes, stride);
-	limiter->Process (l,r, nframes, stride);
+	mSilentFrames += nframes;
+	if (mSilentFrames >= mIdleFrames) {
+		// Clear what is left of the tail so that the next note starts from
+		// the same state as a freshly started synth
+		if (mReverbEngine == ReverbEngine::kFDN)
+			fdnReverb->mute();
+		else
+			reverb->mute();
+		limiter->reset();
+		distortion->reset();
+		mSilentFrames = 0;
+		mIdle = true;
+	}
+}
+
+void
+VoiceAllocationUnit::renderTask(void *context, int task)
+{
+	VoiceAllocationUnit *vau = (VoiceAllocationUnit *) context;
+	VoiceBoard **voices = vau->mTaskVoices + task * kVoicesPerTask;
+	int numVoices = std::min((int) kVoicesPerTask, vau->mTaskNumVoices - task * kVoicesPerTask);
+	float *buffer = vau->mTaskBuffers + task * kMaxBlockSize;
+	SynthFilter::CoefficientCache *cache = vau->mCoefficientCaches + task;
+
+	memset(buffer, 0, vau->mTaskNumFrames * sizeof (float));
+
+	if (vau->mBatchRendering) {
+		VoiceBoard::ProcessSamplesMixBatch (voices, numVoices, buffer, vau->mTaskNumFrames, vau->mMasterVol, cache);
+	} else {
+		for (int i=0; i<numVoices; i++) {
+			voices[i]->ProcessSamplesMix (buffer, vau->mTaskNumFrames, vau->mMasterVol, cache);
+		}
+	}
 }
 
 void
@@ -347,6 +957,22 @@ VoiceAllocationUnit::setKeyboardMode(KeyboardMode keyboardMode)
 	}
 }
 
+void
+VoiceAllocationUnit::setEffectParameter(Param param, float value)
+{
+	switch (param) {
+	case kAmsynthParameter_ReverbRoomsize:	reverb->setroomsize (value); fdnReverb->setRoomSize (value); break;
+	case kAmsynthParameter_ReverbDamp:		reverb->setdamp (value); fdnReverb->setDamp (value); break;
+	case kAmsynthParameter_ReverbWet:
+		reverb->setwet (value); reverb->setdry(1.0f-value);
+		fdnReverb->setWet (value); fdnReverb->setDry (1.0f-value);
+		break;
+	case kAmsynthParameter_ReverbWidth:		reverb->setwidth (value); fdnReverb->setWidth (value); break;
+	case kAmsynthParameter_AmpDistortion:	distortion->SetCrunch (value);	break;
+	default: break;
+	}
+}
+
 void
 VoiceAllocationUnit::parameterDidChange(const Parameter &parameter)
 {
@@ -354,11 +980,19 @@ VoiceAllocationUnit::parameterDidChange(const Parameter &parameter)
 	auto value = parameter.getControlValue();
 	switch (param) {
 	case kAmsynthParameter_MasterVolume:		mMasterVol = value;		break;
-	case kAmsynthParameter_ReverbRoomsize:	reverb->setroomsize (value);	break;
-	case kAmsynthParameter_ReverbDamp:		reverb->setdamp (value);	break;
-	case kAmsynthParameter_ReverbWet:		reverb->setwet (value); reverb->setdry(1.0f-value); break;
-	case kAmsynthParameter_ReverbWidth:		reverb->setwidth (value);	break;
-	case kAmsynthParameter_AmpDistortion:	distortion->SetCrunch (value);	break;
+	case kAmsynthParameter_ReverbRoomsize:
+	case kAmsynthParameter_ReverbDamp:
+	case kAmsynthParameter_ReverbWet:
+	case kAmsynthParameter_ReverbWidth:
+	case kAmsynthParameter_AmpDistortion:
+		if (mEffectsRunning) {
+			// Applied by waitForEffects() once the effects thread is done with them
+			mDeferredEffectValues[param] = value;
+			mDeferredEffectParameters |= 1ull << param;
+		} else {
+			setEffectParameter (param, value);
+		}
+		break;
 	case kAmsynthParameter_PortamentoTime: 	mPortamentoTime = value; break;
 	case kAmsynthParameter_KeyboardMode:	setKeyboardMode((KeyboardMode)(int)value); break;
 	case kAmsynthParameter_PortamentoMode:	mPortamentoMode = (int) value; break;
@@ -395,9 +1029,7 @@ VoiceAllocationUnit::parameterDidChange(const Parameter &parameter)
 	case kAmsynthParameter_FilterKeyTrackAmount:
 	case kAmsynthParameter_FilterKeyVelocityAmount:
 	case kAmsynthParameter_AmpVelocityAmount:
-		for (unsigned i=0; i<_voices.size(); i++) {
-			_voices[i]->UpdateParameter (param, value);
-		}
+		mPatch->UpdateParameter (param, value);
 		break;
 
 	case kAmsynthParameterCount:
@@ -410,26 +1042,30 @@ VoiceAllocationUnit::parameterDidChange(const Parameter &parameter)
 
 // Note: MTS-ESP wants us to supply a MIDI channel when querying retuning or
 // note filtering, in order to support multi-channel tuning tables which are
-// useful for microtonal MIDI controllers with more than 128 keys. We don't yet
-// support this because VoiceAllocationUnit uses the MIDI note number to index
-// _voices[], therefore notes playing on different channels could conflict.
+// useful for microtonal MIDI controllers with more than 128 keys. Voices are
+// allocated per (channel, note) so the same note on different channels does
+// not conflict.
 
 bool
-VoiceAllocationUnit::shouldPlayNote	(int note) const
+VoiceAllocationUnit::shouldPlayNote	(int note, int channel) const
 {
 #ifdef WITH_MTS_ESP
 	if (!mtsEspDisabled && tuningMap.isDefault())
-		return !MTS_ShouldFilterNote(mtsClient, note, 0);
+		return !MTS_ShouldFilterNote(mtsClient, note, channel);
+#else
+	(void) channel;
 #endif
 	return tuningMap.inActiveRange(note);
 }
 
 double
-VoiceAllocationUnit::noteToPitch	(int note) const
+VoiceAllocationUnit::noteToPitch	(int note, int channel) const
 {
 #ifdef WITH_MTS_ESP
 	if (!mtsEspDisabled && tuningMap.isDefault())
-		return MTS_NoteToFrequency(mtsClient, note, 0);
+		return MTS_NoteToFrequency(mtsClient, note, channel);
+#else
+	(void) channel;
 #endif
 	return tuningMap.noteToPitch(note);
 }
@@ -22,21 +22,29 @@
 #ifndef _VOICEALLOCATIONUNIT_H
 #define _VOICEALLOCATIONUNIT_H
 
+#include "ADSR.h"
+#include "LowPassFilter.h"
 #include "MidiController.h"
+#include "Oscillator.h"
 #include "TuningMap.h"
 
 #if HAVE_CONFIG_H
 #include "config.h"
 #endif
 
+#include <atomic>
 #include <stdint.h>
 #include <vector>
 
 
 class VoiceBoard;
+struct VoicePatch;
+class ModulationLFO;
 class SoftLimiter;
 class revmodel;
+class FDNReverb;
 class Distortion;
+class ThreadPool;
 
 
 class VoiceAllocationUnit : public Parameter::Observer, public MidiEventHandler
@@ -49,8 +57,8 @@ public:
 
 	void	SetSampleRate		(int);
 	
-	void	HandleMidiNoteOn(int note, float velocity) override;
-	void	HandleMidiNoteOff(int note, float velocity) override;
+	void	HandleMidiNoteOn(int note, float velocity, int channel) override;
+	void	HandleMidiNoteOff(int note, float velocity, int channel) override;
 	void	HandleMidiPitchWheel(float value) override;
 	void	HandleMidiPitchWheelSensitivity(uchar semitones) override;
 	void	HandleMidiAllSoundOff() override;
@@ -58,8 +66,98 @@ public:
 	void	HandleMidiSustainPedal(uchar value) override;
 	void	HandleMidiPan(float left, float right) override { mPanGainLeft = left; mPanGainRight = right; }
 
-	void	SetMaxVoices	(int voices) { mMaxVoices = voices; }
+	// Sizes the voice pool to voices, or to kMaxVoices if voices is 0
+	// (unlimited). Must not be called from the audio thread.
+	void	SetMaxVoices	(int voices);
 	int		GetMaxVoices	() { return mMaxVoices; }
+	int		getNumActiveVoices	() const { return mNumActiveVoices; }
+
+	// True once all voices have finished and the effects tails have decayed
+	// to silence; Process() then outputs zeros without running the effects
+	bool	isIdle				() const { return mIdle; }
+
+	// Number of threads used to render voices, 1 renders everything on the
+	// calling thread. Must not be called from the audio thread.
+	void	setRenderThreads	(int threads);
+	int		getRenderThreads	() { return mRenderThreads; }
+
+	// Selects how voice oscillators generate their waveforms. Must not be
+	// called from the audio thread.
+	void	setOscillatorEngine	(Oscillator::Engine engine);
+	Oscillator::Engine	getOscillatorEngine	() const;
+
+	void	setEnvelopeShape	(ADSR::Shape shape);
+	ADSR::Shape	getEnvelopeShape	() const;
+
+	void	setFilterEngine	(SynthFilter::Engine engine);
+	SynthFilter::Engine	getFilterEngine	() const;
+
+	// Renders each voice's osc mix, filter and amp in one pass (VoicePatch::fusedKernel)
+	void	setFusedKernel	(bool fused);
+	bool	getFusedKernel	() const;
+
+	// Whether all voices share one free-running LFO, rather than each running
+	// its own that restarts when the voice starts a note
+	void	setSharedLFO	(bool shared);
+	bool	getSharedLFO	() const;
+
+	// kFDN replaces freeverb with a cheaper feedback delay network, driven by
+	// the same reverb parameters. May be called from any thread; the audio
+	// thread switches engines at the start of its next block.
+	enum class ReverbEngine { kFreeverb, kFDN };
+	void	setReverbEngine	(ReverbEngine engine) { mPendingReverbEngine.store(engine); }
+	ReverbEngine	getReverbEngine	() const { return mPendingReverbEngine.load(std::memory_order_relaxed); }
+
+	// Runs the distortion, reverb and limiter on a helper thread, overlapped
+	// with rendering the next block of voices, at the cost of getLatency()
+	// frames of delay. Must not be called from the audio thread.
+	void	setPipelinedEffects	(bool pipelined);
+	bool	getPipelinedEffects	() const { return mPipelineRequested.load(std::memory_order_relaxed); }
+	// Delays the output so that the limiter can bring the gain down ahead of
+	// each peak rather than letting its start through
+	void	setLimiterLookahead	(bool lookahead) { mLimiterLookahead.store(lookahead); }
+	bool	getLimiterLookahead	() const { return mLimiterLookahead.load(std::memory_order_relaxed); }
+
+	// Applies the distortion at twice the sample rate, to reduce aliasing
+	void	setDistortionOversampling	(bool oversampling) { mDistortionOversampling.store(oversampling); }
+	bool	getDistortionOversampling	() const { return mDistortionOversampling.load(std::memory_order_relaxed); }
+
+	// Frames by which the output lags the input, for hosts to compensate
+	unsigned	getLatency		() const;
+
+	// The most frames rendered at a time. Larger blocks spread the fixed cost
+	// of each block (scanning the voices, waking the render threads, calling
+	// the effects) over more frames, but in pipelined mode the block size is
+	// also the added latency. Takes effect from the next block, and may be
+	// called from any thread; Process() accepts up to kMaxBlockSize regardless.
+	static constexpr int kMinBlockSize = 16;
+	static constexpr int kMaxBlockSize = 512;
+	static constexpr int kDefaultBlockSize = 64;
+	void	setBlockSize	(int frames);
+	int		getBlockSize	() const { return mBlockSize.load(std::memory_order_relaxed); }
+
+	// Released voices quieter than this (in dBFS, after the VCA) are retired
+	// early. kVoiceRetireNever, the default, keeps every voice until its
+	// envelope ends, since a long release can fade well below any threshold
+	// and still be heard through the reverb or at high monitoring levels.
+	static constexpr float kVoiceRetireNever = -200.f;
+	void	setVoiceRetireThreshold	(float dBFS);
+	float	getVoiceRetireThreshold	() const { return mVoiceRetireThreshold; }
+
+	/**
+	 * Counters updated by the audio thread, for profiling. They may be read
+	 * from any thread.
+	 */
+	struct Statistics
+	{
+		// Blocks, of getBlockSize() frames, that voices retired by the retire
+		// threshold would otherwise have rendered
+		std::atomic<uint64_t>	voiceBlocksSaved{0};
+		// Filter coefficient lookups answered by / added to the coefficient caches
+		std::atomic<uint64_t>	filterCoefficientHits{0};
+		std::atomic<uint64_t>	filterCoefficientMisses{0};
+	};
+	const Statistics &	getStatistics	() const { return mStatistics; }
 
 	float	getPitchBendRangeSemitones() {return mPitchBendRangeSemitones;}
 	void	setPitchBendRangeSemitones(float range) { mPitchBendRangeSemitones = range; }
@@ -67,8 +165,8 @@ public:
 
 	void	Process			(float *l, float *r, unsigned nframes, int stride=1);
 
-	bool	shouldPlayNote	(int note) const;
-	double	noteToPitch		(int note) const;
+	bool	shouldPlayNote	(int note, int channel) const;
+	double	noteToPitch		(int note, int channel) const;
 	int		loadScale		(const std::string & sclFileName);
 	int		loadKeyMap		(const std::string & kbmFileName);
 
@@ -76,24 +174,166 @@ public:
 
 	void	resetAllVoices();
 
+	static constexpr int kMaxVoices = 128;
+
+	/**
+	 * Voices are allocated from a pool of max_polyphony voices, at most
+	 * kMaxVoices, and are not tied to a note number.
+	 * Live voices are kept on an intrusive doubly linked list (the remaining
+	 * voices on a free list using the same links), and on a binary heap ordered
+	 * so that the best voice to steal - the oldest released voice, else the
+	 * oldest held voice - is at the top.
+	 */
+	struct Voice
+	{
+		VoiceBoard	*board = nullptr;
+		int			channel = -1;
+		int			note = -1;
+		unsigned	age = 0;
+		bool		active = false;
+		bool		keyPressed = false;
+		bool		sustained = false; // note off deferred by the sustain pedal
+		int			prev = -1;
+		int			next = -1;
+		int			heapIndex = -1;
+	};
+
+	int		allocateVoice	();
+	void	activateVoice	(int voice);
+	void	retireVoice		(int voice);
+	bool	heapLess		(int a, int b) const;
+	void	heapSwap		(int i, int j);
+	void	heapFix			(int i);
+	void	heapRemove		(int i);
+	void	listRemove		(int &head, int *tail, int voice);
+	void	listAppend		(int &head, int *tail, int voice);
+	void	keyListRemove	(int key);
+	void	keyListAppend	(int key);
+	void	playLastKey		();
+
+	void	adoptPendingThreadPool();
+	void	adoptPendingPoolSize();
+	void	adoptPendingReverbEngine();
+	void	updateIdleState	(const float *l, const float *r, unsigned nframes, int stride, int numVoices);
+	unsigned	getReverbTailLength	() const;
+	static void	renderTask(void *context, int task);
+
+	void	setEffectParameter	(Param param, float value);
+	void	processEffects	(float *buffer, float *l, float *r, unsigned nframes, int stride, float panLeft, float panRight);
+	void	processPipelined	(float *l, float *r, unsigned nframes, int stride, int numVoices);
+	void	updatePipelineMode	();
+	void	waitForEffects	();
+	static void	effectsTask(void *context, int task);
+
 	int		mMaxVoices;
 
+	VoicePatch	*mPatch;
+	Voice	mVoices[kMaxVoices];
+	int		mPoolSize = 0; // voices [0, mPoolSize) have a board
+	int		mActiveHead = -1;
+	int		mActiveTail = -1;
+	int		mFreeHead = -1;
+	int		mNumActiveVoices = 0;
+	int		mHeap[kMaxVoices];
+	int		mHeapSize = 0;
+	short	mNoteVoices[16][128]; // (channel, note) -> voice index or -1
+
+	// SetMaxVoices() creates and deletes the boards, and publishes each new
+	// pool size for the audio thread to take up at its next note or block.
+	// Changes are numbered (generation << 8 | size) so that SetMaxVoices()
+	// can tell when the audio thread has finished with the boards it dropped.
+	VoiceBoard	*mVoiceBoards[kMaxVoices] = {};
+	unsigned	mPoolGeneration = 0;
+	unsigned	mPublishedPoolChange = 0;
+	unsigned	mTakenPoolChange = 0;
+	std::atomic<unsigned>	mPendingPoolChange{0};
+	std::atomic<unsigned>	mAdoptedPoolChange{0};
+	int			mSampleRate = 44100;
+
+	// Render voices in SIMD batches (VoiceBoard::ProcessSamplesMixBatch) rather than one at a time
+	bool	mBatchRendering = true;
+
+	ModulationLFO	*mLFO;
+	float		*mLFOBuffer;
+
+	float		mVoiceRetireThreshold = kVoiceRetireNever;
+	Statistics	mStatistics;
+
 	float	mPortamentoTime;
 	int		mPortamentoMode;
-	bool	keyPressed[128], sustain;
-	bool	active[128];
+	bool	sustain;
 	
 	unsigned	_keyboardMode;
-	unsigned	_keyPresses[128];
 	unsigned	_keyPressCounter;
-	
-	std::vector<VoiceBoard*>	_voices;
+
+	// Key state for the mono and legato keyboard modes, which play the most
+	// recently pressed key on a single voice. Keys that are held, or were
+	// released while the sustain pedal is down, are kept on a list in press
+	// order, indexed by channel * 128 + note, so the sounding key is its tail.
+	bool		keyPressed[16][128];
+	bool		mKeyListed[16 * 128];
+	short		mKeyPrev[16 * 128];
+	short		mKeyNext[16 * 128];
+	int			mKeyHead = -1;
+	int			mKeyTail = -1;
+	int			mNumKeysPressed = 0;
 	
 	SoftLimiter	*limiter;
 	revmodel	*reverb;
+	FDNReverb	*fdnReverb;
+	ReverbEngine	mReverbEngine = ReverbEngine::kFreeverb; // the engine the audio thread runs
+	std::atomic<ReverbEngine>	mPendingReverbEngine{ReverbEngine::kFreeverb};
 	Distortion	*distortion;
 	
+	// Scratch buffers are allocated for kMaxBlockSize, so that changing the
+	// block size never reallocates under the audio thread
+	std::atomic<int>	mBlockSize{kDefaultBlockSize};
 	float	*mBuffer;
+	float	*mEffectsBuffer;	// planar left and right, for interleaved output
+	std::atomic<bool>	mLimiterLookahead{false};
+	std::atomic<bool>	mDistortionOversampling{false};
+
+	// Frames of silent output with no voices playing, and the number needed
+	// before the reverb is known to be empty
+	unsigned	mSilentFrames = 0;
+	unsigned	mIdleFrames = 0;
+	bool		mIdle = false;
+
+	// Voices are rendered in tasks of kVoicesPerTask, each into its own buffer,
+	// and the task buffers are summed in task order so that the output does
+	// not depend on the number of threads or on scheduling
+	static constexpr int kVoicesPerTask = 8;
+	int			mRenderThreads = 1;
+	ThreadPool	*mThreadPool = nullptr;
+	std::atomic<ThreadPool *>	mPendingThreadPool{nullptr};
+	std::atomic<ThreadPool *>	mRetiredThreadPool{nullptr};
+	float		*mTaskBuffers;
+	// One per task; the first is also used when rendering on the audio thread
+	SynthFilter::CoefficientCache	*mCoefficientCaches;
+	VoiceBoard	**mTaskVoices = nullptr;
+	int			mTaskNumVoices = 0;
+	int			mTaskNumFrames = 0;
+
+	// In pipelined mode the voices for one slot are rendered while the effects
+	// thread processes the other. Each slot holds the dry mono input followed
+	// by the wet left and right output, kMaxBlockSize frames apart, of which
+	// mPipelineBlockSize are used. The block size only changes between blocks.
+	static constexpr unsigned kPipelineSlotSize = 3 * kMaxBlockSize;
+	std::atomic<ThreadPool *>	mEffectsThread{nullptr};
+	std::atomic<bool>	mPipelineRequested{false};
+	bool		mPipelined = false;
+	bool		mEffectsRunning = false;
+	unsigned	mPipelinePosition = 0;
+	int			mPipelineSlot = 0;
+	float		*mPipelineBuffers;
+	// Read by the effects thread, written only while it is idle
+	unsigned	mPipelineBlockSize = kDefaultBlockSize;
+	int			mEffectsSlot = 0;
+	float		mEffectsPanLeft = 0;
+	float		mEffectsPanRight = 0;
+	// Effect parameter changes that arrive while the effects thread is running
+	float		mDeferredEffectValues[kAmsynthParameterCount];
+	uint64_t	mDeferredEffectParameters = 0;
 
 	float	mMasterVol;
 	float	mPanGainLeft;
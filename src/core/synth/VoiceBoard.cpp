@@ -21,8 +21,15 @@
 
 #include "VoiceBoard.h"
 
+#include <algorithm>
 #include <cassert>
 #include <cmath>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#ifdef _WIN32
+#include <malloc.h>
+#endif
 
 #define BLEND(x0, x1, m) (((x0) * (1.f - (m))) + ((x1) * (m)))
 
@@ -41,61 +48,125 @@ enum class LFOWaveform {
 	kSawtoothDown
 };
 
+// The one-sample-at-a-time form of the selected filter engine, for the fused kernels
+template <int N, SynthFilter::Engine engine>
+using VCFLanes = typename std::conditional<engine == SynthFilter::Engine::kSVF,
+	SynthFilter::SVFLanes<N>, SynthFilter::Lanes<N>>::type;
+
+void *
+VoicePatch::operator new	(size_t size)
+{
+	void *ptr = nullptr;
+#ifdef _WIN32
+	ptr = _aligned_malloc(size, alignof(VoicePatch));
+#else
+	if (posix_memalign(&ptr, alignof(VoicePatch), size) != 0)
+		ptr = nullptr;
+#endif
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void
+VoicePatch::operator delete	(void *ptr)
+{
+#ifdef _WIN32
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+VoicePatch::VoicePatch()
+{
+	updateRenderFunctions();
+}
+
+void
+VoicePatch::updateRenderFunctions()
+{
+#define RENDER_FUNCTIONS(mix, lanes, slope, filter, engine) { \
+		&VoiceBoard::mix<SynthFilter::Slope::slope, filter, SynthFilter::Engine::engine>, \
+		&VoiceBoard::lanes<8, SynthFilter::Slope::slope, filter, SynthFilter::Engine::engine>, \
+		&VoiceBoard::lanes<4, SynthFilter::Slope::slope, filter, SynthFilter::Engine::engine>, \
+		&VoiceBoard::lanes<2, SynthFilter::Slope::slope, filter, SynthFilter::Engine::engine> }
+
+#define ALL_RENDER_FUNCTIONS(mix, lanes) { \
+		RENDER_FUNCTIONS(mix, lanes, k12, false, kBiquad), \
+		RENDER_FUNCTIONS(mix, lanes, k12, true, kBiquad), \
+		RENDER_FUNCTIONS(mix, lanes, k24, true, kBiquad), \
+		RENDER_FUNCTIONS(mix, lanes, k12, true, kSVF), \
+		RENDER_FUNCTIONS(mix, lanes, k24, true, kSVF) }
+
+	static const RenderFunctions kStaged[5] = ALL_RENDER_FUNCTIONS(renderMix, processLanes);
+	static const RenderFunctions kFused[5] = ALL_RENDER_FUNCTIONS(renderMixFused, processLanesFused);
+
+#undef ALL_RENDER_FUNCTIONS
+#undef RENDER_FUNCTIONS
+
+	const RenderFunctions *functions = fusedKernel ? kFused : kStaged;
+	if (filterType == SynthFilter::Type::kBypass)
+		render = functions[0];
+	else
+		render = functions[(filterSlope == SynthFilter::Slope::k12 ? 1 : 2) + (filterEngine == SynthFilter::Engine::kSVF ? 2 : 0)];
+}
+
 void
-VoiceBoard::UpdateParameter	(Param param, float value)
+VoicePatch::UpdateParameter	(Param param, float value)
 {
 	switch (param)
 	{
-	case kAmsynthParameter_LFOToAmp:	mAmpModAmount = (value+1.0f)/2.0f;break;
-	case kAmsynthParameter_LFOFreq:		mLFO1Freq = value; 		break;
+	case kAmsynthParameter_LFOToAmp:	ampModAmount = (value+1.0f)/2.0f;break;
+	case kAmsynthParameter_LFOFreq:		lfoFreq = value; 		break;
 	case kAmsynthParameter_LFOWaveform: {
 		switch ((LFOWaveform)(int)value) {
-			case LFOWaveform::kSine:         mLFOPulseWidth = 0.0; lfo1.SetWaveform(Oscillator::Waveform::kSine);   break;
-			case LFOWaveform::kSquare:       mLFOPulseWidth = 0.0; lfo1.SetWaveform(Oscillator::Waveform::kPulse);  break;
-			case LFOWaveform::kTriangle:     mLFOPulseWidth = 0.0; lfo1.SetWaveform(Oscillator::Waveform::kSaw);    break;
-			case LFOWaveform::kNoise:        mLFOPulseWidth = 0.0; lfo1.SetWaveform(Oscillator::Waveform::kNoise);  break;
-			case LFOWaveform::kRandomize:    mLFOPulseWidth = 0.0; lfo1.SetWaveform(Oscillator::Waveform::kRandom); break;
-			case LFOWaveform::kSawtoothUp:   mLFOPulseWidth = 1.0; lfo1.SetWaveform(Oscillator::Waveform::kSaw);    lfo1.setPolarity(+1.0); break;
-			case LFOWaveform::kSawtoothDown: mLFOPulseWidth = 1.0; lfo1.SetWaveform(Oscillator::Waveform::kSaw);    lfo1.setPolarity(-1.0); break;
+			case LFOWaveform::kSine:         lfoPulseWidth = 0.0; lfoWaveform = Oscillator::Waveform::kSine;   break;
+			case LFOWaveform::kSquare:       lfoPulseWidth = 0.0; lfoWaveform = Oscillator::Waveform::kPulse;  break;
+			case LFOWaveform::kTriangle:     lfoPulseWidth = 0.0; lfoWaveform = Oscillator::Waveform::kSaw;    break;
+			case LFOWaveform::kNoise:        lfoPulseWidth = 0.0; lfoWaveform = Oscillator::Waveform::kNoise;  break;
+			case LFOWaveform::kRandomize:    lfoPulseWidth = 0.0; lfoWaveform = Oscillator::Waveform::kRandom; break;
+			case LFOWaveform::kSawtoothUp:   lfoPulseWidth = 1.0; lfoWaveform = Oscillator::Waveform::kSaw;    lfoPolarity = +1.0; break;
+			case LFOWaveform::kSawtoothDown: lfoPulseWidth = 1.0; lfoWaveform = Oscillator::Waveform::kSaw;    lfoPolarity = -1.0; break;
 			default: assert(nullptr == "invalid LFO waveform"); break;
 		}
 		break;
 	}
-	case kAmsynthParameter_LFOToOscillators:	mFreqModAmount=(value/2.0f)+0.5f;	break;
-    case kAmsynthParameter_LFOOscillatorSelect: mFreqModDestination = (int)roundf(value); break;
+	case kAmsynthParameter_LFOToOscillators:	freqModAmount=(value/2.0f)+0.5f;	break;
+    case kAmsynthParameter_LFOOscillatorSelect: freqModDestination = (int)roundf(value); break;
 	
-	case kAmsynthParameter_Oscillator1Waveform:	osc1.SetWaveform ((Oscillator::Waveform) (int)value);
+	case kAmsynthParameter_Oscillator1Waveform:	osc1Waveform = (Oscillator::Waveform) (int)value;
 				break;
-	case kAmsynthParameter_Oscillator1Pulsewidth:	mOsc1PulseWidth = value;	break;
-	case kAmsynthParameter_Oscillator2Waveform:	osc2.SetWaveform ((Oscillator::Waveform) (int)value);
+	case kAmsynthParameter_Oscillator1Pulsewidth:	osc1PulseWidth = value;	break;
+	case kAmsynthParameter_Oscillator2Waveform:	osc2Waveform = (Oscillator::Waveform) (int)value;
 				break;
-	case kAmsynthParameter_Oscillator2Pulsewidth:	mOsc2PulseWidth = value;	break;
-	case kAmsynthParameter_Oscillator2Octave:	mOsc2Octave = value;		break;
-	case kAmsynthParameter_Oscillator2Detune:	mOsc2Detune = value;		break;
-	case kAmsynthParameter_Oscillator2Pitch:	mOsc2Pitch = ::powf(2, value / 12); break;
-	case kAmsynthParameter_Oscillator2Sync:		mOsc2Sync  = roundf(value) != 0.f; break;
-
-	case kAmsynthParameter_LFOToFilterCutoff:	mFilterModAmt = (value+1.0f)/2.0f;break;
-	case kAmsynthParameter_FilterEnvAmount:	mFilterEnvAmt = value;		break;
-	case kAmsynthParameter_FilterCutoff:	mFilterCutoff = value;		break;
-	case kAmsynthParameter_FilterResonance:	mFilterRes = value;		break;
-	case kAmsynthParameter_FilterEnvAttack:	mFilterADSR.SetAttack (value);	break;
-	case kAmsynthParameter_FilterEnvDecay:	mFilterADSR.SetDecay (value);	break;
-	case kAmsynthParameter_FilterEnvSustain:	mFilterADSR.SetSustain (value);	break;
-	case kAmsynthParameter_FilterEnvRelease:	mFilterADSR.SetRelease (value);	break;
-	case kAmsynthParameter_FilterType: mFilterType = (SynthFilter::Type) (int)value; break;
-	case kAmsynthParameter_FilterSlope: mFilterSlope = (SynthFilter::Slope) (int)value; break;
-	case kAmsynthParameter_FilterKeyTrackAmount: mFilterKbdTrack = value; break;
-	case kAmsynthParameter_FilterKeyVelocityAmount: mFilterVelSens = value; break;
-
-	case kAmsynthParameter_OscillatorMixRingMod:	mRingModAmt = value;		break;
-	case kAmsynthParameter_OscillatorMix:			mOscMix = value;			break;
+	case kAmsynthParameter_Oscillator2Pulsewidth:	osc2PulseWidth = value;	break;
+	case kAmsynthParameter_Oscillator2Octave:	osc2Octave = value;		break;
+	case kAmsynthParameter_Oscillator2Detune:	osc2Detune = value;		break;
+	case kAmsynthParameter_Oscillator2Pitch:	osc2Pitch = ::powf(2, value / 12); break;
+	case kAmsynthParameter_Oscillator2Sync:		osc2Sync  = roundf(value) != 0.f; break;
+
+	case kAmsynthParameter_LFOToFilterCutoff:	filterModAmt = (value+1.0f)/2.0f;break;
+	case kAmsynthParameter_FilterEnvAmount:	filterEnvAmt = value;		break;
+	case kAmsynthParameter_FilterCutoff:	filterCutoff = value;		break;
+	case kAmsynthParameter_FilterResonance:	filterRes = value;		break;
+	case kAmsynthParameter_FilterEnvAttack:	filterEnv.attack = value;	break;
+	case kAmsynthParameter_FilterEnvDecay:	filterEnv.decay = value;	break;
+	case kAmsynthParameter_FilterEnvSustain:	filterEnv.sustain = value;	break;
+	case kAmsynthParameter_FilterEnvRelease:	filterEnv.release = value;	break;
+	case kAmsynthParameter_FilterType: filterType = (SynthFilter::Type) (int)value; updateRenderFunctions(); break;
+	case kAmsynthParameter_FilterSlope: filterSlope = (SynthFilter::Slope) (int)value; updateRenderFunctions(); break;
+	case kAmsynthParameter_FilterKeyTrackAmount: filterKbdTrack = value; break;
+	case kAmsynthParameter_FilterKeyVelocityAmount: filterVelSens = value; break;
+
+	case kAmsynthParameter_OscillatorMixRingMod:	ringModAmt = value;		break;
+	case kAmsynthParameter_OscillatorMix:			oscMix = value;			break;
 	
-	case kAmsynthParameter_AmpEnvAttack:			mAmpADSR.SetAttack(value);	break;
-	case kAmsynthParameter_AmpEnvDecay:				mAmpADSR.SetDecay(value);	break;
-	case kAmsynthParameter_AmpEnvSustain:			mAmpADSR.SetSustain(value);	break;
-	case kAmsynthParameter_AmpEnvRelease:			mAmpADSR.SetRelease(value);	break;
-	case kAmsynthParameter_AmpVelocityAmount: mAmpVelSens = value; break;
+	case kAmsynthParameter_AmpEnvAttack:			ampEnv.attack = value;	break;
+	case kAmsynthParameter_AmpEnvDecay:				ampEnv.decay = value;	break;
+	case kAmsynthParameter_AmpEnvSustain:			ampEnv.sustain = value;	break;
+	case kAmsynthParameter_AmpEnvRelease:			ampEnv.release = value;	break;
+	case kAmsynthParameter_AmpVelocityAmount: ampVelSens = value; break;
 		
 	case kAmsynthParameter_MasterVolume:
 	case kAmsynthParameter_ReverbRoomsize:
@@ -113,14 +184,71 @@ VoiceBoard::UpdateParameter	(Param param, float value)
 	}
 }
 
+void
+ModulationLFO::reset()
+{
+	mOsc.reset();
+	mValue = mTarget = mStep = 0;
+	mCountdown = 0;
+}
+
+void
+ModulationLFO::process(float *buffer, int numSamples, const VoicePatch &patch)
+{
+	assert(numSamples <= VoiceBoard::kMaxProcessBufferSize);
+
+	mOsc.setEngine(patch.oscillatorEngine);
+	mOsc.SetWaveform(patch.lfoWaveform);
+	mOsc.setPolarity(patch.lfoPolarity);
+
+	if (patch.lfoWaveform == Oscillator::Waveform::kNoise) {
+		mOsc.ProcessSamples(buffer, numSamples, patch.lfoFreq, patch.lfoPulseWidth);
+		mValue = mTarget = buffer[numSamples - 1];
+		mCountdown = 0;
+		return;
+	}
+
+	// Control points fall at mCountdown, mCountdown + kInterval, ...
+	float points[VoiceBoard::kMaxProcessBufferSize / kInterval + 1];
+	const int numPoints = mCountdown < numSamples ? (numSamples - 1 - mCountdown) / kInterval + 1 : 0;
+	if (numPoints > 0)
+		mOsc.ProcessSamples(points, numPoints, patch.lfoFreq, patch.lfoPulseWidth);
+
+	for (int i = 0, point = 0; i < numSamples; ) {
+		if (mCountdown == 0) {
+			mValue = mTarget;
+			mTarget = points[point++];
+			mStep = (mTarget - mValue) / kInterval;
+			mCountdown = kInterval;
+		}
+		const int count = std::min(mCountdown, numSamples - i);
+		for (int j = 0; j < count; j++) {
+			buffer[i++] = mValue;
+			mValue += mStep;
+		}
+		mCountdown -= count;
+	}
+}
+
+VoiceBoard::VoiceBoard(const VoicePatch &patch)
+:	mPatch(patch)
+,	mOscMix(patch.oscMix)
+,	mRingModAmt(patch.ringModAmt)
+,	mFilterADSR(patch.filterEnv)
+,	mAmpModAmount(patch.ampModAmount)
+,	mAmpVelSens(patch.ampVelSens)
+,	mAmpADSR(patch.ampEnv)
+{
+}
+
 void
 VoiceBoard::SetPitchBend	(float val)
 {	
 	mPitchBend = val;
 }
 
-void
-VoiceBoard::ProcessSamplesMix	(float *buffer, int numSamples, float vol)
+float
+VoiceBoard::prepareBlock	(int numSamples)
 {
 	assert(numSamples <= kMaxProcessBufferSize);
 
@@ -132,8 +260,15 @@ VoiceBoard::ProcessSamplesMix	(float *buffer, int numSamples, float vol)
 	//
 	// Control Signals
 	//
-	float *lfo1buf = mProcessBuffers.lfo_osc_1;
-	lfo1.ProcessSamples (lfo1buf, numSamples, mLFO1Freq, mLFOPulseWidth);
+	const VoicePatch &patch = mPatch;
+
+	if (patch.sharedLFO) {
+		mLFOBuffer = patch.sharedLFO + mSliceOffset;
+	} else {
+		lfo1.process (mProcessBuffers.lfo_osc_1, numSamples, patch);
+		mLFOBuffer = mProcessBuffers.lfo_osc_1;
+	}
+	const float *lfo1buf = mLFOBuffer;
 
 	const float frequency = mFrequency.nextValue();
 	for (int i=1; i<numSamples; i++) { mFrequency.nextValue(); }
@@ -141,28 +276,28 @@ VoiceBoard::ProcessSamplesMix	(float *buffer, int numSamples, float vol)
 	float baseFreq = mPitchBend * frequency;
 
 	float osc1freq = baseFreq;
-	if (mFreqModDestination == 0 || mFreqModDestination == 1) {
-		osc1freq = osc1freq * ( mFreqModAmount * (lfo1buf[0] + 1.0f) + 1.0f - mFreqModAmount );
+	if (patch.freqModDestination == 0 || patch.freqModDestination == 1) {
+		osc1freq = osc1freq * ( patch.freqModAmount * (lfo1buf[0] + 1.0f) + 1.0f - patch.freqModAmount );
 	}
-	float osc1pw = mOsc1PulseWidth;
+	float osc1pw = patch.osc1PulseWidth;
 
-	float osc2freq = baseFreq * mOsc2Detune * mOsc2Octave * mOsc2Pitch;
-	if (mFreqModDestination == 0 || mFreqModDestination == 2) {
-		osc2freq = osc2freq * ( mFreqModAmount * (lfo1buf[0] + 1.0f) + 1.0f - mFreqModAmount );
+	float osc2freq = baseFreq * patch.osc2Detune * patch.osc2Octave * patch.osc2Pitch;
+	if (patch.freqModDestination == 0 || patch.freqModDestination == 2) {
+		osc2freq = osc2freq * ( patch.freqModAmount * (lfo1buf[0] + 1.0f) + 1.0f - patch.freqModAmount );
 	}
-	float osc2pw = mOsc2PulseWidth;
-
-	mFilterADSR.process(mProcessBuffers.filter_env, numSamples);
-	float env_f = mProcessBuffers.filter_env[numSamples - 1];
-	float cutoff_base = BLEND(kKeyTrackBaseFreq, frequency, mFilterKbdTrack);
-	float cutoff_vel_mult = BLEND(1.f, mKeyVelocity, mFilterVelSens);
-	float cutoff_lfo_mult = (lfo1buf[0] * 0.5f + 0.5f) * mFilterModAmt + 1 - mFilterModAmt;
-	float cutoff = mFilterCutoff * cutoff_base * cutoff_vel_mult * cutoff_lfo_mult;
-	if (mFilterEnvAmt > 0.f) cutoff += (frequency * env_f * mFilterEnvAmt);
+	float osc2pw = patch.osc2PulseWidth;
+
+	// Only the last value is used, so the filter envelope is never rendered to a buffer
+	float env_f = mFilterADSR.advance(numSamples);
+	float cutoff_base = BLEND(kKeyTrackBaseFreq, frequency, patch.filterKbdTrack);
+	float cutoff_vel_mult = BLEND(1.f, mKeyVelocity, patch.filterVelSens);
+	float cutoff_lfo_mult = (lfo1buf[0] * 0.5f + 0.5f) * patch.filterModAmt + 1 - patch.filterModAmt;
+	float cutoff = patch.filterCutoff * cutoff_base * cutoff_vel_mult * cutoff_lfo_mult;
+	if (patch.filterEnvAmt > 0.f) cutoff += (frequency * env_f * patch.filterEnvAmt);
 	else
 	{
 		static const float r16 = 1.f/16.f; // scale if from -16 to -1
-		cutoff += cutoff * r16 * mFilterEnvAmt * env_f;
+		cutoff += cutoff * r16 * patch.filterEnvAmt * env_f;
 	}
 	
 
@@ -172,7 +307,12 @@ VoiceBoard::ProcessSamplesMix	(float *buffer, int numSamples, float vol)
 	float *osc1buf = mProcessBuffers.osc_1;
 	float *osc2buf = mProcessBuffers.osc_2;
 
-	bool osc2sync = mOsc2Sync;
+	osc1.setEngine(patch.oscillatorEngine);
+	osc2.setEngine(patch.oscillatorEngine);
+	osc1.SetWaveform(patch.osc1Waveform);
+	osc2.SetWaveform(patch.osc2Waveform);
+
+	bool osc2sync = patch.osc2Sync;
 	// previous implementation of sync had a bug causing it to only work when osc1 was set to sine or saw
 	// we need to recreate that behaviour here to ensure old presets still sound the same.
 	osc2sync &= (osc1.GetWaveform() == Oscillator::Waveform::kSine || osc1.GetWaveform() == Oscillator::Waveform::kSaw);
@@ -181,12 +321,48 @@ VoiceBoard::ProcessSamplesMix	(float *buffer, int numSamples, float vol)
 	osc1.ProcessSamples (osc1buf, numSamples, osc1freq, osc1pw);
 	osc2.ProcessSamples (osc2buf, numSamples, osc2freq, osc2pw, osc1freq);
 
+	//
+	// Amp envelope
+	//
+	// A sustained or finished envelope writes the same value every block, and
+	// may have already written it to enough of the buffer
+	if (mAmpADSR.isConstant() && numSamples <= mAmpEnvConstantFrames &&
+		mProcessBuffers.amp_env[0] == mAmpADSR.getValue()) {
+		return cutoff;
+	}
+	const bool constant = mAmpADSR.isConstant();
+	mAmpADSR.process(mProcessBuffers.amp_env, numSamples);
+	mAmpEnvConstantFrames = constant ? numSamples : 0;
+
+	return cutoff;
+}
+
+void
+VoiceBoard::ProcessSamplesMix	(float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *cache)
+{
+	for (int offset = 0; offset < numSamples; offset += kMaxProcessBufferSize) {
+		mSliceOffset = offset;
+		mPatch.render.mix(*this, buffer + offset, std::min(numSamples - offset, (int) kMaxProcessBufferSize), vol, cache);
+	}
+}
+
+template <SynthFilter::Slope slope, bool kFilter, SynthFilter::Engine engine>
+void
+VoiceBoard::renderMix	(VoiceBoard &voice, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *cache)
+{
+	const float cutoff = voice.prepareBlock(numSamples);
+
+	const VoicePatch &patch = voice.mPatch;
+	const float *lfo1buf = voice.mLFOBuffer;
+	float *osc1buf = voice.mProcessBuffers.osc_1;
+	float *osc2buf = voice.mProcessBuffers.osc_2;
+
 	//
 	// Osc Mix
 	//
 	for (int i=0; i<numSamples; i++) {
-		float ringMod = mRingModAmt.tick();
-		float oscMix = mOscMix.tick();
+		float ringMod = voice.mRingModAmt.processSample(patch.ringModAmt);
+		float oscMix = voice.mOscMix.processSample(patch.oscMix);
 		float osc1vol = (1.F - ringMod) * (1.F - oscMix) / 2.F;
 		float osc2vol = (1.F - ringMod) * (1.F + oscMix) / 2.F;
 		osc1buf[i] =
@@ -198,18 +374,337 @@ VoiceBoard::ProcessSamplesMix	(float *buffer, int numSamples, float vol)
 	//
 	// VCF
 	//
-	filter.ProcessSamples (osc1buf, numSamples, cutoff, mFilterRes, mFilterType, mFilterSlope);
-	
+	if (kFilter && engine == SynthFilter::Engine::kSVF) {
+		SynthFilter::SVFCoefficients coefficients;
+		if (voice.filter.computeSVFCoefficients(coefficients, cutoff, patch.filterRes, patch.filterType, cache))
+			voice.filter.processSVF<slope>(osc1buf, numSamples, coefficients);
+	} else if (kFilter) {
+		SynthFilter::Coefficients coefficients;
+		if (voice.filter.computeCoefficients(coefficients, cutoff, patch.filterRes, patch.filterType, cache))
+			voice.filter.process<slope>(osc1buf, numSamples, coefficients);
+	}
+
 	//
 	// VCA
 	// 
-	float *ampenvbuf = mProcessBuffers.amp_env;
-	mAmpADSR.process(ampenvbuf, numSamples);
+	float *ampenvbuf = voice.mProcessBuffers.amp_env;
+	float peak = 0;
+	for (int i=0; i<numSamples; i++) {
+		float ampModAmount = voice.mAmpModAmount.processSample(patch.ampModAmount);
+		float ampVelSens = voice.mAmpVelSens.processSample(patch.ampVelSens);
+		const float amplitude = ampenvbuf[i] * BLEND(1.f, voice.mKeyVelocity, ampVelSens) *
+			( ((lfo1buf[i] * 0.5f) + 0.5f) * ampModAmount + 1 - ampModAmount);
+		const float output = osc1buf[i] * voice._vcaFilter.processSample(amplitude * voice.mVolume.processSample(vol));
+		peak = std::max(peak, fabsf(output));
+		buffer[i] += output;
+	}
+	voice.updateAudibility(peak, numSamples);
+}
+
+template <int N, SynthFilter::Slope slope, bool kFilter, SynthFilter::Engine engine>
+void
+VoiceBoard::processLanes	(VoiceBoard *const *voices, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *cache)
+{
+	// Scratch buffers hold one voice per lane: sample i of voice n is at [i * N + n]
+	struct {
+		float osc_1[kMaxProcessBufferSize * N];
+		float osc_2[kMaxProcessBufferSize * N];
+		float lfo_osc_1[kMaxProcessBufferSize * N];
+		float amp_env[kMaxProcessBufferSize * N];
+		float output[kMaxProcessBufferSize * N];
+	} lanes;
+
+	// Voices rendered together belong to the same VoiceAllocationUnit and so share a patch
+	const VoicePatch &patch = voices[0]->mPatch;
+
+	float cutoff[N];
+	for (int n = 0; n < N; n++) {
+		assert(&voices[n]->mPatch == &patch);
+		cutoff[n] = voices[n]->prepareBlock(numSamples);
+	}
+
+	for (int n = 0; n < N; n++) {
+		const VoiceBoard *voice = voices[n];
+		for (int i = 0; i < numSamples; i++) {
+			lanes.osc_1[i * N + n] = voice->mProcessBuffers.osc_1[i];
+			lanes.osc_2[i * N + n] = voice->mProcessBuffers.osc_2[i];
+			lanes.lfo_osc_1[i * N + n] = voice->mLFOBuffer[i];
+			lanes.amp_env[i * N + n] = voice->mProcessBuffers.amp_env[i];
+		}
+	}
+
+	//
+	// Osc Mix
+	//
+	const float ringModRaw = patch.ringModAmt, oscMixRaw = patch.oscMix;
+	float ringModZ[N], oscMixZ[N];
+	for (int n = 0; n < N; n++) {
+		ringModZ[n] = voices[n]->mRingModAmt.get();
+		oscMixZ[n] = voices[n]->mOscMix.get();
+	}
+	for (int i = 0; i < numSamples; i++) {
+		float *osc1buf = lanes.osc_1 + i * N;
+		float *osc2buf = lanes.osc_2 + i * N;
+		for (int n = 0; n < N; n++) {
+			float ringMod = (ringModZ[n] += ((ringModRaw - ringModZ[n]) * 0.005F));
+			float oscMix = (oscMixZ[n] += ((oscMixRaw - oscMixZ[n]) * 0.005F));
+			float osc1vol = (1.F - ringMod) * (1.F - oscMix) / 2.F;
+			float osc2vol = (1.F - ringMod) * (1.F + oscMix) / 2.F;
+			osc1buf[n] =
+				osc1vol * osc1buf[n] +
+				osc2vol * osc2buf[n] +
+				ringMod * osc1buf[n] * osc2buf[n];
+		}
+	}
+	for (int n = 0; n < N; n++) {
+		voices[n]->mRingModAmt.set(ringModZ[n]);
+		voices[n]->mOscMix.set(oscMixZ[n]);
+	}
+
+	//
+	// VCF
+	//
+	if (kFilter && engine == SynthFilter::Engine::kSVF) {
+		SynthFilter *filters[N];
+		SynthFilter::SVFCoefficients coefficients[N];
+		bool bypass = false;
+		for (int n = 0; n < N; n++) {
+			VoiceBoard *voice = voices[n];
+			filters[n] = &voice->filter;
+			if (!voice->filter.computeSVFCoefficients(coefficients[n], cutoff[n], patch.filterRes, patch.filterType, cache))
+				bypass = true;
+		}
+		if (!bypass) {
+			SynthFilter::ProcessSVFLanes<N, slope>(lanes.osc_1, numSamples, filters, coefficients);
+		}
+	} else if (kFilter) {
+		SynthFilter *filters[N];
+		SynthFilter::Coefficients coefficients[N];
+		bool bypass = false;
+		for (int n = 0; n < N; n++) {
+			VoiceBoard *voice = voices[n];
+			filters[n] = &voice->filter;
+			if (!voice->filter.computeCoefficients(coefficients[n], cutoff[n], patch.filterRes, patch.filterType, cache))
+				bypass = true;
+		}
+		if (!bypass) {
+			SynthFilter::ProcessSamplesLanes<N, slope>(lanes.osc_1, numSamples, filters, coefficients);
+		}
+	}
+
+	//
+	// VCA
+	//
+	const float ampModRaw = patch.ampModAmount, ampVelSensRaw = patch.ampVelSens;
+	float ampModZ[N], ampVelSensZ[N], keyVelocity[N], volumeZ[N];
+	float vcaA0[N], vcaA1[N], vcaB1[N], vcaZ[N];
+	for (int n = 0; n < N; n++) {
+		VoiceBoard *voice = voices[n];
+		ampModZ[n] = voice->mAmpModAmount.get();
+		ampVelSensZ[n] = voice->mAmpVelSens.get();
+		keyVelocity[n] = voice->mKeyVelocity;
+		volumeZ[n] = voice->mVolume.get();
+		vcaA0[n] = voice->_vcaFilter._a0;
+		vcaA1[n] = voice->_vcaFilter._a1;
+		vcaB1[n] = voice->_vcaFilter._b1;
+		vcaZ[n] = voice->_vcaFilter._z;
+	}
+	for (int i = 0; i < numSamples; i++) {
+		const float *osc1buf = lanes.osc_1 + i * N;
+		const float *lfo1buf = lanes.lfo_osc_1 + i * N;
+		const float *ampenvbuf = lanes.amp_env + i * N;
+		float *output = lanes.output + i * N;
+		for (int n = 0; n < N; n++) {
+			float ampModAmount = (ampModZ[n] += ((ampModRaw - ampModZ[n]) * 0.005F));
+			float ampVelSens = (ampVelSensZ[n] += ((ampVelSensRaw - ampVelSensZ[n]) * 0.005F));
+			const float amplitude = ampenvbuf[n] * BLEND(1.f, keyVelocity[n], ampVelSens) *
+				( ((lfo1buf[n] * 0.5f) + 0.5f) * ampModAmount + 1 - ampModAmount);
+			const float x = amplitude * (volumeZ[n] += ((vol - volumeZ[n]) * 0.005F));
+			const float y = (x * vcaA0[n]) + vcaZ[n];
+			vcaZ[n] = (x * vcaA1[n]) + (y * vcaB1[n]);
+			output[n] = osc1buf[n] * y;
+		}
+	}
+	for (int n = 0; n < N; n++) {
+		VoiceBoard *voice = voices[n];
+		voice->mAmpModAmount.set(ampModZ[n]);
+		voice->mAmpVelSens.set(ampVelSensZ[n]);
+		voice->mVolume.set(volumeZ[n]);
+		voice->_vcaFilter._z = vcaZ[n];
+	}
+
+	// Voices are summed in order so that rounding matches ProcessSamplesMix()
+	float peak[N] = {};
+	for (int i = 0; i < numSamples; i++) {
+		for (int n = 0; n < N; n++) {
+			peak[n] = std::max(peak[n], fabsf(lanes.output[i * N + n]));
+			buffer[i] += lanes.output[i * N + n];
+		}
+	}
+	for (int n = 0; n < N; n++) {
+		voices[n]->updateAudibility(peak[n], numSamples);
+	}
+}
+
+template <SynthFilter::Slope slope, bool kFilter, SynthFilter::Engine engine>
+void
+VoiceBoard::renderMixFused	(VoiceBoard &voice, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *cache)
+{
+	const float cutoff = voice.prepareBlock(numSamples);
+
+	const VoicePatch &patch = voice.mPatch;
+	const float *lfo1buf = voice.mLFOBuffer;
+	const float *osc1buf = voice.mProcessBuffers.osc_1;
+	const float *osc2buf = voice.mProcessBuffers.osc_2;
+	const float *ampenvbuf = voice.mProcessBuffers.amp_env;
+
+	SynthFilter *filter = &voice.filter;
+	VCFLanes<1, engine> vcf = {};
+	const bool filtering = kFilter && vcf.load(&filter, &cutoff, patch.filterRes, patch.filterType, numSamples, cache);
+
+	// The same arithmetic as renderMix() in the same order, one sample at a time
+	float peak = 0;
 	for (int i=0; i<numSamples; i++) {
-		float ampModAmount = mAmpModAmount.tick();
-		const float amplitude = ampenvbuf[i] * BLEND(1.f, mKeyVelocity, mAmpVelSens.tick()) *
+		float ringMod = voice.mRingModAmt.processSample(patch.ringModAmt);
+		float oscMix = voice.mOscMix.processSample(patch.oscMix);
+		float osc1vol = (1.F - ringMod) * (1.F - oscMix) / 2.F;
+		float osc2vol = (1.F - ringMod) * (1.F + oscMix) / 2.F;
+		float x =
+			osc1vol * osc1buf[i] +
+			osc2vol * osc2buf[i] +
+			ringMod * osc1buf[i] * osc2buf[i];
+
+		if (kFilter && filtering)
+			x = vcf.template tick<slope>(0, x);
+
+		float ampModAmount = voice.mAmpModAmount.processSample(patch.ampModAmount);
+		float ampVelSens = voice.mAmpVelSens.processSample(patch.ampVelSens);
+		const float amplitude = ampenvbuf[i] * BLEND(1.f, voice.mKeyVelocity, ampVelSens) *
 			( ((lfo1buf[i] * 0.5f) + 0.5f) * ampModAmount + 1 - ampModAmount);
-		buffer[i] += osc1buf[i] * _vcaFilter.processSample(amplitude * mVolume.processSample(vol));
+		const float output = x * voice._vcaFilter.processSample(amplitude * voice.mVolume.processSample(vol));
+		peak = std::max(peak, fabsf(output));
+		buffer[i] += output;
+	}
+
+	if (kFilter && filtering)
+		vcf.store(&filter);
+
+	voice.updateAudibility(peak, numSamples);
+}
+
+template <int N, SynthFilter::Slope slope, bool kFilter, SynthFilter::Engine engine>
+void
+VoiceBoard::processLanesFused	(VoiceBoard *const *voices, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *cache)
+{
+	const VoicePatch &patch = voices[0]->mPatch;
+
+	float cutoff[N];
+	for (int n = 0; n < N; n++) {
+		assert(&voices[n]->mPatch == &patch);
+		cutoff[n] = voices[n]->prepareBlock(numSamples);
+	}
+
+	// Each lane reads its voice's oscillator and envelope buffers in place,
+	// so there is no interleaved copy to make
+	const float *osc1buf[N], *osc2buf[N], *lfo1buf[N], *ampenvbuf[N];
+	for (int n = 0; n < N; n++) {
+		osc1buf[n] = voices[n]->mProcessBuffers.osc_1;
+		osc2buf[n] = voices[n]->mProcessBuffers.osc_2;
+		lfo1buf[n] = voices[n]->mLFOBuffer;
+		ampenvbuf[n] = voices[n]->mProcessBuffers.amp_env;
+	}
+
+	SynthFilter *filters[N];
+	for (int n = 0; n < N; n++) {
+		filters[n] = &voices[n]->filter;
+	}
+	VCFLanes<N, engine> vcf = {};
+	const bool filtering = kFilter && vcf.load(filters, cutoff, patch.filterRes, patch.filterType, numSamples, cache);
+
+	const float ringModRaw = patch.ringModAmt, oscMixRaw = patch.oscMix;
+	const float ampModRaw = patch.ampModAmount, ampVelSensRaw = patch.ampVelSens;
+	float ringModZ[N], oscMixZ[N], ampModZ[N], ampVelSensZ[N], keyVelocity[N], volumeZ[N];
+	float vcaA0[N], vcaA1[N], vcaB1[N], vcaZ[N];
+	for (int n = 0; n < N; n++) {
+		VoiceBoard *voice = voices[n];
+		ringModZ[n] = voice->mRingModAmt.get();
+		oscMixZ[n] = voice->mOscMix.get();
+		ampModZ[n] = voice->mAmpModAmount.get();
+		ampVelSensZ[n] = voice->mAmpVelSens.get();
+		keyVelocity[n] = voice->mKeyVelocity;
+		volumeZ[n] = voice->mVolume.get();
+		vcaA0[n] = voice->_vcaFilter._a0;
+		vcaA1[n] = voice->_vcaFilter._a1;
+		vcaB1[n] = voice->_vcaFilter._b1;
+		vcaZ[n] = voice->_vcaFilter._z;
+	}
+
+	float peak[N] = {};
+	for (int i = 0; i < numSamples; i++) {
+		for (int n = 0; n < N; n++) {
+			float ringMod = (ringModZ[n] += ((ringModRaw - ringModZ[n]) * 0.005F));
+			float oscMix = (oscMixZ[n] += ((oscMixRaw - oscMixZ[n]) * 0.005F));
+			float osc1vol = (1.F - ringMod) * (1.F - oscMix) / 2.F;
+			float osc2vol = (1.F - ringMod) * (1.F + oscMix) / 2.F;
+			float x =
+				osc1vol * osc1buf[n][i] +
+				osc2vol * osc2buf[n][i] +
+				ringMod * osc1buf[n][i] * osc2buf[n][i];
+
+			if (kFilter && filtering)
+				x = vcf.template tick<slope>(n, x);
+
+			float ampModAmount = (ampModZ[n] += ((ampModRaw - ampModZ[n]) * 0.005F));
+			float ampVelSens = (ampVelSensZ[n] += ((ampVelSensRaw - ampVelSensZ[n]) * 0.005F));
+			const float amplitude = ampenvbuf[n][i] * BLEND(1.f, keyVelocity[n], ampVelSens) *
+				( ((lfo1buf[n][i] * 0.5f) + 0.5f) * ampModAmount + 1 - ampModAmount);
+			const float v = amplitude * (volumeZ[n] += ((vol - volumeZ[n]) * 0.005F));
+			const float y = (v * vcaA0[n]) + vcaZ[n];
+			vcaZ[n] = (v * vcaA1[n]) + (y * vcaB1[n]);
+
+			// Voices are summed in order so that rounding matches ProcessSamplesMix()
+			const float output = x * y;
+			peak[n] = std::max(peak[n], fabsf(output));
+			buffer[i] += output;
+		}
+	}
+
+	if (kFilter && filtering)
+		vcf.store(filters);
+
+	for (int n = 0; n < N; n++) {
+		VoiceBoard *voice = voices[n];
+		voice->mRingModAmt.set(ringModZ[n]);
+		voice->mOscMix.set(oscMixZ[n]);
+		voice->mAmpModAmount.set(ampModZ[n]);
+		voice->mAmpVelSens.set(ampVelSensZ[n]);
+		voice->mVolume.set(volumeZ[n]);
+		voice->_vcaFilter._z = vcaZ[n];
+		voice->updateAudibility(peak[n], numSamples);
+	}
+}
+
+void
+VoiceBoard::ProcessSamplesMixBatch	(VoiceBoard *const *voices, int numVoices, float *buffer, int numSamples, float vol,
+									 SynthFilter::CoefficientCache *cache)
+{
+	static_assert(kMaxBatchSize == 8, "processLanes<N> is instantiated for N = 8, 4, 2");
+
+	if (numVoices <= 0)
+		return;
+
+	const VoicePatch::RenderFunctions &render = voices[0]->mPatch.render;
+	for (int offset = 0; offset < numSamples; offset += kMaxProcessBufferSize) {
+		for (int i = 0; i < numVoices; i++)
+			voices[i]->mSliceOffset = offset;
+		VoiceBoard *const *v = voices;
+		int n = numVoices;
+		float *out = buffer + offset;
+		const int count = std::min(numSamples - offset, (int) kMaxProcessBufferSize);
+		while (n >= 8) { render.lanes8(v, out, count, vol, cache); v += 8; n -= 8; }
+		if    (n >= 4) { render.lanes4(v, out, count, vol, cache); v += 4; n -= 4; }
+		if    (n >= 2) { render.lanes2(v, out, count, vol, cache); v += 2; n -= 2; }
+		if    (n >= 1) { render.mix(*v[0], out, count, vol, cache); }
 	}
 }
 
@@ -224,6 +719,16 @@ VoiceBoard::SetSampleRate	(int rate)
 	mFilterADSR.SetSampleRate(rate);
 	mAmpADSR.SetSampleRate(rate);
 	_vcaFilter.setCoefficients(rate, kVCALowPassFreq, IIRFilterFirstOrder::Mode::kLowPass);
+	mInaudibleHoldFrames = (unsigned) (kInaudibleHoldTime * rate);
+}
+
+void
+VoiceBoard::setRandomSeed	(unsigned seed)
+{
+	// Spread the seeds so that neighbouring voices get unrelated noise
+	lfo1.setRandomSeed(22222 + (seed * 3 + 0) * 2654435761UL);
+	osc1.setRandomSeed(22222 + (seed * 3 + 1) * 2654435761UL);
+	osc2.setRandomSeed(22222 + (seed * 3 + 2) * 2654435761UL);
 }
 
 bool 
@@ -232,17 +737,40 @@ VoiceBoard::isSilent()
 	return mAmpADSR.getState() == 0 && _vcaFilter._z < 0.0000001;
 }
 
+void
+VoiceBoard::updateAudibility	(float peak, int numSamples)
+{
+	if (peak < mPatch.retireThreshold)
+		mInaudibleFrames += numSamples;
+	else
+		mInaudibleFrames = 0;
+}
+
+bool
+VoiceBoard::isInaudible()
+{
+	// A held note may still be in its attack, or get louder again as the filter opens
+	return mAmpADSR.isReleasing() && mInaudibleFrames >= mInaudibleHoldFrames;
+}
+
+unsigned
+VoiceBoard::getFramesRemaining()
+{
+	return mAmpADSR.isReleasing() ? mAmpADSR.getFramesLeftInState() : 0;
+}
+
 void 
 VoiceBoard::triggerOn(bool reset)
 {
 	if (reset) {
-		mOscMix.reset();
-		mRingModAmt.reset();
-		mAmpModAmount.reset();
-		mAmpVelSens.reset();
+		mOscMix.set(mPatch.oscMix);
+		mRingModAmt.set(mPatch.ringModAmt);
+		mAmpModAmount.set(mPatch.ampModAmount);
+		mAmpVelSens.set(mPatch.ampVelSens);
 	}
 	mAmpADSR.triggerOn();
 	mFilterADSR.triggerOn();
+	mInaudibleFrames = 0;
 }
 
 void 
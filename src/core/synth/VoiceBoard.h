@@ -28,6 +28,123 @@
 #include "LowPassFilter.h"
 #include "Synth--.h"
 
+#include <cstddef>
+
+class VoiceBoard;
+
+/**
+ * The patch settings used by every voice. VoiceAllocationUnit owns a single
+ * instance that all of its VoiceBoards reference, so a parameter change is
+ * one write regardless of the number of voices.
+ */
+struct alignas(64) VoicePatch
+{
+	VoicePatch();
+
+	void	UpdateParameter		(Param, float);
+
+	static void *	operator new	(size_t);
+	static void		operator delete	(void *);
+
+	Oscillator::Engine oscillatorEngine = Oscillator::Engine::kClassic;
+
+	// modulation section
+	float			lfoFreq = 0;
+	float			lfoPulseWidth = 0;
+	Oscillator::Waveform lfoWaveform = Oscillator::Waveform::kSine;
+	float			lfoPolarity = 1;
+	float			freqModAmount = 0;
+	int				freqModDestination = 0;
+
+	// oscillator section
+	Oscillator::Waveform osc1Waveform = Oscillator::Waveform::kSine;
+	Oscillator::Waveform osc2Waveform = Oscillator::Waveform::kSine;
+	float			osc1PulseWidth = 0;
+	float			osc2PulseWidth = 0;
+	float			oscMix = 0;
+	float			ringModAmt = 0;
+	float			osc2Octave = 1;
+	float			osc2Detune = 1;
+	float			osc2Pitch = 0;
+	bool			osc2Sync = false;
+
+	// filter section
+	float			filterEnvAmt = 0;
+	float			filterModAmt = 0;
+	float			filterCutoff = 16;
+	float			filterRes = 0;
+	float			filterKbdTrack = 0;
+	float			filterVelSens = 0;
+	SynthFilter::Engine filterEngine = SynthFilter::Engine::kBiquad;
+	SynthFilter::Type filterType = SynthFilter::Type::kLowPass;
+	SynthFilter::Slope filterSlope = SynthFilter::Slope::k24;
+	ADSR::Parameters filterEnv;
+
+	// amp section
+	float			ampModAmount = -1;
+	float			ampVelSens = 1;
+	ADSR::Parameters ampEnv;
+
+	// A released voice whose output stays below this level (linear, 0 = never)
+	// for VoiceBoard::kInaudibleHoldTime is retired before its envelope ends
+	float			retireThreshold = 0;
+
+	// When set, every voice reads this free-running LFO (owned by the
+	// VoiceAllocationUnit, covering the whole block) instead of running its own
+	const float		*sharedLFO = nullptr;
+
+	// Render the osc mix, VCF and VCA of each voice in a single pass over the
+	// block instead of one pass per stage. Both produce identical output. Off
+	// by default: the fused lanes read each voice with a stride and sum into
+	// the mix one sample at a time, which benchmarks slower than the staged,
+	// lane-vectorised kernels on x86-64, but it touches less memory per voice
+	// and may suit CPUs with small caches (the voice_kernel setting).
+	bool			fusedKernel = false;
+
+	void	setFusedKernel	(bool fused) { fusedKernel = fused; updateRenderFunctions(); }
+	void	setFilterEngine	(SynthFilter::Engine engine) { filterEngine = engine; updateRenderFunctions(); }
+
+	// VoiceBoard render paths specialised for the filter engine, type and slope above.
+	// Reselected by UpdateParameter() so that rendering does not test them.
+	struct RenderFunctions
+	{
+		void (*mix)		(VoiceBoard &, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *);
+		void (*lanes8)	(VoiceBoard *const *, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *);
+		void (*lanes4)	(VoiceBoard *const *, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *);
+		void (*lanes2)	(VoiceBoard *const *, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *);
+	};
+	RenderFunctions	render;
+
+private:
+
+	void	updateRenderFunctions	();
+};
+
+/**
+ * The modulation LFO. Its waveform is only evaluated once every kInterval
+ * samples and linearly interpolated in between, which is all that the
+ * per-sample amp modulation needs from a signal of at most 56 Hz. Noise has
+ * no meaningful control-rate equivalent and is still generated per sample.
+ */
+class ModulationLFO
+{
+public:
+	static constexpr int kInterval = 16;
+
+	void	SetSampleRate	(int rate) { mOsc.SetSampleRate(rate / kInterval); }
+	void	setRandomSeed	(unsigned long seed) { mOsc.setRandomSeed(seed); }
+	void	reset			();
+
+	void	process			(float *buffer, int numSamples, const VoicePatch &patch);
+
+private:
+	Oscillator	mOsc;
+	float		mValue = 0;
+	float		mTarget = 0;
+	float		mStep = 0;
+	int			mCountdown = 0; // samples until the next control point
+};
+
 /**
  * the VoiceBoard is what makes the nice noises... ;-)
  *
@@ -39,9 +156,23 @@ class VoiceBoard
 {
 public:
 
+	// Voices update their pitch, filter cutoff and envelopes once per slice of
+	// up to this many frames; longer blocks are rendered a slice at a time
 	static constexpr int kMaxProcessBufferSize = 64;
+	static constexpr int kMaxBatchSize = 8;
+	static constexpr float kInaudibleHoldTime = 0.05f; // seconds, longer than a 20 Hz cycle
+
+	explicit VoiceBoard(const VoicePatch &patch);
 
 	bool	isSilent		();
+
+	/**
+	 * True if the voice has been released and its output has stayed below
+	 * VoicePatch::retireThreshold long enough that it can be retired early.
+	 * getFramesRemaining() is how much longer it would otherwise have played.
+	 */
+	bool	isInaudible		();
+	unsigned	getFramesRemaining	();
 	void	triggerOn		(bool reset);
 	void	triggerOff		();
 	void	setVelocity		(float velocity);
@@ -52,14 +183,43 @@ public:
 	void	SetPitchBend	(float);
 	void	reset			();
 
-	void	UpdateParameter		(Param, float);
+	// cache, if given, must not be in use by another thread
+	void	ProcessSamplesMix	(float *buffer, int numSamples, float vol,
+								 SynthFilter::CoefficientCache *cache = nullptr);
 
-	void	ProcessSamplesMix	(float *buffer, int numSamples, float vol);
+	/**
+	 * Renders several voices in lockstep. Envelopes and oscillators run one voice
+	 * at a time, then the osc mix, VCF and VCA stages of up to kMaxBatchSize voices
+	 * are processed together with one voice per SIMD lane. The output is identical
+	 * to calling ProcessSamplesMix() on each voice in turn.
+	 */
+	static void	ProcessSamplesMixBatch	(VoiceBoard *const *voices, int numVoices, float *buffer, int numSamples, float vol,
+										 SynthFilter::CoefficientCache *cache = nullptr);
 
 	void	SetSampleRate		(int);
+	void	setRandomSeed		(unsigned);
 
 private:
 
+	friend struct VoicePatch;
+
+	float	prepareBlock		(int numSamples);
+	void	updateAudibility	(float peak, int numSamples);
+
+	template <SynthFilter::Slope slope, bool kFilter, SynthFilter::Engine engine>
+	static void	renderMix		(VoiceBoard &voice, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *cache);
+
+	template <int N, SynthFilter::Slope slope, bool kFilter, SynthFilter::Engine engine>
+	static void	processLanes	(VoiceBoard *const *voices, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *cache);
+
+	template <SynthFilter::Slope slope, bool kFilter, SynthFilter::Engine engine>
+	static void	renderMixFused	(VoiceBoard &voice, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *cache);
+
+	template <int N, SynthFilter::Slope slope, bool kFilter, SynthFilter::Engine engine>
+	static void	processLanesFused	(VoiceBoard *const *voices, float *buffer, int numSamples, float vol, SynthFilter::CoefficientCache *cache);
+
+	const VoicePatch &mPatch;
+
 	ParamSmoother	mVolume{0.f};
 
 	Lerper			mFrequency;
@@ -71,48 +231,35 @@ private:
 	float			mSampleRate = 44100;
 	float			mKeyVelocity = 1;
 	float			mPitchBend = 1;
+
+	unsigned		mInaudibleFrames = 0;
+	unsigned		mInaudibleHoldFrames = 2205;
 	
 	// modulation section
-	Oscillator 		lfo1;
-	float			mLFO1Freq = 0;
-	float			mLFOPulseWidth = 0;
+	ModulationLFO	lfo1;
+	const float		*mLFOBuffer = mProcessBuffers.lfo_osc_1; // this voice's or the shared LFO
+	int				mSliceOffset = 0; // where the slice being rendered starts in the block
 	
 	// oscillator section
 	Oscillator 		osc1, osc2;
-	float			mFreqModAmount = 0;
-	int				mFreqModDestination = 0;
-	float			mOsc1PulseWidth = 0;
-	float			mOsc2PulseWidth = 0;
-	SmoothedParam	mOscMix{0.f};
-	SmoothedParam	mRingModAmt{0.f};
-	float			mOsc2Octave = 1;
-	float			mOsc2Detune = 1;
-	float			mOsc2Pitch = 0;
-	bool			mOsc2Sync = false;
+	ParamSmoother	mOscMix;
+	ParamSmoother	mRingModAmt;
 	
 	// filter section
-	float			mFilterEnvAmt = 0;
-	float			mFilterModAmt = 0;
-	float			mFilterCutoff = 16;
-	float			mFilterRes = 0;
-	float			mFilterKbdTrack = 0;
-	float			mFilterVelSens = 0;
 	SynthFilter 	filter;
-	SynthFilter::Type mFilterType;
-	SynthFilter::Slope mFilterSlope;
 	ADSR 			mFilterADSR;
 	
 	// amp section
 	IIRFilterFirstOrder _vcaFilter;
-	SmoothedParam	mAmpModAmount{-1.f};
-	SmoothedParam	mAmpVelSens{1.f};
+	ParamSmoother	mAmpModAmount;
+	ParamSmoother	mAmpVelSens;
 	ADSR 			mAmpADSR;
+	int				mAmpEnvConstantFrames = 0; // leading samples of amp_env holding the constant mAmpADSR value
 
 	struct {
 		float osc_1[kMaxProcessBufferSize];
 		float osc_2[kMaxProcessBufferSize];
 		float lfo_osc_1[kMaxProcessBufferSize];
-		float filter_env[kMaxProcessBufferSize];
 		float amp_env[kMaxProcessBufferSize];
 	} mProcessBuffers;
 };
@@ -0,0 +1,84 @@
+/*
+ *  Wavetables.cpp
+ *
+ *  Copyright (c) 2026 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include "Wavetables.h"
+
+#include <cmath>
+#include <vector>
+
+static const double kPi = 3.14159265358979323846;
+
+const Wavetables &
+Wavetables::get()
+{
+	static const Wavetables tables;
+	return tables;
+}
+
+int
+Wavetables::levelForIncrement(float increment)
+{
+	int level = 0;
+	float limit = 1.f / kSize;
+	while (level < kLevels - 1 && increment > limit) {
+		limit *= 2.f;
+		level++;
+	}
+	return level;
+}
+
+Wavetables::Wavetables()
+{
+	// Harmonic k of sample n is sin(2 pi k n / kSize), which is an exact
+	// entry of the level 0 sine table, so the additive sums below need no
+	// further trig calls
+	std::vector<double> sine(kSize);
+	for (int n = 0; n < kSize; n++)
+		sine[n] = sin(2.0 * kPi * n / kSize);
+
+	for (int n = 0; n < kSize; n++)
+		mSine[n] = (float) sine[n];
+	mSine[kSize] = mSine[0];
+
+	// Build from the top level (fundamental only) down, adding the harmonics
+	// that each lower level has room for
+	std::vector<double> saw(kSize, 0.0), parabola(kSize, 0.0);
+	int harmonics = 0;
+	for (int level = kLevels - 1; level >= 0; level--) {
+		const int levelHarmonics = (kSize / 2) >> level;
+		for (int k = harmonics + 1; k <= levelHarmonics; k++) {
+			const double sawAmp = -2.0 / (kPi * k);
+			const double parabolaAmp = 1.0 / (kPi * kPi * k * k);
+			for (int n = 0; n < kSize; n++) {
+				saw[n] += sawAmp * sine[(k * n) & (kSize - 1)];
+				parabola[n] += parabolaAmp * sine[(k * n + kSize / 4) & (kSize - 1)];
+			}
+		}
+		harmonics = levelHarmonics;
+
+		for (int n = 0; n < kSize; n++) {
+			mSaw[level][n] = (float) saw[n];
+			mParabola[level][n] = (float) parabola[n];
+		}
+		mSaw[level][kSize] = mSaw[level][0];
+		mParabola[level][kSize] = mParabola[level][0];
+	}
+}
@@ -0,0 +1,78 @@
+/*
+ *  Wavetables.h
+ *
+ *  Copyright (c) 2026 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef _WAVETABLES_H
+#define _WAVETABLES_H
+
+/**
+ * Band-limited single-cycle waveforms used by the wavetable oscillator engine.
+ *
+ * Each table holds one cycle in kSize points plus a guard point so that linear
+ * interpolation never has to wrap. Saw and parabola tables are mipmapped per
+ * octave: level n contains the harmonics that stay below Nyquist for phase
+ * increments up to 2^n / kSize cycles per sample. Tables are normalised to
+ * the phase so the same set serves every sample rate.
+ *
+ * There is one read-only instance per process, shared by all oscillators.
+ */
+class Wavetables
+{
+public:
+
+	static constexpr int kSize = 2048;
+	static constexpr int kLevels = 11;
+
+	/**
+	 * Returns the shared tables, building them on first use. Call this from a
+	 * non-realtime thread before the tables are needed on the audio thread.
+	 */
+	static const Wavetables & get();
+
+	/** Selects the mipmap level for a phase increment in cycles per sample. */
+	static int	levelForIncrement	(float increment);
+
+	const float *	sine		() const { return mSine; }
+	/** Rising saw, 2t - 1 */
+	const float *	saw			(int level) const { return mSaw[level]; }
+	/** Periodic parabola t^2 - t + 1/6, the zero-mean integral of saw() / 2 */
+	const float *	parabola	(int level) const { return mParabola[level]; }
+
+private:
+
+	Wavetables();
+
+	float	mSine[kSize + 1];
+	float	mSaw[kLevels][kSize + 1];
+	float	mParabola[kLevels][kSize + 1];
+};
+
+/**
+ * Linearly interpolated read at a position in [0, kSize]
+ */
+static inline float wavetableLookup(const float *table, float position)
+{
+	int index = (int) position;
+	float frac = position - (float) index;
+	index &= Wavetables::kSize - 1;
+	return table[index] + frac * (table[index + 1] - table[index]);
+}
+
+#endif
@@ -64,7 +64,6 @@ public:
 
 		_midiBuffer.resize(MIDI_BUFFER_SIZE);
 		_midiBufferPtr = _midiBuffer.data();
-		_midiEvents.reserve(MIDI_BUFFER_SIZE / 3);
 
 		return noErr;
 	}
@@ -89,6 +88,11 @@ public:
 		return status;
 	}
 
+	Float64 GetLatency() override
+	{
+		return _synth.getLatency() / GetOutput(0)->GetStreamFormat().mSampleRate;
+	}
+
 	// MARK: AU properties
 
 	OSStatus GetPropertyInfo(AudioUnitPropertyID inID, AudioUnitScope inScope, AudioUnitElement inElement,
@@ -164,6 +168,7 @@ public:
 
 	void ApplyPropertiesDictionary(CFDictionaryRef props)
 	{
+		const unsigned latency = _synth.getLatency();
 		CFIndex count = CFDictionaryGetCount(props);
 		std::vector<CFStringRef> keys(count);
 		std::vector<CFStringRef> values(count);
@@ -181,6 +186,9 @@ public:
 				CFRelease(name);
 			}
 		}
+		if (_synth.getLatency() != latency) {
+			PropertyChanged(kAudioUnitProperty_Latency, kAudioUnitScope_Global, 0);
+		}
 	}
 
 	// MARK: AU Parameters
@@ -303,8 +311,8 @@ public:
 			outputBufferList.mBuffers[1].mNumberChannels != 1)
 			return kAudioUnitErr_FormatNotSupported;
 
-		std::vector<amsynth_midi_cc_t> midiOut;
-		_synth.process(inNumberFrames, _midiEvents, midiOut, (float *)outputBufferList.mBuffers[0].mData, (float *)outputBufferList.mBuffers[1].mData);
+		_midiOut.clear();
+		_synth.process(inNumberFrames, _midiEvents.data(), _midiEvents.size(), _midiOut, (float *)outputBufferList.mBuffers[0].mData, (float *)outputBufferList.mBuffers[1].mData);
 		_midiBufferPtr = _midiBuffer.data();
 		_midiEvents.clear();
 
@@ -315,7 +323,8 @@ public:
 	{
 		if (_midiBufferPtr + 3 > _midiBuffer.data() + _midiBuffer.size())
 			return kAudioUnitErr_TooManyFramesToProcess;
-		_midiEvents.push_back((amsynth_midi_event_t) {inOffsetSampleFrame, 3, _midiBufferPtr});
+		if (!_midiEvents.push_back((amsynth_midi_event_t) {inOffsetSampleFrame, 3, _midiBufferPtr}))
+			return kAudioUnitErr_TooManyFramesToProcess;
 		_midiBufferPtr[0] = inStatus;
 		_midiBufferPtr[1] = inData1;
 		_midiBufferPtr[2] = inData2;
@@ -327,7 +336,8 @@ private:
 	Synthesizer _synth;
 	unsigned char *_midiBufferPtr;
 	std::vector<uint8_t> _midiBuffer;
-	std::vector<amsynth_midi_event_t> _midiEvents;
+	MidiEventBuffer _midiEvents;
+	MidiOutputBuffer _midiOut;
 };
 
 AUDIOCOMPONENT_ENTRY(AUMusicDeviceFactory, AmsynthAU)
@@ -55,6 +55,8 @@ struct amsynth_wrapper {
 	LADSPA_Data *out_l;
 	LADSPA_Data *out_r;
 	LADSPA_Data **params;
+	MidiEventBuffer midi_events;
+	MidiOutputBuffer midi_out;
 };
 
 
@@ -188,10 +190,10 @@ static void run_synth (LADSPA_Handle instance, unsigned long sample_count, snd_s
 	midi_buffer_ptr[0] = __status__; \
 	midi_buffer_ptr[1] = __byte1__; \
 	midi_buffer_ptr[2] = __byte2__; \
-	midi_events.push_back((amsynth_midi_event_t){ e->time.tick, 3, midi_buffer_ptr }); \
+	a->midi_events.push_back((amsynth_midi_event_t){ e->time.tick, 3, midi_buffer_ptr }); \
 	midi_buffer_ptr += 3; } while (0)
 
-	std::vector<amsynth_midi_event_t> midi_events;
+	a->midi_events.clear();
 	for (snd_seq_event_t *e = events; e < events + event_count; e++) {
 		switch (e->type) {
 		case SND_SEQ_EVENT_NOTEON:
@@ -227,8 +229,8 @@ static void run_synth (LADSPA_Handle instance, unsigned long sample_count, snd_s
 		}
 	}
 
-	std::vector<amsynth_midi_cc_t> midi_out;
-	a->synth->process(sample_count, midi_events, midi_out, a->out_l, a->out_r);
+	a->midi_out.clear();
+	a->synth->process(sample_count, a->midi_events.data(), a->midi_events.size(), a->midi_out, a->out_l, a->out_r);
 }
 
 // renoise ignores DSSI plugins that don't implement run
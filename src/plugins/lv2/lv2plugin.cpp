@@ -34,6 +34,8 @@
 #define LOG_FUNCTION_CALL()
 #endif
 
+static_assert(PORT_LATENCY == PORT_FIRST_PARAMETER + kAmsynthParameterCount, "latency port follows the parameters");
+
 struct amsynth_wrapper {
 	amsynth_wrapper() : schedule(nullptr), control_port(nullptr), out_l(nullptr), out_r(nullptr) {}
 
@@ -58,6 +60,10 @@ struct amsynth_wrapper {
 	float *out_l;
 	float *out_r;
 	float *param_ports[kAmsynthParameterCount];
+	float *latency_port {nullptr};
+
+	MidiEventBuffer midi_events;
+	MidiOutputBuffer midi_out;
 
 	std::map<LV2_URID, std::string> patch_values;
 
@@ -133,6 +139,9 @@ lv2_connect_port(LV2_Handle instance, uint32_t port, void *data_location)
 		case PORT_AUDIO_R:
 			a->out_r = (float *) data_location;
 			break;
+		case PORT_LATENCY:
+			a->latency_port = (float *) data_location;
+			break;
 		default:
 			if (PORT_FIRST_PARAMETER <= port && (port - PORT_FIRST_PARAMETER) < kAmsynthParameterCount) {
 				a->param_ports[port - PORT_FIRST_PARAMETER] = (float *) data_location;
@@ -167,14 +176,14 @@ lv2_run(LV2_Handle instance, uint32_t sample_count)
     LV2_Atom_Forge_Frame notify_frame;
     lv2_atom_forge_sequence_head(forge, &notify_frame, 0);
 
-    std::vector<amsynth_midi_event_t> midi_events;
+	a->midi_events.clear();
 	LV2_ATOM_SEQUENCE_FOREACH(a->control_port, ev) {
 		if (ev->body.type == a->uris.midiEvent) {
 			amsynth_midi_event_t midi_event {};
 			midi_event.offset_frames = static_cast<unsigned>(ev->time.frames);
 			midi_event.buffer = (uint8_t *)(ev + 1);
 			midi_event.length = ev->body.size;
-			midi_events.push_back(midi_event);
+			a->midi_events.push_back(midi_event);
 		}
 		if (lv2_atom_forge_is_object_type(forge, ev->body.type)) {
 			const auto *obj = (const LV2_Atom_Object *)&ev->body;
@@ -213,8 +222,12 @@ lv2_run(LV2_Handle instance, uint32_t sample_count)
 		}
 	}
 
-	std::vector<amsynth_midi_cc_t> midi_out;
-	a->synth.process(sample_count, midi_events, midi_out, a->out_l, a->out_r);
+	if (a->latency_port) {
+		*a->latency_port = (float) a->synth.getLatency();
+	}
+
+	a->midi_out.clear();
+	a->synth.process(sample_count, a->midi_events.data(), a->midi_events.size(), a->midi_out, a->out_l, a->out_r);
 }
 
 static LV2_State_Status
@@ -34,15 +34,28 @@
 #define AMSYNTH_LV2UI_URI           "http://code.google.com/p/amsynth/amsynth/ui"
 
 #define FOR_EACH_PROPERTY(X) \
+	X(block_size) \
+	X(controller_ramps) \
+	X(distortion_oversampling) \
+	X(envelope_shape) \
+	X(filter_engine) \
+	X(lfo_mode) \
+	X(limiter_lookahead) \
 	X(max_polyphony) \
 	X(midi_channel) \
+	X(oscillator_engine) \
+	X(pipelined_effects) \
 	X(pitch_bend_range) \
 	X(preset_bank_name) \
 	X(preset_name) \
 	X(preset_number) \
+	X(render_threads) \
+	X(reverb_engine) \
 	X(tuning_kbm_file) \
 	X(tuning_scl_file) \
-	X(tuning_mts_esp_disabled)
+	X(tuning_mts_esp_disabled) \
+	X(voice_kernel) \
+	X(voice_retire_threshold)
 
 enum {
     PORT_CONTROL            = 0,
@@ -50,6 +63,7 @@ enum {
     PORT_AUDIO_L            = 2,
     PORT_AUDIO_R            = 3,
     PORT_FIRST_PARAMETER    = 4,
+    PORT_LATENCY            = 45, // after the kAmsynthParameterCount parameters
 };
 
 #endif //AMSYNTH_LV2_H
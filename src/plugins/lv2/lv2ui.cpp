@@ -251,7 +251,7 @@ lv2_ui_port_event(LV2UI_Handle handle,
 				}
 			}
 		}
-	} else if (port_index >= PORT_FIRST_PARAMETER) {
+	} else if (port_index >= PORT_FIRST_PARAMETER && port_index < PORT_LATENCY) {
 		ui->presetController.getCurrentPreset().getParameter(port_index - PORT_FIRST_PARAMETER).setValue(*(float *)buffer, ui->parameterListener.get());
 	}
 }
@@ -85,11 +85,24 @@ struct Plugin final : public Parameter::Observer
 			audioMaster(effect, audioMasterEndEdit, parameter.getId(), 0, nullptr, 0);
 	}
 
+	// Reports the synthesizer's latency as the effect's initialDelay, which
+	// vestige.h leaves as the first field of empty3
+	void updateLatency()
+	{
+		int32_t latency = (int32_t)synthesizer->getLatency();
+		if (memcmp(effect->empty3, &latency, sizeof(latency)) == 0)
+			return;
+		memcpy(effect->empty3, &latency, sizeof(latency));
+		if (audioMaster)
+			audioMaster(effect, audioMasterIOChanged, 0, 0, nullptr, 0);
+	}
+
 	AEffect *effect;
 	audioMasterCallback audioMaster;
 	Synthesizer *synthesizer;
 	unsigned char *midiBuffer;
-	std::vector<amsynth_midi_event_t> midiEvents;
+	MidiEventBuffer midiEvents;
+	MidiOutputBuffer midiOut;
 	std::string chunk;
 	JuceIntegration juceIntegration;
 	std::unique_ptr<MainComponent> gui;
@@ -156,6 +169,7 @@ static intptr_t dispatcher(AEffect *effect, int opcode, int index, intptr_t val,
 			}
 			plugin->gui->sendProperty = [plugin] (const char *name, const char *value) {
 				plugin->synthesizer->setProperty(name, value);
+				plugin->updateLatency();
 			};
 			assert(plugin->gui->isOpaque()); // CreateWindowEx will fail if not opaque
 			plugin->gui->addToDesktop(juce::ComponentPeer::windowIgnoresKeyPresses, ptr);
@@ -179,6 +193,7 @@ static intptr_t dispatcher(AEffect *effect, int opcode, int index, intptr_t val,
 
 		case effSetChunk:
 			plugin->synthesizer->setState(std::string((const char *)ptr, val));
+			plugin->updateLatency();
 			return 0;
 
 		case effProcessEvents: {
@@ -300,8 +315,8 @@ static void process(AEffect *effect, float **inputs, float **outputs, int numSam
 {
 	(void)inputs;
 	Plugin *plugin = (Plugin *)effect->ptr3;
-	std::vector<amsynth_midi_cc_t> midi_out;
-	plugin->synthesizer->process(numSampleFrames, plugin->midiEvents, midi_out, outputs[0], outputs[1]);
+	plugin->midiOut.clear();
+	plugin->synthesizer->process(numSampleFrames, plugin->midiEvents.data(), plugin->midiEvents.size(), plugin->midiOut, outputs[0], outputs[1]);
 	plugin->midiEvents.clear();
 }
 
@@ -309,8 +324,8 @@ static void processReplacing(AEffect *effect, float **inputs, float **outputs, i
 {
 	(void)inputs;
 	Plugin *plugin = (Plugin *)effect->ptr3;
-	std::vector<amsynth_midi_cc_t> midi_out;
-	plugin->synthesizer->process(numSampleFrames, plugin->midiEvents, midi_out, outputs[0], outputs[1]);
+	plugin->midiOut.clear();
+	plugin->synthesizer->process(numSampleFrames, plugin->midiEvents.data(), plugin->midiEvents.size(), plugin->midiOut, outputs[0], outputs[1]);
 	plugin->midiEvents.clear();
 }
 
@@ -82,10 +82,10 @@ AudioOutput::ThreadAction	()
 {
 	Configuration & config = Configuration::get();
 	int bufsize = config.buffer_size;
+	MidiOutputBuffer midi_out;
 	while (!shouldStop) {
-		std::vector<amsynth_midi_event_t> midi_in;
-		std::vector<amsynth_midi_cc_t> midi_out;
-		amsynth_audio_callback(buffer+bufsize*2, buffer+bufsize*3, bufsize, 1, midi_in, midi_out);
+		midi_out.clear();
+		amsynth_audio_callback(buffer+bufsize*2, buffer+bufsize*3, bufsize, 1, nullptr, 0, midi_out);
 
 		for (int i=0; i<bufsize; i++) {
 			buffer[2*i]   = buffer[bufsize*2+i];
@@ -33,7 +33,6 @@
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
-#include <vector>
 
 
 #define UNUSED_PARAM( x ) (void)x
@@ -100,7 +99,8 @@ int
 JackOutput::process (jack_nframes_t nframes, void *arg)
 {
 	JackOutput *self = (JackOutput *)arg;
-	std::vector<amsynth_midi_event_t> midi_events;
+	self->midi_events.clear();
+	self->midi_out.clear();
 	float *lout = (jack_default_audio_sample_t *) jack_port_get_buffer(self->l_port, nframes);
 	float *rout = (jack_default_audio_sample_t *) jack_port_get_buffer(self->r_port, nframes);
 #if HAVE_JACK_MIDIPORT_H
@@ -111,21 +111,19 @@ JackOutput::process (jack_nframes_t nframes, void *arg)
 			jack_midi_event_t midi_event;
 			memset(&midi_event, 0, sizeof(midi_event));
 			jack_midi_event_get(&midi_event, port_buf, i);
-			midi_events.push_back(amsynth_midi_event_make(midi_event));
+			self->midi_events.push_back(amsynth_midi_event_make(midi_event));
 		}
 	}
 #endif
-	std::vector<amsynth_midi_cc_t> midi_out;
-	amsynth_audio_callback(lout, rout, nframes, 1, midi_events, midi_out);
+	amsynth_audio_callback(lout, rout, nframes, 1, self->midi_events.data(), self->midi_events.size(), self->midi_out);
 #if HAVE_JACK_MIDIPORT_H
 	if (self->m_port_out) {
 		void *port_buffer = jack_port_get_buffer(self->m_port_out, nframes);
 		jack_midi_clear_buffer(port_buffer);
-		std::vector<amsynth_midi_cc_t>::const_iterator out_it;
-		for (out_it = midi_out.begin(); out_it != midi_out.end(); ++out_it) {
+		for (const amsynth_midi_cc_t &out : self->midi_out) {
 			jack_midi_data_t data[] = {
-				(unsigned char) (MIDI_STATUS_CONTROLLER | (out_it->channel & 0x0f)),
-				out_it->cc, out_it->value };
+				(unsigned char) (MIDI_STATUS_CONTROLLER | (out.channel & 0x0f)),
+				out.cc, out.value };
 			jack_midi_event_write(port_buffer, 0, data, 3);
 		}
 	}
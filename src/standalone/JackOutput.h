@@ -55,6 +55,8 @@ private:
 	jack_port_t 	*m_port = nullptr;
 	jack_port_t 	*m_port_out = nullptr;
 	jack_client_t 	*client = nullptr;
+	MidiEventBuffer	midi_events;
+	MidiOutputBuffer	midi_out;
 #endif
 };
 
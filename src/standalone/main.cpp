@@ -69,7 +69,6 @@
 #include <sys/resource.h>
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <algorithm>
 
 #define _(string) gettext (string)
 
@@ -102,6 +101,7 @@ static MidiDriver *midiDriver;
 Synthesizer *s_synthesizer;
 static unsigned char *midiBuffer;
 static const size_t midiBufferSize = 4096;
+static MidiEventBuffer midiEvents; // only touched by amsynth_audio_callback()
 static int gui_midi_pipe[2];
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -195,6 +195,32 @@ public:
 			s_synthesizer->setProperty(name, value);
 			if (name == std::string(PROP_NAME(max_polyphony)))
 				Configuration::get().polyphony = std::stoi(value);
+			if (name == std::string(PROP_NAME(render_threads)))
+				Configuration::get().render_threads = std::stoi(value);
+			if (name == std::string(PROP_NAME(block_size)))
+				Configuration::get().block_size = std::stoi(value);
+			if (name == std::string(PROP_NAME(oscillator_engine)))
+				Configuration::get().oscillator_engine = value;
+			if (name == std::string(PROP_NAME(envelope_shape)))
+				Configuration::get().envelope_shape = value;
+			if (name == std::string(PROP_NAME(filter_engine)))
+				Configuration::get().filter_engine = value;
+			if (name == std::string(PROP_NAME(voice_kernel)))
+				Configuration::get().voice_kernel = value;
+			if (name == std::string(PROP_NAME(lfo_mode)))
+				Configuration::get().lfo_mode = value;
+			if (name == std::string(PROP_NAME(reverb_engine)))
+				Configuration::get().reverb_engine = value;
+			if (name == std::string(PROP_NAME(distortion_oversampling)))
+				Configuration::get().distortion_oversampling = std::stoi(value);
+			if (name == std::string(PROP_NAME(limiter_lookahead)))
+				Configuration::get().limiter_lookahead = std::stoi(value);
+			if (name == std::string(PROP_NAME(pipelined_effects)))
+				Configuration::get().pipelined_effects = std::stoi(value);
+			if (name == std::string(PROP_NAME(controller_ramps)))
+				Configuration::get().controller_ramps = std::stoi(value);
+			if (name == std::string(PROP_NAME(voice_retire_threshold)))
+				Configuration::get().voice_retire_threshold = std::stoi(value);
 			if (name == std::string(PROP_NAME(midi_channel)))
 				Configuration::get().midi_channel = std::stoi(value);
 			if (name == std::string(PROP_NAME(pitch_bend_range)))
@@ -405,6 +431,19 @@ int main( int argc, char *argv[] )
 	s_synthesizer = new Synthesizer();
 	s_synthesizer->setSampleRate(config.sample_rate);
 	s_synthesizer->setMaxNumVoices(config.polyphony);
+	s_synthesizer->setRenderThreads(config.render_threads);
+	s_synthesizer->setBlockSize(config.block_size);
+	s_synthesizer->setOscillatorEngine(config.oscillator_engine);
+	s_synthesizer->setVoiceRetireThreshold((float)config.voice_retire_threshold);
+	s_synthesizer->setEnvelopeShape(config.envelope_shape);
+	s_synthesizer->setFilterEngine(config.filter_engine);
+	s_synthesizer->setVoiceKernel(config.voice_kernel);
+	s_synthesizer->setLFOMode(config.lfo_mode);
+	s_synthesizer->setReverbEngine(config.reverb_engine);
+	s_synthesizer->setDistortionOversampling(config.distortion_oversampling);
+	s_synthesizer->setLimiterLookahead(config.limiter_lookahead);
+	s_synthesizer->setPipelinedEffects(config.pipelined_effects);
+	s_synthesizer->setControllerRamps(config.controller_ramps);
 	s_synthesizer->setMidiChannel(config.midi_channel);
 	s_synthesizer->setPitchBendRangeSemitones(config.pitch_bend_range);
 	if (config.current_tuning_file != "default") {
@@ -487,16 +526,14 @@ void amsynth_midi_input(unsigned char status, unsigned char data1, unsigned char
 	}
 }
 
-static bool compare(const amsynth_midi_event_t &first, const amsynth_midi_event_t &second) {
-	return (first.offset_frames < second.offset_frames);
-}
-
 void amsynth_audio_callback(
 		float *buffer_l, float *buffer_r, unsigned num_frames, int stride,
-		const std::vector<amsynth_midi_event_t> &midi_in,
-		std::vector<amsynth_midi_cc_t> &midi_out)
+		const amsynth_midi_event_t *midi_in, unsigned midi_in_count,
+		MidiOutputBuffer &midi_out)
 {
-	std::vector<amsynth_midi_event_t> midi_in_merged = midi_in;
+	midiEvents.clear();
+	for (unsigned i = 0; i < midi_in_count; i++)
+		midiEvents.insertSorted(midi_in[i]);
 
 	if (midiBuffer) {
 		unsigned char *buffer = midiBuffer;
@@ -510,7 +547,7 @@ void amsynth_audio_callback(
 				event.offset_frames = num_frames - 1;
 				event.length = (unsigned int) bytes_read;
 				event.buffer = buffer;
-				midi_in_merged.push_back(event);
+				midiEvents.insertSorted(event);
 				buffer += bytes_read;
 				bufferSize -= bytes_read;
 			}
@@ -523,21 +560,18 @@ void amsynth_audio_callback(
 				event.offset_frames = num_frames - 1;
 				event.length = bytes_read;
 				event.buffer = buffer;
-				midi_in_merged.push_back(event);
+				midiEvents.insertSorted(event);
 			}
 		}
 	}
 
-	std::sort(midi_in_merged.begin(), midi_in_merged.end(), compare);
-
 	if (s_synthesizer) {
-		s_synthesizer->process(num_frames, midi_in_merged, midi_out, buffer_l, buffer_r, stride);
+		s_synthesizer->process(num_frames, midiEvents.data(), midiEvents.size(), midi_out, buffer_l, buffer_r, stride);
 	}
 
 	if (midiDriver && !midi_out.empty()) {
-		std::vector<amsynth_midi_cc_t>::const_iterator out_it;
-		for (out_it = midi_out.begin(); out_it != midi_out.end(); ++out_it) {
-			midiDriver->write_cc(out_it->channel, out_it->cc, out_it->value);
+		for (const amsynth_midi_cc_t &out : midi_out) {
+			midiDriver->write_cc(out.channel, out.cc, out.value);
 		}
 	}
 }
@@ -595,7 +629,7 @@ void ptest ()
 	
 	// trigger off some notes for amsynth to render.
 	for (int v=0; v<kNumVoices; v++) {
-		voiceAllocationUnit->HandleMidiNoteOn(60 + v, 1.0f);
+		voiceAllocationUnit->HandleMidiNoteOn(60 + v, 1.0f, 0);
 	}
 	
 	struct rusage usage_before; 
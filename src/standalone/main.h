@@ -25,7 +25,7 @@
 #include "core/types.h"
 
 #ifdef __cplusplus
-#include <vector>
+#include "core/synth/EventBuffer.h"
 extern "C" {
 #endif
 
@@ -43,8 +43,8 @@ extern void amsynth_midi_input(unsigned char status, unsigned char data1, unsign
 
 extern void amsynth_audio_callback(
         float *buffer_l, float *buffer_r, unsigned num_frames, int stride,
-        const std::vector<amsynth_midi_event_t> &midi_in,
-        std::vector<amsynth_midi_cc_t> &midi_out);
+        const amsynth_midi_event_t *midi_in, unsigned midi_in_count,
+        MidiOutputBuffer &midi_out);
 
 }
 #endif
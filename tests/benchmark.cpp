@@ -0,0 +1,325 @@
+/*
+ *  benchmark.cpp
+ *
+ *  Copyright (c) 2026 Nick Dowell
+ *
+ *  This file is part of amsynth.
+ *
+ *  amsynth is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  amsynth is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with amsynth.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Engine benchmarks; build with `make amsynth-benchmark` and run from the
+// build directory, optionally naming one of them:
+//
+//   denormals    Times each block through the release tail of a chord, with
+//                and without denormals flushed to zero.
+//   block-size   The CPU used to play a chord at each internal block size,
+//                against the latency that block size adds in pipelined mode.
+//   controllers  The CPU used to play a chord while a MIDI controller sweeps
+//                the filter cutoff, at increasing event rates, with and
+//                without controller ramps.
+//   kernels      The CPU used to play a chord with the staged and the fused
+//                voice kernels.
+//   distortion   Times the distortion per block, with crunch held and with
+//                crunch automated, i.e. changed every block.
+
+#include "core/midi.h"
+#include "core/synth/DenormalGuard.h"
+#include "core/synth/Distortion.h"
+#include "core/synth/MidiController.h"
+#include "core/synth/Synthesizer.h"
+#include "core/synth/VoiceAllocationUnit.h"
+#include "core/synth/VoiceBoard.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+static const int kSampleRate = 44100;
+static const int kBlockSize = 64;
+static const int kBlocksPerSecond = kSampleRate / kBlockSize;
+static const int kSeconds = 20;
+
+struct Timing
+{
+	double mean[kSeconds] = {};
+	double max[kSeconds] = {};
+};
+
+static Timing
+releaseTail(bool flushDenormals)
+{
+	static float buffer[2][kBlockSize];
+
+	Synthesizer synth;
+	synth.setSampleRate(kSampleRate);
+	synth.setParameterValue(kAmsynthParameter_AmpEnvRelease, 8.f);
+	synth.setParameterValue(kAmsynthParameter_FilterEnvRelease, 8.f);
+	synth.setParameterValue(kAmsynthParameter_ReverbWet, 0.5f);
+	synth.setVoiceRetireThreshold(VoiceAllocationUnit::kVoiceRetireNever);
+
+	// Calls the engine directly, bypassing the guard in Synthesizer::process
+	VoiceAllocationUnit *vau = synth._voiceAllocationUnit;
+	auto process = [&] {
+		if (flushDenormals) {
+			DenormalGuard denormalGuard;
+			vau->Process(buffer[0], buffer[1], kBlockSize);
+		} else {
+			vau->Process(buffer[0], buffer[1], kBlockSize);
+		}
+	};
+
+	const int chord[] = { 48, 55, 60, 64, 67, 72 };
+	for (int note : chord)
+		vau->HandleMidiNoteOn(note, 0.8f, 0);
+	for (int i = 0; i < kBlocksPerSecond; i++)
+		process();
+	for (int note : chord)
+		vau->HandleMidiNoteOff(note, 0.f, 0);
+
+	Timing timing;
+	for (int second = 0; second < kSeconds; second++) {
+		double total = 0;
+		for (int i = 0; i < kBlocksPerSecond; i++) {
+			auto start = std::chrono::steady_clock::now();
+			process();
+			double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+			total += us;
+			timing.max[second] = std::max(timing.max[second], us);
+		}
+		timing.mean[second] = total / kBlocksPerSecond;
+	}
+	return timing;
+}
+
+static void
+benchmarkDenormals()
+{
+	// Best of a few runs, to keep scheduling noise out of the maxima
+	const int kRuns = 3;
+	Timing before, after;
+	for (int run = 0; run < kRuns; run++) {
+		Timing b = releaseTail(false), a = releaseTail(true);
+		for (int s = 0; s < kSeconds; s++) {
+			before.mean[s] = run ? std::min(before.mean[s], b.mean[s]) : b.mean[s];
+			before.max[s] = run ? std::min(before.max[s], b.max[s]) : b.max[s];
+			after.mean[s] = run ? std::min(after.mean[s], a.mean[s]) : a.mean[s];
+			after.max[s] = run ? std::min(after.max[s], a.max[s]) : a.max[s];
+		}
+	}
+
+	printf("Microseconds per %d frame block after releasing a chord\n\n", kBlockSize);
+	printf("  time   denormals (mean / max)   flushed (mean / max)\n");
+	for (int s = 0; s < kSeconds; s++) {
+		printf("  %2ds   %9.2f / %8.2f     %9.2f / %8.2f\n", s + 1,
+			   before.mean[s], before.max[s], after.mean[s], after.max[s]);
+	}
+}
+
+// Percentage of real time taken to render a held chord
+static double
+chordLoad(int blockSize, int renderThreads, bool pipelined, bool fusedKernel = false)
+{
+	const int kHostBufferSize = 512, kChordSeconds = 4;
+	static float buffer[2][kHostBufferSize];
+
+	Synthesizer synth;
+	synth.setSampleRate(kSampleRate);
+	synth.setParameterValue(kAmsynthParameter_ReverbWet, 0.5f);
+	synth.setBlockSize(blockSize);
+	synth.setRenderThreads(renderThreads);
+	synth.setPipelinedEffects(pipelined);
+	synth.setVoiceKernel(fusedKernel ? "fused" : "staged");
+
+	unsigned char notes[16][3];
+	std::vector<amsynth_midi_event_t> chord, midiIn;
+	std::vector<amsynth_midi_cc_t> midiOut;
+	for (int i = 0; i < 16; i++) {
+		notes[i][0] = 0x90;
+		notes[i][1] = (unsigned char)(36 + i * 3);
+		notes[i][2] = 100;
+		chord.push_back({ 0, 3, notes[i] });
+	}
+	synth.process(kHostBufferSize, chord, midiOut, buffer[0], buffer[1]);
+
+	const int numBuffers = kChordSeconds * kSampleRate / kHostBufferSize;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < numBuffers; i++)
+		synth.process(kHostBufferSize, midiIn, midiOut, buffer[0], buffer[1]);
+	double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	return 100 * seconds * kSampleRate / (numBuffers * kHostBufferSize);
+}
+
+static void
+benchmarkBlockSize()
+{
+	printf("CPU load playing a 16 note chord, in 512 frame host buffers\n\n");
+	printf("  block   pipelined latency   1 thread   4 threads   pipelined\n");
+	for (int blockSize = VoiceAllocationUnit::kMinBlockSize; blockSize <= VoiceAllocationUnit::kMaxBlockSize; blockSize *= 2) {
+		// Best of a few runs
+		double load[3] = { 1e9, 1e9, 1e9 };
+		for (int run = 0; run < 3; run++) {
+			load[0] = std::min(load[0], chordLoad(blockSize, 1, false));
+			load[1] = std::min(load[1], chordLoad(blockSize, 4, false));
+			load[2] = std::min(load[2], chordLoad(blockSize, 1, true));
+		}
+		printf("  %5d   %11d frames   %7.2f%%   %8.2f%%   %8.2f%%\n", blockSize, blockSize, load[0], load[1], load[2]);
+	}
+}
+
+static void
+benchmarkKernels()
+{
+	printf("CPU load playing a 16 note chord, in 512 frame host buffers\n\n");
+	printf("  run   staged    fused\n");
+	for (int run = 0; run < 5; run++) {
+		const double staged = chordLoad(64, 1, false, false);
+		const double fused = chordLoad(64, 1, false, true);
+		printf("  %3d   %5.2f%%   %5.2f%%\n", run + 1, staged, fused);
+	}
+}
+
+// Percentage of real time taken to render a held chord while a controller
+// sends an event every `interval` frames (0 for none)
+static double
+controllerLoad(int interval, bool ramps)
+{
+	const int kHostBufferSize = 512, kChordSeconds = 4;
+	static float buffer[2][kHostBufferSize];
+	static unsigned char events[kHostBufferSize][3];
+
+	Synthesizer synth;
+	synth.setSampleRate(kSampleRate);
+	synth.setControllerRamps(ramps);
+	int cc = synth.getMidiController()->getControllerForParameter(kAmsynthParameter_FilterCutoff);
+	if (cc < 0) {
+		cc = MIDI_CC_SOUND_CONTROLLER_5;
+		synth.getMidiController()->setControllerForParameter(kAmsynthParameter_FilterCutoff, cc);
+	}
+
+	unsigned char notes[8][3];
+	std::vector<amsynth_midi_event_t> chord, midiIn;
+	std::vector<amsynth_midi_cc_t> midiOut;
+	for (int i = 0; i < 8; i++) {
+		notes[i][0] = MIDI_STATUS_NOTE_ON;
+		notes[i][1] = (unsigned char)(48 + i * 3);
+		notes[i][2] = 100;
+		chord.push_back({ 0, 3, notes[i] });
+	}
+	synth.process(kHostBufferSize, chord, midiOut, buffer[0], buffer[1]);
+
+	const int numBuffers = kChordSeconds * kSampleRate / kHostBufferSize;
+	midiIn.reserve(kHostBufferSize);
+	double seconds = 0;
+	for (int i = 0, frame = 0; i < numBuffers; i++) {
+		midiIn.clear();
+		for (int j = 0; interval && j < kHostBufferSize; j += interval, frame += interval) {
+			// A slow triangle sweep
+			const int position = (frame / 64) % 254;
+			events[j][0] = MIDI_STATUS_CONTROLLER;
+			events[j][1] = (unsigned char) cc;
+			events[j][2] = (unsigned char) (position < 127 ? position : 253 - position);
+			midiIn.push_back({ (unsigned) j, 3, events[j] });
+		}
+		midiOut.clear();
+		auto start = std::chrono::steady_clock::now();
+		synth.process(kHostBufferSize, midiIn, midiOut, buffer[0], buffer[1]);
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	return 100 * seconds * kSampleRate / (numBuffers * kHostBufferSize);
+}
+
+static void
+benchmarkControllers()
+{
+	printf("CPU load playing an 8 note chord while a CC sweeps the filter cutoff\n\n");
+	printf("  event every   split blocks   ramps\n");
+	for (int interval : { 0, 64, 16, 4, 1 }) {
+		double load[2] = { 1e9, 1e9 };
+		for (int run = 0; run < 3; run++) {
+			load[0] = std::min(load[0], controllerLoad(interval, false));
+			load[1] = std::min(load[1], controllerLoad(interval, true));
+		}
+		if (interval)
+			printf("  %4d frames   %11.2f%%   %4.2f%%\n", interval, load[0], load[1]);
+		else
+			printf("  no events     %11.2f%%   %4.2f%%\n", load[0], load[1]);
+	}
+}
+
+// Mean microseconds per block through the distortion
+static double
+distortionTime(bool automated, bool oversampling)
+{
+	const int kBlocks = 20000;
+	static float buffer[kBlockSize];
+
+	Distortion distortion;
+	distortion.SetOversampling(oversampling);
+	distortion.SetCrunch(0.5f);
+	double seconds = 0;
+	for (int i = 0; i < kBlocks; i++) {
+		for (int j = 0; j < kBlockSize; j++)
+			buffer[j] = 0.5f * sinf((float)(i * kBlockSize + j) * 0.05f);
+		if (automated)
+			distortion.SetCrunch(0.5f + 0.4f * sinf((float)i * 0.01f));
+		auto start = std::chrono::steady_clock::now();
+		distortion.Process(buffer, kBlockSize);
+		seconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	}
+	return 1e6 * seconds / kBlocks;
+}
+
+static void
+benchmarkDistortion()
+{
+	printf("Microseconds per %d frame block through the distortion\n\n", kBlockSize);
+	printf("  oversampling   crunch held   crunch automated\n");
+	for (int oversampling = 0; oversampling < 2; oversampling++) {
+		double held = 1e9, automated = 1e9;
+		for (int run = 0; run < 3; run++) {
+			held = std::min(held, distortionTime(false, oversampling));
+			automated = std::min(automated, distortionTime(true, oversampling));
+		}
+		printf("  %-12s   %11.2f   %16.2f\n", oversampling ? "on" : "off", held, automated);
+	}
+}
+
+int main(int argc, const char *argv[])
+{
+	const char *name = argc > 1 ? argv[1] : nullptr;
+	if (!name || !strcmp(name, "denormals")) {
+		benchmarkDenormals();
+		printf("\n");
+	}
+	if (!name || !strcmp(name, "block-size")) {
+		benchmarkBlockSize();
+		printf("\n");
+	}
+	if (!name || !strcmp(name, "kernels")) {
+		benchmarkKernels();
+		printf("\n");
+	}
+	if (!name || !strcmp(name, "controllers")) {
+		benchmarkControllers();
+		printf("\n");
+	}
+	if (!name || !strcmp(name, "distortion")) {
+		benchmarkDistortion();
+	}
+	return 0;
+}
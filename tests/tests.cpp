@@ -21,19 +21,84 @@
 
 #include "core/controls.h"
 #include "core/midi.h"
+#include "core/synth/ADSR.h"
+#include "core/synth/DenormalGuard.h"
+#include "core/synth/Distortion.h"
+#include "core/synth/FDNReverb.h"
 #include "core/synth/LowPassFilter.h"
 #include "core/synth/MidiController.h"
 #include "core/synth/Oscillator.h"
+#include "core/synth/SoftLimiter.h"
+#include "core/synth/Synth--.h"
 #include "core/synth/Synthesizer.h"
 #include "core/synth/VoiceAllocationUnit.h"
 #include "core/synth/VoiceBoard.h"
+#include "freeverb/revmodel.hpp"
 
+#include <atomic>
 #include <cassert>
+#include <cmath>
 #include <cstdio>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <new>
 
 #define TEST(name) static void name()
 
+// Counts heap allocations made by any thread while enabled. Every global
+// form of operator new and delete is replaced, so that none go uncounted,
+// and kept out of line so that GCC cannot pair the malloc inside one with
+// the free inside another and warn that they are mismatched.
+static std::atomic<bool> s_countAllocations{false};
+static std::atomic<int> s_allocations{0};
+
+#define ALLOCATOR __attribute__((noinline))
+
+static ALLOCATOR void *allocate(std::size_t size, std::size_t alignment)
+{
+    if (s_countAllocations.load())
+        s_allocations++;
+    void *ptr = nullptr;
+    if (posix_memalign(&ptr, std::max(alignment, sizeof(void *)), size ? size : 1) != 0)
+        return nullptr;
+    return ptr;
+}
+
+static ALLOCATOR void *allocateOrThrow(std::size_t size, std::size_t alignment)
+{
+    if (void *ptr = allocate(size, alignment))
+        return ptr;
+    throw std::bad_alloc();
+}
+
+static const std::size_t kDefaultAlignment = alignof(std::max_align_t);
+
+ALLOCATOR void *operator new(std::size_t size) { return allocateOrThrow(size, kDefaultAlignment); }
+ALLOCATOR void *operator new[](std::size_t size) { return allocateOrThrow(size, kDefaultAlignment); }
+ALLOCATOR void *operator new(std::size_t size, const std::nothrow_t &) noexcept { return allocate(size, kDefaultAlignment); }
+ALLOCATOR void *operator new[](std::size_t size, const std::nothrow_t &) noexcept { return allocate(size, kDefaultAlignment); }
+ALLOCATOR void operator delete(void *ptr) noexcept { free(ptr); }
+ALLOCATOR void operator delete[](void *ptr) noexcept { free(ptr); }
+ALLOCATOR void operator delete(void *ptr, std::size_t) noexcept { free(ptr); }
+ALLOCATOR void operator delete[](void *ptr, std::size_t) noexcept { free(ptr); }
+ALLOCATOR void operator delete(void *ptr, const std::nothrow_t &) noexcept { free(ptr); }
+ALLOCATOR void operator delete[](void *ptr, const std::nothrow_t &) noexcept { free(ptr); }
+
+#if __cpp_aligned_new
+// Used for over-aligned types, e.g. alignas(64) VoicePatch, from C++17
+ALLOCATOR void *operator new(std::size_t size, std::align_val_t alignment) { return allocateOrThrow(size, (std::size_t)alignment); }
+ALLOCATOR void *operator new[](std::size_t size, std::align_val_t alignment) { return allocateOrThrow(size, (std::size_t)alignment); }
+ALLOCATOR void *operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return allocate(size, (std::size_t)alignment); }
+ALLOCATOR void *operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept { return allocate(size, (std::size_t)alignment); }
+ALLOCATOR void operator delete(void *ptr, std::align_val_t) noexcept { free(ptr); }
+ALLOCATOR void operator delete[](void *ptr, std::align_val_t) noexcept { free(ptr); }
+ALLOCATOR void operator delete(void *ptr, std::size_t, std::align_val_t) noexcept { free(ptr); }
+ALLOCATOR void operator delete[](void *ptr, std::size_t, std::align_val_t) noexcept { free(ptr); }
+ALLOCATOR void operator delete(void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { free(ptr); }
+ALLOCATOR void operator delete[](void *ptr, std::align_val_t, const std::nothrow_t &) noexcept { free(ptr); }
+#endif
+
 TEST(testMidiOutput) {
     static float audioBuffer[64];
 
@@ -83,7 +148,7 @@ TEST(testMidiOutput_OnOff) {
     MidiController *midiController = synth->getMidiController();
     midiController->setControllerForParameter(kAmsynthParameter_Oscillator2Sync, 2);
     synth->setNormalizedParameterValue(kAmsynthParameter_Oscillator2Sync, 0);
-    std::vector<amsynth_midi_cc_t> midiOut;
+    MidiOutputBuffer midiOut;
     midiController->generateMidiOutput(midiOut);
     midiOut.clear();
 
@@ -112,11 +177,7 @@ TEST(testMidiOutput_OnOff) {
 }
 
 static int countActiveVoices(Synthesizer *synth) {
-    int count = 0;
-    for (int i = 0; i < 128; i++) {
-        count = count + (synth->_voiceAllocationUnit->active[i] ? 1 : 0);
-    }
-    return count;
+    return synth->_voiceAllocationUnit->getNumActiveVoices();
 }
 
 TEST(testMidiAllNotesOff) {
@@ -162,6 +223,152 @@ TEST(testMidiAllNotesOff) {
     delete synth;
 }
 
+static void processMidi(Synthesizer *synth, unsigned char status, unsigned char data1, unsigned char data2) {
+    static float audioBuffer[64];
+    unsigned char midi[4] = { status, data1, data2 };
+    amsynth_midi_event_t e = { 0, 3, midi };
+    std::vector<amsynth_midi_event_t> midiIn(1, e);
+    std::vector<amsynth_midi_cc_t> midiOut;
+    synth->process(32, midiIn, midiOut, &audioBuffer[0], &audioBuffer[32]);
+}
+
+TEST(testVoiceStealing) {
+    Synthesizer *synth = new Synthesizer();
+    synth->setSampleRate(44100);
+    synth->setParameterValue(kAmsynthParameter_KeyboardMode, KeyboardModePoly);
+    synth->setParameterValue(kAmsynthParameter_AmpEnvRelease, 2.f);
+    synth->setMaxNumVoices(4);
+    VoiceAllocationUnit *vau = synth->_voiceAllocationUnit;
+
+    for (unsigned char note = 60; note < 64; note++) {
+        processMidi(synth, MIDI_STATUS_NOTE_ON, note, 100);
+    }
+    assert(countActiveVoices(synth) == 4);
+
+    // the oldest released voice is stolen first...
+    processMidi(synth, MIDI_STATUS_NOTE_ON, 62, 0);
+    processMidi(synth, MIDI_STATUS_NOTE_ON, 64, 100);
+    assert(countActiveVoices(synth) == 4);
+    assert(vau->mNoteVoices[0][62] < 0);
+    assert(vau->mNoteVoices[0][60] >= 0);
+
+    // ...then the oldest held voice
+    processMidi(synth, MIDI_STATUS_NOTE_ON, 65, 100);
+    assert(countActiveVoices(synth) == 4);
+    assert(vau->mNoteVoices[0][60] < 0);
+    assert(vau->mNoteVoices[0][61] >= 0);
+
+    delete synth;
+}
+
+TEST(testVoicePoolFollowsMaxPolyphony) {
+    Synthesizer *synth = new Synthesizer();
+    synth->setSampleRate(44100);
+    synth->setParameterValue(kAmsynthParameter_KeyboardMode, KeyboardModePoly);
+    synth->setParameterValue(kAmsynthParameter_AmpEnvRelease, 2.f);
+    VoiceAllocationUnit *vau = synth->_voiceAllocationUnit;
+
+    // the unlimited pool was never taken up, so its surplus boards go at once
+    synth->setMaxNumVoices(4);
+    assert(vau->mVoiceBoards[3] && !vau->mVoiceBoards[4]);
+    processMidi(synth, MIDI_STATUS_NOTE_ON, 60, 100);
+    assert(vau->mPoolSize == 4);
+
+    synth->setMaxNumVoices(8);
+    for (unsigned char note = 61; note < 68; note++) {
+        processMidi(synth, MIDI_STATUS_NOTE_ON, note, 100);
+    }
+    assert(vau->mPoolSize == 8);
+    assert(countActiveVoices(synth) == 8);
+
+    // shrinking silences the voices beyond the new size...
+    synth->setMaxNumVoices(2);
+    assert(vau->mVoiceBoards[7]);
+    processMidi(synth, MIDI_STATUS_NOTE_OFF, 60, 0);
+    assert(vau->mPoolSize == 2);
+    assert(countActiveVoices(synth) <= 2);
+
+    // ...and their boards are deleted once the audio thread is done with them
+    synth->setMaxNumVoices(2);
+    assert(vau->mVoiceBoards[1] && !vau->mVoiceBoards[2]);
+
+    delete synth;
+}
+
+TEST(testSameNoteOnDifferentChannels) {
+    Synthesizer *synth = new Synthesizer();
+    synth->setSampleRate(44100);
+    synth->setParameterValue(kAmsynthParameter_KeyboardMode, KeyboardModePoly);
+    VoiceAllocationUnit *vau = synth->_voiceAllocationUnit;
+
+    processMidi(synth, MIDI_STATUS_NOTE_ON | 0, 60, 100);
+    processMidi(synth, MIDI_STATUS_NOTE_ON | 1, 60, 100);
+    assert(countActiveVoices(synth) == 2);
+
+    processMidi(synth, MIDI_STATUS_NOTE_OFF | 0, 60, 0);
+    int voice = vau->mNoteVoices[1][60];
+    assert(voice >= 0 && voice != vau->mNoteVoices[0][60]);
+    assert(vau->mVoices[voice].keyPressed);
+
+    delete synth;
+}
+
+TEST(testSameNoteOnDifferentChannelsInLegatoMode) {
+    Synthesizer *synth = new Synthesizer();
+    synth->setSampleRate(44100);
+    synth->setParameterValue(kAmsynthParameter_KeyboardMode, KeyboardModeLegato);
+    synth->setParameterValue(kAmsynthParameter_AmpEnvRelease, 2.f);
+    VoiceAllocationUnit *vau = synth->_voiceAllocationUnit;
+
+    processMidi(synth, MIDI_STATUS_NOTE_ON | 0, 60, 100);
+    processMidi(synth, MIDI_STATUS_NOTE_ON | 1, 60, 100);
+    assert(vau->mNumKeysPressed == 2);
+
+    // the note is still held on channel 1
+    processMidi(synth, MIDI_STATUS_NOTE_OFF | 0, 60, 0);
+    assert(vau->mNumKeysPressed == 1);
+    assert(vau->mVoices[0].board->getFramesRemaining() == 0);
+
+    processMidi(synth, MIDI_STATUS_NOTE_OFF | 1, 60, 0);
+    assert(vau->mNumKeysPressed == 0);
+    assert(vau->mVoices[0].board->getFramesRemaining() > 0);
+
+    delete synth;
+}
+
+TEST(testMonoModeKeyOrder) {
+    Synthesizer *synth = new Synthesizer();
+    synth->setSampleRate(44100);
+    synth->setParameterValue(kAmsynthParameter_KeyboardMode, KeyboardModeMono);
+    synth->setParameterValue(kAmsynthParameter_PortamentoTime, 0.f);
+    synth->setParameterValue(kAmsynthParameter_AmpEnvRelease, 2.f);
+    VoiceAllocationUnit *vau = synth->_voiceAllocationUnit;
+    const float c4 = (float) vau->noteToPitch(60, 0), e4 = (float) vau->noteToPitch(64, 1);
+
+    // releasing the sounding key returns to the last one still held
+    processMidi(synth, MIDI_STATUS_NOTE_ON | 0, 60, 100);
+    processMidi(synth, MIDI_STATUS_NOTE_ON | 1, 64, 100);
+    VoiceBoard *voice = vau->mVoices[0].board;
+    assert(voice->getFrequency() == e4);
+    processMidi(synth, MIDI_STATUS_NOTE_OFF | 1, 64, 0);
+    assert(voice->getFrequency() == c4 && voice->getFramesRemaining() == 0);
+
+    // keys released under the sustain pedal are dropped when it is lifted
+    processMidi(synth, MIDI_STATUS_CONTROLLER, MIDI_CC_SUSTAIN_PEDAL, 127);
+    processMidi(synth, MIDI_STATUS_NOTE_ON | 1, 64, 100);
+    processMidi(synth, MIDI_STATUS_NOTE_OFF | 1, 64, 0);
+    assert(voice->getFrequency() == e4);
+    processMidi(synth, MIDI_STATUS_CONTROLLER, MIDI_CC_SUSTAIN_PEDAL, 0);
+    assert(voice->getFrequency() == c4 && voice->getFramesRemaining() == 0);
+    assert(vau->mKeyHead == 60 && vau->mKeyTail == 60);
+
+    processMidi(synth, MIDI_STATUS_NOTE_OFF | 0, 60, 0);
+    assert(voice->getFramesRemaining() > 0);
+    assert(vau->mKeyHead < 0 && vau->mKeyTail < 0);
+
+    delete synth;
+}
+
 TEST(testPresetIgnoredParameters) {
     Preset basePreset;
     basePreset.getParameter(0).setValue(1);
@@ -195,12 +402,1041 @@ TEST(testOscillatorHighFrequency) {
     
     Oscillator osc;
     osc.SetSampleRate(44100);
-    for (int waveform = (int)Oscillator::Waveform::kSine; waveform <= (int)Oscillator::Waveform::kRandom; waveform++) {
-        osc.SetWaveform((Oscillator::Waveform)waveform);
-        osc.ProcessSamples(buffer, VoiceBoard::kMaxProcessBufferSize, 99999, 0.5f);
+    for (auto engine : {Oscillator::Engine::kClassic, Oscillator::Engine::kWavetable, Oscillator::Engine::kPolyBLEP}) {
+        osc.setEngine(engine);
+        for (int waveform = (int)Oscillator::Waveform::kSine; waveform <= (int)Oscillator::Waveform::kRandom; waveform++) {
+            osc.SetWaveform((Oscillator::Waveform)waveform);
+            osc.ProcessSamples(buffer, VoiceBoard::kMaxProcessBufferSize, 99999, 0.5f);
+        }
     }
 }
 
+// Magnitude of the DFT bin at `hz`, normalised by the number of samples
+static double goertzel(const float *samples, int numSamples, double hz, double sampleRate) {
+    double coeff = 2 * cos(2 * 3.14159265358979323846 * hz / sampleRate);
+    double s1 = 0, s2 = 0;
+    for (int i = 0; i < numSamples; i++) {
+        double s0 = samples[i] + coeff * s1 - s2;
+        s2 = s1;
+        s1 = s0;
+    }
+    return sqrt(s1 * s1 + s2 * s2 - coeff * s1 * s2) / numSamples;
+}
+
+// Renders one second of an oscillator and returns its largest alias relative
+// to the fundamental. Harmonics of f above Nyquist fold back to frequencies
+// that are (sampleRate % f) above a multiple of f, e.g. 24 kHz -> 20.1 kHz
+// for f = 3 kHz, which are measured here.
+static double worstAlias(Oscillator::Engine engine, Oscillator::Waveform waveform, float freq, float syncFreq) {
+    const int sampleRate = 44100, blockSize = VoiceBoard::kMaxProcessBufferSize;
+    static float buffer[44100];
+    Oscillator osc;
+    osc.setEngine(engine);
+    osc.SetSampleRate(sampleRate);
+    osc.SetWaveform(waveform);
+    osc.setSyncEnabled(syncFreq > 0);
+    osc.ProcessSamples(buffer, blockSize, freq, 0.5f, syncFreq); // let the frequency settle
+    for (int i = 0; i < sampleRate; i += blockSize) {
+        osc.ProcessSamples(buffer + i, std::min(blockSize, sampleRate - i), freq, 0.5f, syncFreq);
+    }
+    const int fundamental = (int)(syncFreq > 0 ? syncFreq : freq);
+    const double level = goertzel(buffer, sampleRate, fundamental, sampleRate);
+    assert(level > 0.05);
+    double worst = 0;
+    for (int alias = sampleRate % fundamental; alias < sampleRate / 2; alias += fundamental) {
+        worst = std::max(worst, goertzel(buffer, sampleRate, alias, sampleRate));
+    }
+    return worst / level;
+}
+
+TEST(testWavetableOscillator) {
+    const int sampleRate = 44100, blockSize = VoiceBoard::kMaxProcessBufferSize;
+    static float classic[44100], wavetable[44100];
+
+    // Same output as the classic sine, give or take the table interpolation
+    // error and the two engines wrapping the phase at different times
+    Oscillator osc[2];
+    osc[1].setEngine(Oscillator::Engine::kWavetable);
+    for (auto &o : osc) {
+        o.SetSampleRate(sampleRate);
+        o.SetWaveform(Oscillator::Waveform::kSine);
+    }
+    for (int i = 0; i + blockSize <= sampleRate; i += blockSize) {
+        osc[0].ProcessSamples(classic + i, blockSize, 440, 0);
+        osc[1].ProcessSamples(wavetable + i, blockSize, 440, 0);
+    }
+    for (int i = 0; i < sampleRate; i++) {
+        assert(fabsf(classic[i] - wavetable[i]) < 5e-3f);
+    }
+
+    for (auto waveform : {Oscillator::Waveform::kSaw, Oscillator::Waveform::kPulse}) {
+        assert(worstAlias(Oscillator::Engine::kWavetable, waveform, 3000, 0) < 1e-4);
+    }
+}
+
+TEST(testPolyBLEPOscillator) {
+    // Aliasing should be well below the classic engine's, with and without
+    // hard sync
+    for (auto waveform : {Oscillator::Waveform::kSaw, Oscillator::Waveform::kPulse}) {
+        assert(worstAlias(Oscillator::Engine::kPolyBLEP, waveform, 3000, 0) < 0.04);
+        assert(worstAlias(Oscillator::Engine::kPolyBLEP, waveform, 3000, 0) < worstAlias(Oscillator::Engine::kClassic, waveform, 3000, 0) / 2);
+        assert(worstAlias(Oscillator::Engine::kPolyBLEP, waveform, 2630, 1000) < worstAlias(Oscillator::Engine::kClassic, waveform, 2630, 1000) / 2);
+    }
+}
+
+// Largest absolute (or relative) difference between fast::fn and libm over a
+// range, printed so that changes to the approximations can be compared
+template <typename Fast, typename Reference>
+static double maxError(Fast fast, Reference reference, float begin, float end, float step, bool relative) {
+    double worst = 0;
+    for (float x = begin; x < end; x += step) {
+        double expected = reference((double)x);
+        double error = fabs(fast(x) - expected);
+        worst = std::max(worst, relative ? error / fabs(expected) : error);
+    }
+    return worst;
+}
+
+TEST(testFastMath) {
+    assert(maxError(fast::sin, [](double x) { return sin(x); }, -1e4f, 1e4f, 0.0137f, false) < 3e-7);
+    assert(maxError(fast::exp2, [](double x) { return exp2(x); }, -126.f, 126.f, 0.0011f, true) < 2e-7);
+    assert(maxError(fast::log2, [](double x) { return log2(x); }, 0.5f, 2.f, 1e-6f, false) < 2e-7);
+    assert(maxError(fast::tan, [](double x) { return tan(x); }, 1e-3f, 1.555f, 1e-5f, true) < 2e-5);
+    // the range used by Distortion
+    double powError = 0;
+    for (float y = 0.01f; y <= 1.f; y *= 1.5f) {
+        powError = std::max(powError, maxError([y](float x) { return fast::pow(x, y); }, [y](double x) { return pow(x, y); }, 1e-3f, 1.f, 1e-5f, true));
+    }
+    assert(powError < 1e-6);
+    assert(fast::pow(0.f, 0.5f) == 0.f);
+}
+
+TEST(testBatchRenderingMatchesPerVoiceRendering) {
+    static float batched[2][VoiceBoard::kMaxProcessBufferSize];
+    static float reference[2][VoiceBoard::kMaxProcessBufferSize];
+
+    Synthesizer synths[2];
+    for (auto &synth : synths) {
+        synth.setSampleRate(44100);
+        synth.setParameterValue(kAmsynthParameter_OscillatorMixRingMod, 0.3f);
+        synth.setParameterValue(kAmsynthParameter_LFOToAmp, 0.5f);
+        synth.setParameterValue(kAmsynthParameter_FilterResonance, 0.5f);
+    }
+    synths[1]._voiceAllocationUnit->mBatchRendering = false;
+
+    // 15 voices exercises the 8, 4 and 2 lane batches plus a single voice
+    for (int note = 40; note < 55; note++) {
+        for (auto &synth : synths) {
+            synth._voiceAllocationUnit->HandleMidiNoteOn(note, (float)note / 127.f, 0);
+        }
+    }
+
+    std::vector<amsynth_midi_event_t> midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+    for (int i = 0; i < 100; i++) {
+        // step through every filter type and slope, each of which has its own render path
+        if (i % 10 == 0) {
+            for (auto &synth : synths) {
+                synth.setParameterValue(kAmsynthParameter_FilterType, (float)(i / 10 % 5));
+                synth.setParameterValue(kAmsynthParameter_FilterSlope, (float)(i / 50));
+            }
+        }
+        synths[0].process(VoiceBoard::kMaxProcessBufferSize, midiIn, midiOut, batched[0], batched[1]);
+        synths[1].process(VoiceBoard::kMaxProcessBufferSize, midiIn, midiOut, reference[0], reference[1]);
+        assert(memcmp(batched, reference, sizeof(batched)) == 0);
+    }
+}
+
+TEST(testFusedKernelMatchesStagedKernel) {
+    static float fused[2][VoiceBoard::kMaxProcessBufferSize];
+    static float staged[2][VoiceBoard::kMaxProcessBufferSize];
+
+    for (bool batch : {true, false}) for (const char *engine : {"biquad", "svf"}) {
+        Synthesizer synths[2];
+        for (auto &synth : synths) {
+            synth.setSampleRate(44100);
+            synth.setProperty(PROP_NAME(filter_engine), engine);
+            synth.setParameterValue(kAmsynthParameter_OscillatorMixRingMod, 0.3f);
+            synth.setParameterValue(kAmsynthParameter_LFOToAmp, 0.5f);
+            synth.setParameterValue(kAmsynthParameter_FilterResonance, 0.5f);
+            synth._voiceAllocationUnit->mBatchRendering = batch;
+        }
+        synths[0].setProperty(PROP_NAME(voice_kernel), "fused");
+        assert(synths[0].getProperties()[PROP_NAME(voice_kernel)] == "fused");
+        assert(synths[1].getProperties()[PROP_NAME(voice_kernel)] == "staged");
+
+        for (int note = 40; note < 55; note++) {
+            for (auto &synth : synths) {
+                synth._voiceAllocationUnit->HandleMidiNoteOn(note, (float)note / 127.f, 0);
+            }
+        }
+
+        std::vector<amsynth_midi_event_t> midiIn;
+        std::vector<amsynth_midi_cc_t> midiOut;
+        for (int i = 0; i < 100; i++) {
+            if (i % 10 == 0) {
+                for (auto &synth : synths) {
+                    synth.setParameterValue(kAmsynthParameter_FilterType, (float)(i / 10 % 5));
+                    synth.setParameterValue(kAmsynthParameter_FilterSlope, (float)(i / 50));
+                }
+            }
+            synths[0].process(VoiceBoard::kMaxProcessBufferSize, midiIn, midiOut, fused[0], fused[1]);
+            synths[1].process(VoiceBoard::kMaxProcessBufferSize, midiIn, midiOut, staged[0], staged[1]);
+            // identical, unless the compiler contracts the two kernels into FMAs differently
+            for (int j = 0; j < VoiceBoard::kMaxProcessBufferSize; j++) {
+                assert(fabsf(fused[0][j] - staged[0][j]) < 1e-5f);
+                assert(fabsf(fused[1][j] - staged[1][j]) < 1e-5f);
+            }
+        }
+    }
+}
+
+TEST(testThreadedRenderingIsDeterministic) {
+    static float buffers[4][2][VoiceBoard::kMaxProcessBufferSize];
+    const int threads[4] = { 1, 2, 3, 4 };
+
+    Synthesizer synths[4];
+    for (int i = 0; i < 4; i++) {
+        synths[i].setSampleRate(44100);
+        synths[i].setParameterValue(kAmsynthParameter_FilterResonance, 0.5f);
+        synths[i].setProperty(PROP_NAME(render_threads), std::to_string(threads[i]).c_str());
+        assert(synths[i].getRenderThreads() == threads[i]);
+        // 20 voices is split into three tasks of up to 8 voices
+        for (int note = 40; note < 60; note++) {
+            synths[i]._voiceAllocationUnit->HandleMidiNoteOn(note, (float)note / 127.f, 0);
+        }
+    }
+
+    std::vector<amsynth_midi_event_t> midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+    for (int block = 0; block < 100; block++) {
+        for (int i = 0; i < 4; i++) {
+            synths[i].process(VoiceBoard::kMaxProcessBufferSize, midiIn, midiOut, buffers[i][0], buffers[i][1]);
+        }
+        // the reduction order is fixed, so any number of threads gives the same result
+        assert(memcmp(buffers[1], buffers[2], sizeof(buffers[1])) == 0);
+        assert(memcmp(buffers[1], buffers[3], sizeof(buffers[1])) == 0);
+        // and it only differs from single threaded rendering by rounding
+        for (int i = 0; i < VoiceBoard::kMaxProcessBufferSize; i++) {
+            assert(fabsf(buffers[0][0][i] - buffers[1][0][i]) < 1e-5f);
+        }
+    }
+}
+
+TEST(testIdleAfterTailDecays) {
+    static float buffer[2][VoiceBoard::kMaxProcessBufferSize];
+    const int blockSize = VoiceBoard::kMaxProcessBufferSize;
+
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    synth.setParameterValue(kAmsynthParameter_ReverbWet, 0.5f);
+    VoiceAllocationUnit *vau = synth._voiceAllocationUnit;
+
+    std::vector<amsynth_midi_event_t> midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+
+    processMidi(&synth, MIDI_STATUS_NOTE_ON, 60, 100);
+    for (int i = 0; i < 100; i++) {
+        synth.process(blockSize, midiIn, midiOut, buffer[0], buffer[1]);
+    }
+    processMidi(&synth, MIDI_STATUS_NOTE_OFF, 60, 0);
+    assert(!vau->isIdle());
+
+    // the reverb tail and limiter envelope decay within a few seconds
+    int blocks = 0;
+    while (!vau->isIdle() && blocks < 10 * 44100 / blockSize) {
+        synth.process(blockSize, midiIn, midiOut, buffer[0], buffer[1]);
+        blocks++;
+    }
+    assert(vau->isIdle());
+
+    memset(buffer, 0xff, sizeof(buffer));
+    synth.process(blockSize, midiIn, midiOut, buffer[0], buffer[1]);
+    for (int i = 0; i < blockSize; i++) {
+        assert(buffer[0][i] == 0.f && buffer[1][i] == 0.f);
+    }
+
+    // and a note wakes it up again
+    processMidi(&synth, MIDI_STATUS_NOTE_ON, 60, 100);
+    assert(!vau->isIdle());
+    float peak = 0;
+    for (int i = 0; i < 10; i++) {
+        synth.process(blockSize, midiIn, midiOut, buffer[0], buffer[1]);
+        for (int j = 0; j < blockSize; j++) {
+            peak = std::max(peak, fabsf(buffer[0][j]));
+        }
+    }
+    assert(peak > 0.01f);
+}
+
+TEST(testInaudibleVoicesRetireEarly) {
+    // larger than a voice's slice, so that blocks saved are counted in blocks
+    static float buffer[2][256];
+    const int blockSize = 256;
+
+    Synthesizer synths[2];
+    for (auto &synth : synths) {
+        synth.setSampleRate(44100);
+        synth.setBlockSize(blockSize);
+        synth.setParameterValue(kAmsynthParameter_AmpEnvRelease, 5.f);
+    }
+    synths[0].setProperty(PROP_NAME(voice_retire_threshold), "-30");
+    assert(synths[0].getProperties()[PROP_NAME(voice_retire_threshold)] == "-30");
+    // off unless asked for
+    assert(synths[1].getVoiceRetireThreshold() == VoiceAllocationUnit::kVoiceRetireNever);
+
+    std::vector<amsynth_midi_event_t> midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+    for (auto &synth : synths) {
+        // a soft note, below the threshold from the start
+        processMidi(&synth, MIDI_STATUS_NOTE_ON, 60, 5);
+        for (int i = 0; i < 100; i++) {
+            synth.process(blockSize, midiIn, midiOut, buffer[0], buffer[1]);
+        }
+        // a held voice is never retired, however quiet
+        assert(countActiveVoices(&synth) == 1);
+        processMidi(&synth, MIDI_STATUS_NOTE_OFF, 60, 0);
+    }
+
+    // half a second into the five second release
+    for (int i = 0; i < 44100 / 2 / blockSize; i++) {
+        for (auto &synth : synths) {
+            synth.process(blockSize, midiIn, midiOut, buffer[0], buffer[1]);
+        }
+    }
+    assert(countActiveVoices(&synths[0]) == 0);
+    assert(countActiveVoices(&synths[1]) == 1);
+
+    // roughly the rest of the release, which the other synth still has to render
+    VoiceAllocationUnit *vau = synths[1]._voiceAllocationUnit;
+    uint64_t remaining = vau->mVoices[vau->mNoteVoices[0][60]].board->getFramesRemaining() / blockSize;
+    uint64_t saved = synths[0]._voiceAllocationUnit->getStatistics().voiceBlocksSaved;
+    assert(saved > remaining && saved <= remaining + 44100 / 2 / blockSize + 1);
+    assert(synths[1]._voiceAllocationUnit->getStatistics().voiceBlocksSaved == 0);
+}
+
+TEST(testControlRateLFO) {
+    const int sampleRate = 44100, blockSize = VoiceBoard::kMaxProcessBufferSize;
+    static float audioRate[44100], controlRate[44100];
+
+    VoicePatch patch;
+    patch.lfoFreq = 5;
+    for (auto waveform : {Oscillator::Waveform::kSine, Oscillator::Waveform::kSaw}) {
+        patch.lfoWaveform = waveform;
+        Oscillator osc;
+        osc.SetSampleRate(sampleRate);
+        osc.SetWaveform(waveform);
+        ModulationLFO lfo;
+        lfo.SetSampleRate(sampleRate);
+        // odd block sizes move the control points around within the blocks
+        for (int i = 0, n = 1; i < sampleRate; i += n, n = (n + 7) % blockSize + 1) {
+            n = std::min(n, sampleRate - i);
+            osc.ProcessSamples(audioRate + i, n, patch.lfoFreq, patch.lfoPulseWidth);
+            lfo.process(controlRate + i, n, patch);
+        }
+        // the interpolated LFO trails the audio rate one by up to a control
+        // period, which at 5 Hz is a difference of up to 2 * pi * 5 * 16 / 44100
+        for (int i = 0; i < sampleRate; i++) {
+            assert(fabsf(audioRate[i] - controlRate[i]) < 0.015f);
+        }
+    }
+
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    assert(synth.getProperties()[PROP_NAME(lfo_mode)] == "voice");
+    synth.setProperty(PROP_NAME(lfo_mode), "global");
+    assert(synth.getProperties()[PROP_NAME(lfo_mode)] == "global");
+    assert(synth._voiceAllocationUnit->getSharedLFO());
+    synth.setParameterValue(kAmsynthParameter_LFOToAmp, 1.f);
+    processMidi(&synth, MIDI_STATUS_NOTE_ON, 60, 100);
+    processMidi(&synth, MIDI_STATUS_NOTE_ON, 64, 100);
+    assert(countActiveVoices(&synth) == 2);
+}
+
+TEST(testSVFMatchesBiquad) {
+    // At a fixed cutoff both engines are the bilinear transform of the same
+    // analog prototype, so they differ only by rounding
+    const SynthFilter::Type types[] = {
+        SynthFilter::Type::kLowPass, SynthFilter::Type::kHighPass,
+        SynthFilter::Type::kBandPass, SynthFilter::Type::kBandStop };
+    for (SynthFilter::Type type : types) for (SynthFilter::Slope slope : {SynthFilter::Slope::k12, SynthFilter::Slope::k24}) {
+        for (float res : {0.f, 0.5f, 0.9f}) {
+            SynthFilter biquad, svf;
+            biquad.SetSampleRate(44100);
+            svf.SetSampleRate(44100);
+            float expected[64], actual[64];
+            uint32_t seed = 1;
+            for (int block = 0; block < 50; block++) {
+                for (int i = 0; i < 64; i++) {
+                    seed = seed * 1664525 + 1013904223;
+                    expected[i] = actual[i] = (float)(int32_t)seed / 2147483648.f;
+                }
+                SynthFilter::Coefficients c;
+                SynthFilter::SVFCoefficients sc;
+                assert(biquad.computeCoefficients(c, 1000.f, res, type));
+                assert(svf.computeSVFCoefficients(sc, 1000.f, res, type));
+                if (slope == SynthFilter::Slope::k12) {
+                    biquad.process<SynthFilter::Slope::k12>(expected, 64, c);
+                    svf.processSVF<SynthFilter::Slope::k12>(actual, 64, sc);
+                } else {
+                    biquad.process<SynthFilter::Slope::k24>(expected, 64, c);
+                    svf.processSVF<SynthFilter::Slope::k24>(actual, 64, sc);
+                }
+                for (int i = 0; i < 64; i++) {
+                    assert(fabsf(expected[i] - actual[i]) < 1e-3f);
+                }
+            }
+        }
+    }
+}
+
+TEST(testFilterCoefficientCache) {
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    // Without key tracking, velocity or envelope modulation every voice has the same cutoff
+    synth.setParameterValue(kAmsynthParameter_FilterKeyTrackAmount, 0.f);
+    synth.setParameterValue(kAmsynthParameter_FilterKeyVelocityAmount, 0.f);
+    synth.setParameterValue(kAmsynthParameter_FilterEnvAmount, 0.f);
+    synth.setParameterValue(kAmsynthParameter_LFOToFilterCutoff, 0.f);
+    for (int note : {60, 64, 67, 72}) {
+        synth._voiceAllocationUnit->HandleMidiNoteOn(note, 1.f, 0);
+    }
+
+    static float buffers[2][VoiceBoard::kMaxProcessBufferSize];
+    std::vector<amsynth_midi_event_t> midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+    const int blocks = 20;
+    for (int i = 0; i < blocks; i++) {
+        synth.process(VoiceBoard::kMaxProcessBufferSize, midiIn, midiOut, buffers[0], buffers[1]);
+    }
+
+    const VoiceAllocationUnit::Statistics &stats = synth._voiceAllocationUnit->getStatistics();
+    assert(stats.filterCoefficientHits + stats.filterCoefficientMisses == 4 * blocks);
+    assert(stats.filterCoefficientMisses <= blocks);
+
+    // A hit returns exactly what computeCoefficients() would
+    SynthFilter filter;
+    filter.SetSampleRate(44100);
+    SynthFilter::CoefficientCache cache;
+    SynthFilter::Coefficients cached, computed;
+    for (int i = 0; i < 2; i++) {
+        assert(cache.get(cached, filter, 1234.5f, 0.3f, SynthFilter::Type::kBandPass));
+    }
+    assert(cache.hits == 1 && cache.misses == 1);
+    filter.computeCoefficients(computed, 1234.5f, 0.3f, SynthFilter::Type::kBandPass);
+    assert(memcmp(&cached, &computed, sizeof(cached)) == 0);
+    assert(!cache.get(cached, filter, 1234.5f, 0.3f, SynthFilter::Type::kBypass));
+}
+
+TEST(testEnvelopeAdvanceMatchesProcess) {
+    for (ADSR::Shape shape : {ADSR::Shape::kLinear, ADSR::Shape::kExponential}) {
+        ADSR::Parameters params;
+        params.attack = 0.01f;
+        params.decay = 0.02f;
+        params.sustain = 0.4f;
+        params.release = 0.03f;
+        params.shape = shape;
+        ADSR rendered(params), advanced(params);
+        float buffer[VoiceBoard::kMaxProcessBufferSize];
+        int n = 1;
+        for (int block = 0; block < 200; block++) {
+            if (block == 0) { rendered.triggerOn(); advanced.triggerOn(); }
+            if (block == 100) { rendered.triggerOff(); advanced.triggerOff(); }
+            n = n * 7 % VoiceBoard::kMaxProcessBufferSize + 1;
+            rendered.process(buffer, n);
+            const float last = advanced.advance(n);
+            assert(fabsf(last - buffer[n - 1]) < 1e-4f);
+            assert(fabsf(advanced.getValue() - rendered.getValue()) < 1e-4f);
+            assert(advanced.isConstant() == rendered.isConstant());
+        }
+        // the release has finished, and the envelope rests at 0
+        assert(rendered.isConstant() && rendered.getState() == 0);
+    }
+}
+
+TEST(testExponentialEnvelope) {
+    ADSR::Parameters params;
+    params.attack = 0.1f;
+    params.decay = 0.1f;
+    params.sustain = 0.5f;
+    params.release = 0.1f;
+    params.shape = ADSR::Shape::kExponential;
+    ADSR adsr(params);
+    adsr.SetSampleRate(1000);
+
+    static float buffer[100];
+    adsr.triggerOn();
+    adsr.process(buffer, 100);
+    // rises faster than a linear attack, and is at the peak when the decay begins
+    assert(buffer[50] > 0.6f && buffer[99] < 1.f);
+    assert(adsr.getValue() == 1.f);
+
+    adsr.process(buffer, 100);
+    // falls faster than a linear decay, and lands on the sustain level
+    assert(buffer[50] < 0.75f && buffer[99] > 0.5f);
+    assert(adsr.getValue() == 0.5f);
+    assert(adsr.isConstant());
+
+    adsr.triggerOff();
+    adsr.process(buffer, 100);
+    assert(buffer[50] < 0.25f && buffer[99] > 0.f);
+    assert(adsr.getState() == 0);
+}
+
+TEST(testReverbCombBankMatchesCombs) {
+    // The original per-sample freeverb signal path, built from comb and allpass
+    const int combTuning[2][numcombs] = {
+        { TUNING(combtuningL1, 44100), TUNING(combtuningL2, 44100), TUNING(combtuningL3, 44100), TUNING(combtuningL4, 44100),
+          TUNING(combtuningL5, 44100), TUNING(combtuningL6, 44100), TUNING(combtuningL7, 44100), TUNING(combtuningL8, 44100) },
+        { TUNING(combtuningR1, 44100), TUNING(combtuningR2, 44100), TUNING(combtuningR3, 44100), TUNING(combtuningR4, 44100),
+          TUNING(combtuningR5, 44100), TUNING(combtuningR6, 44100), TUNING(combtuningR7, 44100), TUNING(combtuningR8, 44100) } };
+    const int allpassTuning[2][numallpasses] = {
+        { TUNING(allpasstuningL1, 44100), TUNING(allpasstuningL2, 44100), TUNING(allpasstuningL3, 44100), TUNING(allpasstuningL4, 44100) },
+        { TUNING(allpasstuningR1, 44100), TUNING(allpasstuningR2, 44100), TUNING(allpasstuningR3, 44100), TUNING(allpasstuningR4, 44100) } };
+    static std::vector<float> storage(100000, 0.f);
+    comb combs[2][numcombs];
+    allpass allpasses[2][numallpasses];
+    float *next = storage.data();
+    for (int ch = 0; ch < 2; ch++) {
+        for (int i = 0; i < numcombs; i++) {
+            combs[ch][i].setbuffer(next, combTuning[ch][i]);
+            combs[ch][i].setfeedback(initialroom * scaleroom + offsetroom);
+            combs[ch][i].setdamp(initialdamp * scaledamp);
+            next += combTuning[ch][i];
+        }
+        for (int i = 0; i < numallpasses; i++) {
+            allpasses[ch][i].setbuffer(next, allpassTuning[ch][i]);
+            allpasses[ch][i].setfeedback(0.5f);
+            next += allpassTuning[ch][i];
+        }
+    }
+
+    // The delay lines are allocated for the rate, so a rate change must leave nothing behind
+    assert(sizeof(revmodel) < 4096);
+    static revmodel reverb;
+    reverb.setrate(192000);
+    reverb.setrate(44100);
+    reverb.setdry(0);
+
+    float wetz = 0;
+    uint32_t seed = 1;
+    float input[VoiceBoard::kMaxProcessBufferSize], output[2][VoiceBoard::kMaxProcessBufferSize];
+    for (int block = 0, n = 1; block < 2000; block++) {
+        n = n * 7 % VoiceBoard::kMaxProcessBufferSize + 1;
+        for (int i = 0; i < n; i++) {
+            seed = seed * 1664525 + 1013904223;
+            input[i] = block < 1000 ? (float)(int32_t)seed / 2147483648.f : 0.f;
+        }
+        reverb.processreplace(input, input, output[0], output[1], n, 1);
+        for (int i = 0; i < n; i++) {
+            float out[2] = {0, 0};
+            for (int ch = 0; ch < 2; ch++) {
+                for (int c = 0; c < numcombs; c++)
+                    out[ch] += combs[ch][c].process(input[i] * fixedgain);
+                for (int a = 0; a < numallpasses; a++)
+                    out[ch] = allpasses[ch][a].process(out[ch]);
+            }
+            // wet = 1 and width = 1, so each output is its own channel faded in by the de-zipper
+            const float w = (wetz += ((1.f - wetz) * 0.005F));
+            assert(fabsf(output[0][i] - out[0] * w) < 1e-6f);
+            assert(fabsf(output[1][i] - out[1] * w) < 1e-6f);
+        }
+    }
+}
+
+TEST(testFDNReverb) {
+    // The output does not depend on how the input is split into blocks
+    static FDNReverb reverbs[3];
+    static float in[2][44100], out[2][2][44100];
+    uint32_t seed = 1;
+    for (int i = 0; i < 44100; i++) {
+        seed = seed * 1664525 + 1013904223;
+        in[0][i] = in[1][i] = i < 4410 ? (float)(int32_t)seed / 2147483648.f : 0.f;
+    }
+    for (int r = 0; r < 2; r++) {
+        reverbs[r].setWet(1);
+        reverbs[r].setDry(0);
+        for (int i = 0, n = 1; i < 44100; i += n) {
+            n = std::min(r ? n * 7 % 97 + 1 : 64, 44100 - i);
+            reverbs[r].processMix(in[0] + i, in[1] + i, out[r][0] + i, out[r][1] + i, n, 1);
+        }
+    }
+    assert(!memcmp(out[0], out[1], sizeof(out[0])));
+
+    // The mono input path matches, given the sum of the stereo inputs
+    static float mono[2][44100];
+    reverbs[2].setWet(1);
+    reverbs[2].setDry(0);
+    for (int i = 0; i < 44100; i += 64) {
+        reverbs[2].processMix(in[0] + i, 2.f, mono[0] + i, mono[1] + i, std::min(64, 44100 - i));
+    }
+    assert(!memcmp(mono, out[0], sizeof(mono)));
+
+    // A decaying tail, which is different in each channel
+    double early = 0, late = 0, difference = 0;
+    for (int i = 4410; i < 8820; i++) {
+        early += out[0][0][i] * out[0][0][i];
+        difference += fabs(out[0][0][i] - out[0][1][i]);
+    }
+    for (int i = 44100 - 4410; i < 44100; i++) {
+        late += out[0][0][i] * out[0][0][i];
+    }
+    assert(early > 1 && late < early / 1000 && late > 0);
+    assert(difference > 10);
+
+    Synthesizer synth;
+    assert(synth.getProperties()[PROP_NAME(reverb_engine)] == "freeverb");
+    synth.setProperty(PROP_NAME(reverb_engine), "fdn");
+    assert(synth.getProperties()[PROP_NAME(reverb_engine)] == "fdn");
+    assert(synth._voiceAllocationUnit->getReverbEngine() == VoiceAllocationUnit::ReverbEngine::kFDN);
+    // the audio thread only switches engines at the start of a block
+    assert(synth._voiceAllocationUnit->mReverbEngine == VoiceAllocationUnit::ReverbEngine::kFreeverb);
+
+    // and its tail decays to idle, as freeverb's does
+    synth.setSampleRate(44100);
+    synth.setParameterValue(kAmsynthParameter_ReverbWet, 1.0f);
+    std::vector<amsynth_midi_event_t> midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+    float *left = out[0][0], *right = out[0][1];
+    float peak = 0;
+    processMidi(&synth, MIDI_STATUS_NOTE_ON, 60, 100);
+    for (int i = 0; i < 20; i++) {
+        synth.process(VoiceBoard::kMaxProcessBufferSize, midiIn, midiOut, left, right);
+        for (int j = 0; j < VoiceBoard::kMaxProcessBufferSize; j++)
+            peak = std::max(peak, fabsf(left[j]));
+    }
+    assert(peak > 0.01f);
+    assert(synth._voiceAllocationUnit->mReverbEngine == VoiceAllocationUnit::ReverbEngine::kFDN);
+    processMidi(&synth, MIDI_STATUS_NOTE_OFF, 60, 0);
+    for (int blocks = 0; !synth._voiceAllocationUnit->isIdle() && blocks < 10 * 44100 / VoiceBoard::kMaxProcessBufferSize; blocks++) {
+        synth.process(VoiceBoard::kMaxProcessBufferSize, midiIn, midiOut, left, right);
+    }
+    assert(synth._voiceAllocationUnit->isIdle());
+}
+
+TEST(testDistortion) {
+    const int numFrames = 8192;
+    static float in[numFrames], out[numFrames];
+    for (int i = 0; i < numFrames; i++) {
+        in[i] = 0.8f * sinf(i * 2 * m::pi * 1000 / 44100);
+    }
+
+    // With no crunch the signal is untouched
+    Distortion distortion;
+    memcpy(out, in, sizeof(in));
+    distortion.Process(out, numFrames);
+    assert(!memcmp(out, in, sizeof(in)));
+
+    // otherwise it follows the curve, once faded in
+    distortion.SetCrunch(0.6f);
+    memcpy(out, in, sizeof(in));
+    distortion.Process(out, Distortion::kFadeFrames);
+    assert(fabsf(out[10] - in[10]) < 0.01f);
+    float x = 1e-9f, maxError = 0;
+    for (int i = 0; i < 600; i++, x *= 1.04f) {
+        float y[2] = { x, -x };
+        distortion.Process(y, 2);
+        const float expected = powf(x, 0.4f);
+        maxError = std::max(maxError, std::max(fabsf(y[0] - expected), fabsf(y[1] + expected)) / expected);
+    }
+    assert(maxError < 4e-5f);
+
+    // Changes during a fade are picked up once it finishes
+    distortion.SetCrunch(0.2f);
+    memcpy(out, in, sizeof(in));
+    distortion.Process(out, 100);
+    distortion.SetCrunch(0.8f);
+    distortion.Process(out + 100, 2 * Distortion::kFadeFrames);
+    float y[2] = { 0.5f, -0.5f };
+    distortion.Process(y, 2);
+    assert(fabsf(y[0] - powf(0.5f, 0.2f)) < 1e-4f && fabsf(y[1] + powf(0.5f, 0.2f)) < 1e-4f);
+
+    // Oversampling delays the signal, and is otherwise transparent below a quarter of the sample rate
+    distortion.SetCrunch(0);
+    distortion.SetOversampling(true);
+    assert(distortion.getLatency() == Distortion::kOversamplingLatency);
+    memcpy(out, in, sizeof(in));
+    for (int i = 0; i < numFrames; i += 37) {
+        distortion.Process(out + i, std::min(37, numFrames - i));
+    }
+    for (int i = Distortion::kFadeFrames + Distortion::kOversamplingLatency; i < numFrames; i++) {
+        assert(fabsf(out[i] - in[i - Distortion::kOversamplingLatency]) < 1e-3f);
+    }
+
+    // and removes most of the aliasing: the 3rd harmonic of 15 kHz folds back to 900 Hz
+    float aliased[2];
+    for (int oversampling = 0; oversampling < 2; oversampling++) {
+        Distortion d;
+        d.SetCrunch(0.6f);
+        d.SetOversampling(oversampling);
+        for (int i = 0; i < numFrames; i++) {
+            out[i] = 0.5f * sinf(i * 2 * m::pi * 15000 / 44100);
+        }
+        d.Process(out, numFrames);
+        aliased[oversampling] = (float)goertzel(out + numFrames / 2, numFrames / 2, 900, 44100);
+    }
+    assert(aliased[1] * 10 < aliased[0]);
+}
+
+TEST(testSoftLimiter) {
+    const int numFrames = 4410;
+    static float in[2][numFrames], out[2][2][numFrames];
+    for (int i = 0; i < numFrames; i++) {
+        const float envelope = i < numFrames / 2 ? 0.4f : 2.f;
+        in[0][i] = envelope * sinf(i * 0.05f);
+        in[1][i] = envelope * sinf(i * 0.07f);
+    }
+
+    // Quiet signals are passed through untouched
+    SoftLimiter limiter;
+    limiter.SetSampleRate(44100);
+    assert(limiter.getLatency() == 0);
+    memcpy(out[0], in, sizeof(in));
+    limiter.Process(out[0][0], out[0][1], numFrames / 2);
+    assert(!memcmp(out[0][0], in[0], numFrames / 2 * sizeof(float)));
+    assert(!memcmp(out[0][1], in[1], numFrames / 2 * sizeof(float)));
+
+    // and loud ones brought down to the threshold, soon after the onset
+    limiter.Process(out[0][0] + numFrames / 2, out[0][1] + numFrames / 2, numFrames / 2);
+    float peak = 0;
+    for (int i = numFrames / 2 + 441; i < numFrames; i++) {
+        peak = std::max(peak, fabsf(out[0][0][i]) + fabsf(out[0][1][i]));
+    }
+    assert(peak > 0.85f && peak < 0.95f);
+
+    // With look-ahead no sample exceeds the threshold, however the input is split
+    for (int split = 0; split < 2; split++) {
+        limiter.SetSampleRate(44100);
+        limiter.SetLookahead(true);
+        assert(limiter.getLatency() == SoftLimiter::kLookaheadFrames);
+        memcpy(out[split], in, sizeof(in));
+        for (int i = 0, n = 1; i < numFrames; i += n) {
+            n = std::min(split ? n * 7 % 97 + 1 : 64, numFrames - i);
+            limiter.Process(out[split][0] + i, out[split][1] + i, n);
+        }
+    }
+    assert(!memcmp(out[0], out[1], sizeof(out[0])));
+    for (int i = 0; i < numFrames; i++) {
+        assert(fabsf(out[0][0][i]) + fabsf(out[0][1][i]) <= 0.9f * 1.0001f);
+        if (i >= SoftLimiter::kLookaheadFrames && i < numFrames / 2) {
+            assert(out[0][0][i] == in[0][i - SoftLimiter::kLookaheadFrames]);
+        }
+    }
+}
+
+TEST(testPipelinedEffects) {
+    const int numFrames = 44100, latency = 64, hostBlock = 37;
+    static float out[2][2][numFrames];
+
+    Synthesizer synths[2];
+    for (auto &synth : synths) {
+        synth.setSampleRate(44100);
+        synth.setParameterValue(kAmsynthParameter_ReverbWet, 0.5f);
+        synth.setParameterValue(kAmsynthParameter_AmpDistortion, 0.3f);
+    }
+    assert(synths[1].getProperties()[PROP_NAME(pipelined_effects)] == "0");
+    assert(synths[1].getLatency() == 0);
+    synths[1].setProperty(PROP_NAME(pipelined_effects), "1");
+    assert(synths[1].getProperties()[PROP_NAME(pipelined_effects)] == "1");
+    assert(synths[1].getLatency() == latency);
+
+    unsigned char notes[4][3];
+    std::vector<amsynth_midi_event_t> chord, midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+    for (int i = 0; i < 4; i++) {
+        notes[i][0] = MIDI_STATUS_NOTE_ON;
+        notes[i][1] = (unsigned char)(48 + i * 4);
+        notes[i][2] = 100;
+        chord.push_back({ 0, 3, notes[i] });
+    }
+
+    // The pipelined synth is run in blocks that straddle its internal blocks,
+    // and the other is split in the same places so that the voices render the same
+    for (int i = 0, n; i < numFrames; i += n) {
+        n = std::min(hostBlock - i % hostBlock, latency - i % latency);
+        n = std::min(n, numFrames - i);
+        synths[0].process(n, i ? midiIn : chord, midiOut, out[0][0] + i, out[0][1] + i);
+    }
+    for (int i = 0, n; i < numFrames; i += n) {
+        n = std::min(hostBlock, numFrames - i);
+        synths[1].process(n, i ? midiIn : chord, midiOut, out[1][0] + i, out[1][1] + i);
+    }
+
+    float peak = 0;
+    for (int i = 0; i < numFrames; i++) {
+        peak = std::max(peak, fabsf(out[0][0][i]));
+        if (i < latency) {
+            assert(out[1][0][i] == 0.f && out[1][1][i] == 0.f);
+        } else {
+            assert(out[1][0][i] == out[0][0][i - latency]);
+            assert(out[1][1][i] == out[0][1][i - latency]);
+        }
+    }
+    assert(peak > 0.01f);
+
+    synths[1].setPipelinedEffects(false);
+    assert(synths[1].getLatency() == 0);
+}
+
+TEST(testBlockSize) {
+    const int numFrames = 22050, hostBlock = 512;
+    static float out[6][2][numFrames];
+
+    Synthesizer synth;
+    assert(synth.getProperties()[PROP_NAME(block_size)] == "64");
+    synth.setProperty(PROP_NAME(block_size), "1000");
+    assert(synth.getProperties()[PROP_NAME(block_size)] == "512");
+    synth.setProperty(PROP_NAME(block_size), "1");
+    assert(synth.getProperties()[PROP_NAME(block_size)] == "16");
+
+    unsigned char notes[12][3];
+    std::vector<amsynth_midi_event_t> chord, midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+    for (int i = 0; i < 12; i++) {
+        notes[i][0] = MIDI_STATUS_NOTE_ON;
+        notes[i][1] = (unsigned char)(36 + i * 5);
+        notes[i][2] = 100;
+        chord.push_back({ 0, 3, notes[i] });
+    }
+
+    // Voices update their control signals every 64 frames whatever the block
+    // size, so larger blocks, rendered on one thread or several, sound the same
+    for (const char *lfoMode : {"voice", "global"}) {
+        Synthesizer synths[6];
+        const int blockSizes[6] = { 64, 128, 512, 64, 512, 512 };
+        for (int s = 0; s < 6; s++) {
+            synths[s].setSampleRate(44100);
+            synths[s].setParameterValue(kAmsynthParameter_ReverbWet, 0.5f);
+            synths[s].setParameterValue(kAmsynthParameter_AmpDistortion, 0.3f);
+            synths[s].setParameterValue(kAmsynthParameter_LFOToFilterCutoff, 1.f);
+            synths[s].setLFOMode(lfoMode);
+            synths[s].setBlockSize(blockSizes[s]);
+        }
+        synths[3].setRenderThreads(2);
+        synths[4].setRenderThreads(2);
+        synths[5].setPipelinedEffects(true);
+        assert(synths[0].getLatency() == 0);
+        assert(synths[5].getLatency() == 512);
+
+        for (int s = 0; s < 6; s++) {
+            for (int i = 0; i < numFrames; i += hostBlock) {
+                const int n = std::min(hostBlock, numFrames - i);
+                synths[s].process(n, i ? midiIn : chord, midiOut, out[s][0] + i, out[s][1] + i);
+            }
+        }
+
+        float peak = 0;
+        for (int i = 0; i < numFrames; i++) {
+            peak = std::max(peak, fabsf(out[0][0][i]));
+            for (int s = 1; s < 3; s++) {
+                assert(out[s][0][i] == out[0][0][i] && out[s][1][i] == out[0][1][i]);
+            }
+            // threads sum the voices in a different order, but the same for every block size
+            assert(out[4][0][i] == out[3][0][i] && out[4][1][i] == out[3][1][i]);
+            if (i >= 512) {
+                assert(out[5][0][i] == out[0][0][i - 512] && out[5][1][i] == out[0][1][i - 512]);
+            }
+        }
+        assert(peak > 0.01f);
+    }
+
+    // and the smallest blocks still render
+    synth.setSampleRate(44100);
+    float peak = 0;
+    for (int i = 0; i < 8; i++) {
+        synth.process(hostBlock, i ? midiIn : chord, midiOut, out[0][0], out[0][1]);
+        for (int j = 0; j < hostBlock; j++) {
+            peak = std::max(peak, fabsf(out[0][0][j]));
+        }
+    }
+    assert(peak > 0.01f);
+}
+
+TEST(testControllerRamps) {
+    static float buffer[2][2][512];
+    struct Recorder : Parameter::Observer {
+        std::vector<float> values;
+        void parameterDidChange(const Parameter &parameter) override { values.push_back(parameter.getNormalisedValue()); }
+    } recorder;
+
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    assert(synth.getProperties()[PROP_NAME(controller_ramps)] == "0");
+    synth.setProperty(PROP_NAME(controller_ramps), "1");
+    assert(synth.getProperties()[PROP_NAME(controller_ramps)] == "1");
+
+    const unsigned char cc = MIDI_CC_SOUND_CONTROLLER_5;
+    synth.getMidiController()->setControllerForParameter(kAmsynthParameter_FilterCutoff, cc);
+    Parameter &cutoff = synth.getPresetController()->getCurrentPreset().getParameter(kAmsynthParameter_FilterCutoff);
+    cutoff.setNormalisedValue(0.f);
+    std::vector<amsynth_midi_event_t> midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+    synth.process(512, midiIn, midiOut, buffer[1][0], buffer[1][1]);
+    midiOut.clear();
+    cutoff.addObserver(&recorder, false);
+
+    // The parameter ramps towards an event, reaching it at the event's frame
+    unsigned char midi[512][3] = {{ MIDI_STATUS_CONTROLLER, cc, 127 }};
+    midiIn = {{ 256, 3, midi[0] }};
+    synth.process(512, midiIn, midiOut, buffer[1][0], buffer[1][1]);
+    assert(recorder.values.size() == 4);
+    for (int i = 0; i < 4; i++) {
+        assert(fabsf(recorder.values[i] - (i + 1) / 4.f) < 1e-6f);
+    }
+    assert(midiOut.empty() || 0 == "ramped controllers should not be echoed");
+
+    // and however dense the controller data, moves once per 64 frames
+    recorder.values.clear();
+    midiIn.clear();
+    for (int i = 0; i < 512; i++) {
+        midi[i][0] = MIDI_STATUS_CONTROLLER;
+        midi[i][1] = cc;
+        midi[i][2] = (unsigned char)(127 - i / 4);
+        midiIn.push_back({ (unsigned)i, 3, midi[i] });
+    }
+    synth.process(512, midiIn, midiOut, buffer[1][0], buffer[1][1]);
+    assert(recorder.values.size() == 8);
+    for (size_t i = 1; i < recorder.values.size(); i++) {
+        assert(recorder.values[i] < recorder.values[i - 1]);
+    }
+    assert(cutoff.getMidiValue() == 0);
+    cutoff.removeObserver(&recorder);
+
+    // The pitch wheel ramps too
+    unsigned char bend[3] = { MIDI_STATUS_PITCH_WHEEL, 0x7f, 0x7f };
+    midiIn = {{ 128, 3, bend }};
+    synth.process(512, midiIn, midiOut, buffer[1][0], buffer[1][1]);
+    assert(synth._voiceAllocationUnit->mPitchBendValue == powf(2.f, 8191.f / 8192.f * 2.f / 12.f));
+
+    // Notes still start at their exact frame, as without ramps
+    Synthesizer synths[2];
+    for (auto &synth : synths) {
+        synth.setSampleRate(44100);
+    }
+    synths[1].setControllerRamps(true);
+    unsigned char notes[2][3] = {{ MIDI_STATUS_NOTE_ON, 60, 100 }, { MIDI_STATUS_NOTE_ON, 67, 100 }};
+    midiIn = {{ 100, 3, notes[0] }, { 301, 3, notes[1] }};
+    for (int i = 0; i < 2; i++) {
+        synths[i].process(512, midiIn, midiOut, buffer[i][0], buffer[i][1]);
+    }
+    for (int i = 0; i < 512; i++) {
+        assert(buffer[0][0][i] == buffer[1][0][i] && buffer[0][1][i] == buffer[1][1][i]);
+    }
+    assert(buffer[1][0][99] == 0.f && buffer[1][0][101] != 0.f);
+
+    // A driver may pass several messages as one event; none are ramped, so
+    // the note after the CC still plays
+    for (auto &synth : synths) {
+        synth.getMidiController()->setControllerForParameter(kAmsynthParameter_FilterCutoff, cc);
+    }
+    unsigned char chunk[6] = { MIDI_STATUS_CONTROLLER, cc, 100, MIDI_STATUS_NOTE_ON, 72, 100 };
+    midiIn = {{ 0, 6, chunk }};
+    for (int i = 0; i < 2; i++) {
+        synths[i].process(512, midiIn, midiOut, buffer[i][0], buffer[i][1]);
+    }
+    for (int i = 0; i < 512; i++) {
+        assert(buffer[0][0][i] == buffer[1][0][i] && buffer[0][1][i] == buffer[1][1][i]);
+    }
+    assert(synths[1].getPresetController()->getCurrentPreset().getParameter(kAmsynthParameter_FilterCutoff).getMidiValue() == 100);
+
+    // and a ramped CC still sets the running status for the events after it
+    unsigned char running[2][3] = {{ MIDI_STATUS_CONTROLLER, cc, 10 }, { cc, 20 }};
+    midiIn = {{ 0, 3, running[0] }, { 128, 2, running[1] }};
+    synths[1].process(512, midiIn, midiOut, buffer[1][0], buffer[1][1]);
+    assert(synths[1].getPresetController()->getCurrentPreset().getParameter(kAmsynthParameter_FilterCutoff).getMidiValue() == 20);
+}
+
+TEST(testDenormalGuard) {
+#if DENORMAL_GUARD_SSE || DENORMAL_GUARD_ARM
+    volatile float small = 1e-30f, scale = 1e-10f;
+    assert(small * scale != 0.f);
+    {
+        DenormalGuard denormalGuard;
+        assert(small * scale == 0.f);
+        {
+            DenormalGuard nested;
+        }
+        assert(small * scale == 0.f || 0 == "an inner guard should restore the mode set by the outer one");
+    }
+    assert(small * scale != 0.f);
+
+    // and the host's mode survives processing
+    static float buffer[2][64];
+    std::vector<amsynth_midi_event_t> midiIn;
+    std::vector<amsynth_midi_cc_t> midiOut;
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    synth.process(64, midiIn, midiOut, buffer[0], buffer[1]);
+    assert(small * scale != 0.f);
+#endif
+}
+
+TEST(testEventBuffer) {
+    unsigned char data[4][3] = {};
+    EventBuffer<amsynth_midi_event_t, 4> events;
+    events.insertSorted({ 10, 3, data[0] });
+    events.insertSorted({ 5, 3, data[1] });
+    events.insertSorted({ 10, 3, data[2] });
+    events.insertSorted({ 0, 3, data[3] });
+    assert(events.size() == 4);
+    // sorted, with events at the same offset kept in arrival order
+    assert(events[0].buffer == data[3] && events[1].buffer == data[1]);
+    assert(events[2].buffer == data[0] && events[3].buffer == data[2]);
+    assert(!events.push_back({ 20, 3, data[0] }) && !events.insertSorted({ 0, 3, data[0] }));
+    events.clear();
+    assert(events.empty());
+}
+
+TEST(testProcessDoesNotAllocate) {
+    static float buffer[2][1024];
+    unsigned char notes[8][3], cc[64][3];
+    MidiEventBuffer midiIn;
+    MidiOutputBuffer midiOut;
+
+    Synthesizer synth;
+    synth.setSampleRate(44100);
+    synth.setRenderThreads(2);
+    synth.setPipelinedEffects(true);
+    synth.setControllerRamps(true);
+    synth.getMidiController()->setControllerForParameter(kAmsynthParameter_FilterCutoff, 74);
+    synth.getMidiController()->setControllerForParameter(kAmsynthParameter_ReverbWet, 75);
+
+    for (unsigned i = 0; i < 8; i++) {
+        notes[i][0] = MIDI_STATUS_NOTE_ON; notes[i][1] = (unsigned char)(48 + i * 4); notes[i][2] = 100;
+        midiIn.insertSorted({ i * 100, 3, notes[i] });
+    }
+    for (unsigned i = 0; i < 64; i++) {
+        cc[i][0] = MIDI_STATUS_CONTROLLER; cc[i][1] = (unsigned char)(i % 2 ? 74 : 75); cc[i][2] = (unsigned char)i;
+        midiIn.insertSorted({ i * 16, 3, cc[i] });
+    }
+
+    // The counter sees array and over-aligned allocations too
+    s_allocations = 0;
+    s_countAllocations = true;
+    float *volatile array = new float[4];
+    s_countAllocations = false;
+    assert(s_allocations == 1);
+    delete[] array;
+#if __cpp_aligned_new
+    struct alignas(64) Aligned { float x[16]; };
+    s_countAllocations = true;
+    Aligned *volatile aligned = new Aligned;
+    s_countAllocations = false;
+    assert(s_allocations == 2);
+    assert(((uintptr_t)aligned & 63) == 0);
+    delete aligned;
+#endif
+
+    s_allocations = 0;
+    s_countAllocations = true;
+    synth.process(1024, midiIn.data(), midiIn.size(), midiOut, buffer[0], buffer[1]);
+    for (int i = 0; i < 8; i++)
+        synth.process(1024, nullptr, 0, midiOut, buffer[0], buffer[1]);
+    s_countAllocations = false;
+    assert(s_allocations == 0);
+    assert(!midiOut.empty());
+}
+
 #define RUN_TEST(testFunction) do { printf("%s()... ", #testFunction); testFunction(); printf("OK\n"); } while (0)
 
 int main(int argc, const char * argv[])  {
@@ -209,6 +1445,34 @@ int main(int argc, const char * argv[])  {
     RUN_TEST(testPresetIgnoredParameters);
     RUN_TEST(testPresetValueStrings);
     RUN_TEST(testMidiAllNotesOff);
+    RUN_TEST(testVoiceStealing);
+    RUN_TEST(testVoicePoolFollowsMaxPolyphony);
+    RUN_TEST(testSameNoteOnDifferentChannels);
+    RUN_TEST(testSameNoteOnDifferentChannelsInLegatoMode);
+    RUN_TEST(testMonoModeKeyOrder);
     RUN_TEST(testOscillatorHighFrequency);
+    RUN_TEST(testWavetableOscillator);
+    RUN_TEST(testPolyBLEPOscillator);
+    RUN_TEST(testFastMath);
+    RUN_TEST(testDenormalGuard);
+    RUN_TEST(testControlRateLFO);
+    RUN_TEST(testSVFMatchesBiquad);
+    RUN_TEST(testFilterCoefficientCache);
+    RUN_TEST(testEnvelopeAdvanceMatchesProcess);
+    RUN_TEST(testExponentialEnvelope);
+    RUN_TEST(testReverbCombBankMatchesCombs);
+    RUN_TEST(testFDNReverb);
+    RUN_TEST(testDistortion);
+    RUN_TEST(testSoftLimiter);
+    RUN_TEST(testPipelinedEffects);
+    RUN_TEST(testBlockSize);
+    RUN_TEST(testControllerRamps);
+    RUN_TEST(testEventBuffer);
+    RUN_TEST(testProcessDoesNotAllocate);
+    RUN_TEST(testBatchRenderingMatchesPerVoiceRendering);
+    RUN_TEST(testFusedKernelMatchesStagedKernel);
+    RUN_TEST(testThreadedRenderingIsDeterministic);
+    RUN_TEST(testIdleAfterTailDecays);
+    RUN_TEST(testInaudibleVoicesRetireEarly);
     return 0;
 }